@@ -13,7 +13,7 @@
 static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli::StrBuilder& error) {
     auto verbose = cmd->GetBool("verbose");
     if (verbose) {
-        logger::level = logger::LOG_DEBUG;
+        logger::SetLevel(logger::LOG_DEBUG);
     }
 
     if (!AnimToolAnimate(
@@ -28,6 +28,7 @@ static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli:
             cmd->GetStr("format"),
 
             cmd->GetBool("minimize_size"),
+            cmd->GetBool("global_palette"),
             verbose,
 
             cmd->GetBool("lossless"),
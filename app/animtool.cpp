@@ -9,6 +9,10 @@
 #include "count_cmd.h"
 #include "cluster_cmd.h"
 #include "blur_cmd.h"
+#include "batch_cmd.h"
+#include "serve_cmd.h"
+#include "bench_cmd.h"
+#include "trace_flag.h"
 
 int main(int argc, char *argv[]) {
     cli::App app {
@@ -57,5 +61,19 @@ int main(int argc, char *argv[]) {
     CmdBlurInit(&blur);
     app.AddCmd(&blur);
 
+    cli::Cmd bench {};
+    CmdBenchInit(&bench);
+    app.AddCmd(&bench);
+
+    cli::Cmd batch {};
+    CmdBatchInit(&batch, &app);
+    app.AddCmd(&batch);
+
+    cli::Cmd serve {};
+    CmdServeInit(&serve, &app);
+    app.AddCmd(&serve);
+
+    AppAddTraceFlag(&app);
+
     return app.Run(argc, argv);
 }
@@ -0,0 +1,109 @@
+#include "batch_cmd.h"
+#include "cli.h"
+#include "job.h"
+
+#include "core/piccache.h"
+
+#include "utils/parallel.h"
+#include "utils/pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli::StrBuilder& error) {
+    auto app = reinterpret_cast<cli::App*>(context);
+    auto manifest = cmd->GetFirstArg();
+
+    std::vector<Job> jobs;
+    if (!JobReadManifest(manifest, &jobs)) {
+        error.AddText("Cannot read the manifest %s", manifest);
+        return cli::ACTION_FAILED;
+    }
+
+    PicCacheGetShared()->SetMaxBytes(static_cast<size_t>(std::max(cmd->GetInt("image_cache_mb"), 0)) << 20);
+
+    auto n_threads = cmd->GetInt("jobs");
+    if (n_threads <= 0) {
+        n_threads = ParallelGetThreadCount();
+    }
+
+    std::mutex report_mutex;
+    std::atomic<int> n_failed(0);
+    auto batch_start = std::chrono::steady_clock::now();
+
+    {
+        ThreadPool pool(n_threads, n_threads);
+
+        for (auto& job : jobs) {
+            pool.Submit([app, &job, &report_mutex, &n_failed]() {
+                auto start = std::chrono::steady_clock::now();
+
+                cli::StrBuilder job_error;
+                std::string output;
+                auto result = JobRunLine(app, job.line, job_error, &output);
+
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                if (result != cli::ACTION_OK) {
+                    ++n_failed;
+                }
+
+                std::lock_guard<std::mutex> lock(report_mutex);
+                fprintf(stdout, "#%d %s %.1f ms: %s\n", job.line_number, result == cli::ACTION_OK ? "ok" : "failed",
+                        elapsed.count(), job.line.c_str());
+                fwrite(output.data(), 1, output.size(), stdout);
+                if (job_error.cur != job_error.buf) {
+                    fprintf(stdout, "#%d error: %s\n", job.line_number, job_error.buf);
+                }
+                fflush(stdout);
+            });
+        }
+    }
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - batch_start;
+    fprintf(stdout, "%d jobs, %d failed, %.1f ms on %d threads\n",
+            static_cast<int>(jobs.size()), n_failed.load(), elapsed.count(), n_threads);
+
+    return n_failed > 0 ? cli::ACTION_FAILED : cli::ACTION_OK;
+}
+
+void CmdBatchInit(cli::Cmd* cmd, cli::App* app) {
+    *cmd = cli::Cmd {
+            .name = "batch",
+            .desc = "Run the jobs of a manifest on a pool of threads.",
+            .usage = "[command options] MANIFEST_FILE_PATH",
+            .examples = {
+                    "animtool batch jobs.txt -j 8",
+                    "",
+                    "jobs.txt has one command per line, without the leading `animtool`. Lines starting with # are ignored:",
+                    "    dropframes -o /path/to/output.webp -R 15 /path/to/input.gif",
+                    "    overlay --layer /path/to/layer.png -o /path/to/output.webp /path/to/input.webp",
+            },
+            .n_args = 1,
+            .args_desc = "Path of the manifest, - for stdin. "
+                         "Jobs keep running when one fails, the status and time of each is printed once it is done.",
+            .context = app,
+            .action = CmdAction
+    };
+
+    cmd->AddFlag(cli::Flag{
+            .name = "jobs",
+            .short_aliases = {'j'},
+            .desc = "Number of jobs to run at the same time, 0 for one per hardware thread.",
+            .type = cli::FLAG_INT,
+            .required = 0,
+            .multiple = 0,
+            .default_value = { .int_value = 0 }
+    });
+
+    cmd->AddFlag(cli::Flag{
+            .name = "image_cache_mb",
+            .desc = "Memory for the decoded images shared by the animate jobs, in MiB. 0 to decode them every time.",
+            .type = cli::FLAG_INT,
+            .required = 0,
+            .multiple = 0,
+            .default_value = { .int_value = PIC_CACHE_DEFAULT_MAX_BYTES >> 20 }
+    });
+}
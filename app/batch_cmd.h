@@ -0,0 +1,14 @@
+#ifndef ANIMTOOL_BATCH_CMD_H
+#define ANIMTOOL_BATCH_CMD_H
+
+
+namespace cli {
+    struct Cmd;
+    struct App;
+} // namespace cli
+
+// The jobs of the manifest run commands of `app`.
+void CmdBatchInit(cli::Cmd* cmd, cli::App* app);
+
+
+#endif //ANIMTOOL_BATCH_CMD_H
@@ -0,0 +1,512 @@
+#include "bench_cmd.h"
+#include "cli.h"
+#include "output_flags.h"
+
+#include "core/addlayer.h"
+#include "core/animate.h"
+#include "core/animenc.h"
+#include "core/blur.h"
+#include "core/dropframes.h"
+#include "core/stagetime.h"
+#include "core/cg.h"
+
+#include "core/check.h"
+#include "core/logger.h"
+#include "utils/defer.h"
+
+#include "webp/encode.h"
+#include "webp/mux_types.h" // WebPData
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// The corpus is generated in memory from fixed seeds, so every build box benchmarks the same bytes.
+struct CorpusAnim {
+    const char* name;
+    const char* format;
+    int width;
+    int height;
+    int n_frames;
+    int duration;
+    int alpha;    // transparent background and soft edges
+    int n_colors; // flat colors out of n_colors, 0 for noisy gradients
+};
+
+static const CorpusAnim kCorpusAnims[] = {
+    { .name = "sticker", .format = "gif", .width = 240, .height = 240, .n_frames = 24, .duration = 40, .alpha = 1, .n_colors = 16 },
+    { .name = "sticker", .format = "webp", .width = 240, .height = 240, .n_frames = 24, .duration = 40, .alpha = 1, .n_colors = 0 },
+    { .name = "clip", .format = "gif", .width = 480, .height = 270, .n_frames = 48, .duration = 40, .alpha = 0, .n_colors = 0 },
+    { .name = "clip", .format = "webp", .width = 960, .height = 540, .n_frames = 24, .duration = 40, .alpha = 0, .n_colors = 64 },
+};
+
+#define N_CORPUS_PHOTOS 8
+#define CORPUS_PHOTO_WIDTH 800
+#define CORPUS_PHOTO_HEIGHT 600
+#define CORPUS_LAYER_SIZE 64
+
+struct Corpus {
+    std::vector<AnimEncoderBuffer> anims; // encoded kCorpusAnims
+    std::vector<WebPData> photos;         // still WebP images for animate
+    WebPData layer;                       // still WebP image with alpha for overlay
+};
+
+struct BenchSettings {
+    int repeat;
+    const char* filter;
+
+    int minimize_size;
+    int global_palette;
+    int verbose;
+    int lossless;
+    float quality;
+    int method;
+    int pass;
+};
+
+struct BenchRun {
+    double wall_ms;
+    long peak_rss_kb;
+    int64_t stage_ns[N_STAGES];
+};
+
+// xorshift32, so that the corpus is the same on every platform
+static uint32_t NextRandom(uint32_t* state) {
+    auto x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static cg::Color PaletteColor(int i) {
+    return cg::Color((i * 97) & 0xFF, (i * 57 + 80) & 0xFF, (i * 151 + 160) & 0xFF, 0xFF);
+}
+
+// A disc moving across the canvas, over a background of bands or noisy gradients.
+static void DrawAnimFrame(WebPPicture* pic, const CorpusAnim& anim, int index) {
+    uint32_t state = 0x9E3779B9u + index;
+    const int w = anim.width;
+    const int h = anim.height;
+    const int radius = std::min(w, h) / 4;
+    const int soft_radius = radius + 4;
+    const int cx = radius + (w - 2 * radius) * index / std::max(1, anim.n_frames - 1);
+    const int cy = h / 2 + (h / 8) * ((index % 8) - 4) / 4;
+
+    for (int y=0; y<h; ++y) {
+        auto argb_line = pic->argb + pic->argb_stride * y;
+        for (int x=0; x<w; ++x) {
+            auto noise = NextRandom(&state);
+            auto d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+            auto inside = d2 <= radius * radius;
+
+            int r, g, b;
+            if (anim.n_colors > 0) {
+                auto band = ((x + y + index * 4) / 16) % anim.n_colors;
+                auto color = PaletteColor(inside ? (band + anim.n_colors / 2) % anim.n_colors : band);
+                r = color.r;
+                g = color.g;
+                b = color.b;
+            } else {
+                r = inside ? 240 : (x * 255 / w + index * 3) & 0xFF;
+                g = inside ? 80 : y * 255 / h;
+                b = inside ? 40 : ((x ^ y) + index) & 0xFF;
+                r = std::min(255, r + static_cast<int>(noise & 0xF));
+                g = std::min(255, g + static_cast<int>((noise >> 4) & 0xF));
+                b = std::min(255, b + static_cast<int>((noise >> 8) & 0xF));
+            }
+
+            int a = 255;
+            if (anim.alpha && !inside) {
+                a = d2 < soft_radius * soft_radius ?
+                        255 * (soft_radius * soft_radius - d2) / (soft_radius * soft_radius - radius * radius) : 0;
+            }
+
+            argb_line[x] = a ? cg::Color(r, g, b, a).ToARGB() : 0;
+        }
+    }
+}
+
+// Smooth gradients with sensor-like noise, different for every seed.
+static void DrawPhoto(WebPPicture* pic, uint32_t seed) {
+    uint32_t state = seed;
+    for (int y=0; y<pic->height; ++y) {
+        auto argb_line = pic->argb + pic->argb_stride * y;
+        for (int x=0; x<pic->width; ++x) {
+            auto noise = NextRandom(&state);
+            int r = (x * 255 / pic->width + seed * 40) & 0xFF;
+            int g = (y * 255 / pic->height + seed * 20) & 0xFF;
+            int b = ((x + y) * 255 / (pic->width + pic->height)) & 0xFF;
+            r = std::min(255, r + static_cast<int>(noise & 0x1F));
+            g = std::min(255, g + static_cast<int>((noise >> 5) & 0x1F));
+            b = std::min(255, b + static_cast<int>((noise >> 10) & 0x1F));
+            argb_line[x] = cg::Color(r, g, b, 0xFF).ToARGB();
+        }
+    }
+}
+
+static int EncodeAnim(const CorpusAnim& anim, AnimEncoderBuffer* output) {
+    AnimEncoderOptions encoder_options {};
+    AnimFrameOptions frame_options {
+        .lossless = 0,
+        .quality = 90,
+        .method = 0,
+        .pass = 1
+    };
+
+    auto encoder = AnimEncoderNewWithBuffer(anim.format, anim.width, anim.height, &encoder_options, output);
+    check(encoder);
+    defer(AnimEncoderDelete(encoder));
+
+    WebPPicture pic;
+    check(WebPPictureInit(&pic));
+    defer(WebPPictureFree(&pic));
+    pic.use_argb = 1;
+    pic.width = anim.width;
+    pic.height = anim.height;
+    check(WebPPictureAlloc(&pic));
+
+    for (int i=0; i<anim.n_frames; ++i) {
+        DrawAnimFrame(&pic, anim, i);
+        check(AnimEncoderAddFrame(encoder, &pic, i * anim.duration, (i + 1) * anim.duration, &frame_options));
+    }
+
+    check(AnimEncoderFinish(encoder, anim.n_frames * anim.duration, 0));
+
+    return 1;
+}
+
+// ARGB words are BGRA bytes in memory.
+static int EncodeStill(const WebPPicture* pic, int lossless, WebPData* output) {
+    uint8_t* bytes = nullptr;
+    auto bgra = reinterpret_cast<const uint8_t*>(pic->argb);
+    auto stride = pic->argb_stride * static_cast<int>(sizeof(uint32_t));
+    auto size = lossless ?
+            WebPEncodeLosslessBGRA(bgra, pic->width, pic->height, stride, &bytes) :
+            WebPEncodeBGRA(bgra, pic->width, pic->height, stride, 90, &bytes);
+    check(size > 0);
+
+    output->bytes = bytes;
+    output->size = size;
+
+    return 1;
+}
+
+static int CorpusInit(Corpus* corpus) {
+    for (auto& anim : kCorpusAnims) {
+        corpus->anims.emplace_back();
+        AnimEncoderBufferInit(&corpus->anims.back());
+        check(EncodeAnim(anim, &corpus->anims.back()));
+    }
+
+    WebPPicture pic;
+    check(WebPPictureInit(&pic));
+    defer(WebPPictureFree(&pic));
+    pic.use_argb = 1;
+    pic.width = CORPUS_PHOTO_WIDTH;
+    pic.height = CORPUS_PHOTO_HEIGHT;
+    check(WebPPictureAlloc(&pic));
+
+    for (int i=0; i<N_CORPUS_PHOTOS; ++i) {
+        DrawPhoto(&pic, i + 1);
+        corpus->photos.emplace_back();
+        check(EncodeStill(&pic, 0, &corpus->photos.back()));
+    }
+
+    CorpusAnim sticker = kCorpusAnims[0];
+    sticker.width = sticker.height = CORPUS_LAYER_SIZE;
+
+    WebPPicture layer;
+    check(WebPPictureInit(&layer));
+    defer(WebPPictureFree(&layer));
+    layer.use_argb = 1;
+    layer.width = layer.height = CORPUS_LAYER_SIZE;
+    check(WebPPictureAlloc(&layer));
+    DrawAnimFrame(&layer, sticker, 0);
+    check(EncodeStill(&layer, 1, &corpus->layer));
+
+    return 1;
+}
+
+static void CorpusClear(Corpus* corpus) {
+    for (auto& anim : corpus->anims) {
+        AnimEncoderBufferClear(&anim);
+    }
+    for (auto& photo : corpus->photos) {
+        WebPFree(const_cast<uint8_t*>(photo.bytes));
+    }
+    WebPFree(const_cast<uint8_t*>(corpus->layer.bytes));
+    corpus->layer = WebPData {};
+}
+
+// On Linux the peak is reset before each run. Elsewhere it only grows,
+// so a run reports the largest footprint of all the runs so far.
+static void ResetPeakRss() {
+#ifdef __linux__
+    auto file = fopen("/proc/self/clear_refs", "w");
+    if (file) {
+        fputs("5", file);
+        fclose(file);
+    }
+#endif
+}
+
+static long GetPeakRssKb() {
+#ifdef __linux__
+    auto file = fopen("/proc/self/status", "r");
+    if (file) {
+        defer(fclose(file));
+        char line[256];
+        while (fgets(line, sizeof(line), file)) {
+            if (!strncmp(line, "VmHWM:", 6)) {
+                return atol(line + 6);
+            }
+        }
+    }
+#endif
+
+#ifndef _WIN32
+    rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+typedef std::function<int()> BenchOp;
+
+// Runs `op` settings->repeat times and keeps the run of median wall time.
+static int RunRepeated(const BenchSettings* settings, const BenchOp& op, BenchRun* median) {
+    std::vector<BenchRun> runs(settings->repeat);
+    for (auto& run : runs) {
+        ResetPeakRss();
+        StageTimesReset();
+
+        auto start = std::chrono::steady_clock::now();
+        check(op());
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        run.wall_ms = elapsed.count();
+        run.peak_rss_kb = GetPeakRssKb();
+        StageTimesGet(run.stage_ns);
+    }
+
+    std::sort(runs.begin(), runs.end(), [](const BenchRun& l, const BenchRun& r) {
+        return l.wall_ms < r.wall_ms;
+    });
+    *median = runs[runs.size() / 2];
+
+    return 1;
+}
+
+static void PrintHeader() {
+    fprintf(stdout, "op\tinput\tformat\twidth\theight\tframes\twall_ms\tframes_per_s\tmpix_per_s\tpeak_rss_kb");
+    for (int i=0; i<N_STAGES; ++i) {
+        fprintf(stdout, "\t%s_ms", StageGetName(static_cast<Stage>(i)));
+    }
+    fprintf(stdout, "\n");
+}
+
+// `n_frames` frames of width x height pixels went through the op.
+static void PrintRun(const char* op, const char* input, const char* format, int width, int height, int n_frames,
+                     const BenchRun& run) {
+    auto seconds = run.wall_ms / 1e3;
+    auto mpix = static_cast<double>(width) * height * n_frames / 1e6;
+
+    fprintf(stdout, "%s\t%s\t%s\t%d\t%d\t%d\t%.1f\t%.1f\t%.2f\t%ld", op, input, format, width, height, n_frames,
+            run.wall_ms, n_frames / seconds, mpix / seconds, run.peak_rss_kb);
+    for (int i=0; i<N_STAGES; ++i) {
+        fprintf(stdout, "\t%.1f", run.stage_ns[i] / 1e6);
+    }
+    fprintf(stdout, "\n");
+    fflush(stdout);
+}
+
+static int Selected(const BenchSettings* settings, const char* op, const char* input, const char* format) {
+    if (!settings->filter || !settings->filter[0]) {
+        return 1;
+    }
+    auto label = std::string(op) + "/" + input + "." + format;
+    return strstr(label.c_str(), settings->filter) != nullptr;
+}
+
+static int BenchAnim(const BenchSettings* settings, const CorpusAnim& anim, const AnimEncoderBuffer& data,
+                     const WebPData* layer) {
+    const WebPData input { .bytes = data.bytes, .size = data.size };
+    const auto s = settings;
+    BenchRun run;
+
+    if (Selected(s, "dropframes", anim.name, anim.format)) {
+        // a centered square, half the size, at 15 fps
+        FrameTransform transform {};
+        transform.src.type = FTRT_REL;
+        transform.src.rel.ratio_x = 1;
+        transform.src.rel.ratio_y = 1;
+        transform.src.rel.gravities = FRG_CENTER;
+        transform.n_dsts = 1;
+        transform.dsts[0].width = std::min(anim.width, anim.height) / 2;
+        transform.dsts[0].height = transform.dsts[0].width;
+        strncpy(transform.dsts[0].format, anim.format, MAX_FORMAT_LENGTH - 1);
+
+        check(RunRepeated(s, [&]() {
+            AnimEncoderBuffer outputs[MAX_N_TRANSFORMS][MAX_N_TRANSFORM_DSTS];
+            AnimEncoderBufferInit(&outputs[0][0]);
+            defer(AnimEncoderBufferClear(&outputs[0][0]));
+            return AnimToolDropFramesWithData(&input, 15, 0, -1, s->minimize_size, s->global_palette, s->verbose,
+                                              s->lossless, s->quality, s->method, s->pass, 0, 1, &transform, outputs,
+                                              nullptr);
+        }, &run));
+        PrintRun("dropframes", anim.name, anim.format, anim.width, anim.height, anim.n_frames, run);
+    }
+
+    if (Selected(s, "overlay", anim.name, anim.format)) {
+        check(RunRepeated(s, [&]() {
+            AnimEncoderBuffer output;
+            AnimEncoderBufferInit(&output);
+            defer(AnimEncoderBufferClear(&output));
+            return AnimToolAddLayerWithData(&input, layer, 1, 1, 0, 0, "0x00000000", &output, anim.format,
+                                            s->minimize_size, s->global_palette, s->verbose,
+                                            s->lossless, s->quality, s->method, s->pass);
+        }, &run));
+        PrintRun("overlay", anim.name, anim.format, anim.width, anim.height, anim.n_frames, run);
+    }
+
+    if (Selected(s, "blur", anim.name, anim.format)) {
+        check(RunRepeated(s, [&]() {
+            AnimEncoderBuffer output;
+            AnimEncoderBufferInit(&output);
+            defer(AnimEncoderBufferClear(&output));
+            return AnimToolBlurWithData(&input, -1, 8, &output, anim.format,
+                                        s->minimize_size, s->global_palette, s->verbose,
+                                        s->lossless, s->quality, s->method, s->pass);
+        }, &run));
+        PrintRun("blur", anim.name, anim.format, anim.width, anim.height, anim.n_frames, run);
+    }
+
+    return 1;
+}
+
+// A slideshow of the photos over the first one blurred, as in `animate --background frame:0`.
+static int BenchAnimate(const BenchSettings* settings, const Corpus& corpus, const char* format) {
+    const auto s = settings;
+    const int width = 640;
+    const int height = 480;
+    BenchRun run;
+
+    if (!Selected(s, "animate", "photos", format)) {
+        return 1;
+    }
+
+    check(RunRepeated(s, [&]() {
+        AnimEncoderBuffer output;
+        AnimEncoderBufferInit(&output);
+        defer(AnimEncoderBufferClear(&output));
+        return AnimToolAnimateWithData(corpus.photos.data(), static_cast<int>(corpus.photos.size()), "frame:0", nullptr,
+                                       16, width, height, 500, &output, format,
+                                       s->minimize_size, s->global_palette, s->verbose,
+                                       s->lossless, s->quality, s->method, s->pass);
+    }, &run));
+    PrintRun("animate", "photos", format, width, height, static_cast<int>(corpus.photos.size()), run);
+
+    return 1;
+}
+
+static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli::StrBuilder& error) {
+    auto verbose = cmd->GetBool("verbose");
+    if (verbose) {
+        logger::SetLevel(logger::LOG_DEBUG);
+    }
+
+    BenchSettings settings {
+        .repeat = std::max(1, cmd->GetInt("repeat")),
+        .filter = cmd->GetStr("filter"),
+
+        .minimize_size = cmd->GetBool("minimize_size"),
+        .global_palette = cmd->GetBool("global_palette"),
+        .verbose = verbose,
+        .lossless = cmd->GetBool("lossless"),
+        .quality = cmd->GetFloat("quality"),
+        .method = cmd->GetInt("method"),
+        .pass = cmd->GetInt("pass"),
+    };
+
+    Corpus corpus {};
+    defer(CorpusClear(&corpus));
+    if (!CorpusInit(&corpus)) {
+        error.AddText("Failed to generate the corpus");
+        return cli::ACTION_FAILED;
+    }
+
+    StageTimesEnable(1);
+    defer(StageTimesEnable(0));
+
+    PrintHeader();
+
+    for (size_t i=0; i<corpus.anims.size(); ++i) {
+        if (!BenchAnim(&settings, kCorpusAnims[i], corpus.anims[i], &corpus.layer)) {
+            error.AddText("%s.%s failed", kCorpusAnims[i].name, kCorpusAnims[i].format);
+            return cli::ACTION_FAILED;
+        }
+    }
+
+    static const char* const kAnimateFormats[] = { "gif", "webp" };
+    for (auto format : kAnimateFormats) {
+        if (!BenchAnimate(&settings, corpus, format)) {
+            error.AddText("animate to %s failed", format);
+            return cli::ACTION_FAILED;
+        }
+    }
+
+    return cli::ACTION_OK;
+}
+
+void CmdBenchInit(cli::Cmd* cmd) {
+    *cmd = cli::Cmd {
+            .name = "bench",
+            .desc = "Benchmark dropframes, overlay, blur and animate on a generated corpus.",
+            .usage = "[command options]",
+            .examples = {
+                    "animtool bench",
+                    "animtool bench --filter dropframes --repeat 5",
+                    "",
+                    "Prints one tab separated line per op and input, with the run of median wall time:",
+                    "throughput, peak RSS and the time spent in each stage, summed over threads.",
+            },
+            .n_args = 0,
+            .args_desc = "The corpus of GIF and WebP animations and still images is generated in memory, "
+                         "no file is read or written.",
+            .context = nullptr,
+            .action = CmdAction
+    };
+
+    cmd->AddFlag(cli::Flag{
+            .name = "repeat",
+            .desc = "Number of runs of each op.",
+            .type = cli::FLAG_INT,
+            .required = 0,
+            .multiple = 0,
+            .default_value = { .int_value = 3 }
+    });
+
+    cmd->AddFlag(cli::Flag{
+            .name = "filter",
+            .desc = "Only run the ops whose label, like dropframes/sticker.gif, contains this.",
+            .type = cli::FLAG_STR,
+            .required = 0,
+            .multiple = 0,
+            .default_value = { .str_value = "" }
+    });
+
+    CmdAddOutputFlags(cmd);
+}
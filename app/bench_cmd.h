@@ -0,0 +1,12 @@
+#ifndef ANIMTOOL_BENCH_CMD_H
+#define ANIMTOOL_BENCH_CMD_H
+
+
+namespace cli {
+    struct Cmd;
+} // namespace cli
+
+void CmdBenchInit(cli::Cmd* cmd);
+
+
+#endif //ANIMTOOL_BENCH_CMD_H
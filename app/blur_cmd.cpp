@@ -4,7 +4,9 @@
 
 #include "blur_cmd.h"
 #include "cli.h"
+#include "frame_index_flag.h"
 #include "output_flags.h"
+#include "core/frameindex.h"
 #include "core/blur.h"
 
 #include "core/logger.h"
@@ -13,9 +15,10 @@
 static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli::StrBuilder& error) {
     auto verbose = cmd->GetBool("verbose");
     if (verbose) {
-        logger::level = logger::LOG_DEBUG;
+        logger::SetLevel(logger::LOG_DEBUG);
     }
 
+    FrameIndexSidecarBinding sidecar(cmd->GetBool("frame_index"));
     if (!AnimToolBlur(
             cmd->GetFirstArg(),
             cmd->GetInt("frame"),
@@ -24,6 +27,7 @@ static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli:
             cmd->GetStr("format"),
 
             cmd->GetBool("minimize_size"),
+            cmd->GetBool("global_palette"),
             verbose,
 
             cmd->GetBool("lossless"),
@@ -98,4 +102,6 @@ void CmdBlurInit(cli::Cmd* cmd) {
     });
 
     CmdAddOutputFlags(cmd);
+
+    CmdAddFrameIndexFlag(cmd);
 }
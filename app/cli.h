@@ -69,6 +69,13 @@ namespace cli {
         fprintf(stderr, "ERROR: %s", sb.buf);
     }
 
+    // Where a command prints its results: the output of the job running on the calling thread, stdout otherwise.
+    inline thread_local FILE* job_out = nullptr;
+
+    static inline FILE* Out() {
+        return job_out ? job_out : stdout;
+    }
+
     static inline const char* GetFlagTypeName(FlagType type) {
         switch (type) {
             case FLAG_BOOL: return "BOOL";
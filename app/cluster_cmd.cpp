@@ -4,7 +4,9 @@
 
 #include "cluster_cmd.h"
 #include "cli.h"
+#include "frame_index_flag.h"
 
+#include "core/frameindex.h"
 #include "core/cluster.h"
 #include "core/cg.h"
 #include "utils/defer.h"
@@ -19,6 +21,7 @@ static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli:
     auto counts = new uint32_t[k];
     defer(delete[] counts);
 
+    FrameIndexSidecarBinding sidecar(cmd->GetBool("frame_index"));
     if (!AnimToolCluster(
             input,
             cmd->GetInt("frame"),
@@ -35,7 +38,7 @@ static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli:
     for (int i=0; i<k; ++i) {
         auto argb = argbs[i];
         auto clr = cg::Color::FromARGB(argb);
-        fprintf(stdout, "#%02X%02X%02X%02X, %d\n", clr.r, clr.g, clr.b, clr.a, counts[i]);
+        fprintf(cli::Out(), "#%02X%02X%02X%02X, %d\n", clr.r, clr.g, clr.b, clr.a, counts[i]);
     }
 
     return cli::ACTION_OK;
@@ -118,4 +121,6 @@ void CmdClusterInit(cli::Cmd* cmd) {
             .required = 1,
             .multiple = 0,
     });
+
+    CmdAddFrameIndexFlag(cmd);
 }
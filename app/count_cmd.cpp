@@ -4,7 +4,9 @@
 
 #include "count_cmd.h"
 #include "cli.h"
+#include "frame_index_flag.h"
 
+#include "core/frameindex.h"
 #include "core/count.h"
 
 
@@ -12,6 +14,7 @@ static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli:
     auto input = cmd->GetFirstArg();
 
     int count = 0;
+    FrameIndexSidecarBinding sidecar(cmd->GetBool("frame_index"));
     if (!AnimToolCountStr(
             input,
             cmd->GetInt("frame"),
@@ -24,7 +27,7 @@ static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli:
         return cli::ACTION_FAILED;
     }
 
-    fprintf(stdout, "%d\n", count);
+    fprintf(cli::Out(), "%d\n", count);
 
     return cli::ACTION_OK;
 }
@@ -107,4 +110,6 @@ void CmdCountInit(cli::Cmd* cmd) {
             .multiple = 1,
             .default_value = { .str_value = "15<red<=100:alpha=0" }
     });
-}
\ No newline at end of file
+
+    CmdAddFrameIndexFlag(cmd);
+}
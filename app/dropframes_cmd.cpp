@@ -4,6 +4,9 @@
 #include "utils/parse.h"
 #include "core/logger.h"
 
+#include <inttypes.h>
+#include <stdio.h>
+
 
 static int ParseColonInts(const char* pstart, const char* pend, int* values, int limit_n, int* pcount) {
     return ParseList(pstart, pend, ":", values, limit_n, pcount, ParseInt);
@@ -111,6 +114,30 @@ static int ParseTransform(const char* pstart, FrameTransform* transform) {
     return 0;
 }
 
+static void PrintStatsJson(const DropFramesStats* stats, int n_transforms, const FrameTransform* transforms) {
+    auto ms = [](int64_t ns) { return ns / 1e6; };
+
+    fprintf(cli::Out(), "{\"stage_ms\":{\"decode\":%.3f,\"compose\":%.3f,\"crop\":%.3f,\"rescale\":%.3f,"
+                    "\"quantize\":%.3f,\"encode\":%.3f,\"mux\":%.3f,\"write\":%.3f},",
+            ms(stats->decode_ns), ms(stats->compose_ns), ms(stats->crop_ns), ms(stats->rescale_ns),
+            ms(stats->quantize_ns), ms(stats->encode_ns), ms(stats->mux_ns), ms(stats->write_ns));
+    fprintf(cli::Out(), "\"bytes_read\":%" PRId64 ",\"bytes_written\":%" PRId64 ",", stats->bytes_read, stats->bytes_written);
+    fprintf(cli::Out(), "\"in_frames\":%d,\"out_frames\":%d,\"frames_dropped\":%d,",
+            stats->in_frame_count, stats->out_frame_count, stats->frames_dropped);
+
+    fprintf(cli::Out(), "\"transforms\":[");
+    for (int i=0; i<n_transforms; ++i) {
+        fprintf(cli::Out(), "%s[", i ? "," : "");
+        for (int j=0; j<transforms[i].n_dsts; ++j) {
+            auto& dst = stats->dsts[i][j];
+            fprintf(cli::Out(), "%s{\"encode_ms\":%.3f,\"output_size\":%" PRId64 "}", j ? "," : "",
+                    ms(dst.encode_ns), dst.output_size);
+        }
+        fprintf(cli::Out(), "]");
+    }
+    fprintf(cli::Out(), "]}\n");
+}
+
 static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli::StrBuilder& error) {
     const char* transform_strs[MAX_N_FLAG_VALUES] = {};
     int n_transforms = 0;
@@ -126,11 +153,19 @@ static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli:
         }
     }
 
+    auto stats_format = cmd->GetStr("stats");
+    auto want_stats = stats_format && stats_format[0];
+    if (want_stats && strcmp(stats_format, "json") != 0) {
+        error.AddText("Unsupported stats format `%s`", stats_format);
+        return cli::ACTION_WRONG_ARGS;
+    }
+
     auto verbose = cmd->GetBool("verbose");
     if (verbose) {
-        logger::level = logger::LOG_DEBUG;
+        logger::SetLevel(logger::LOG_DEBUG);
     }
 
+    DropFramesStats stats;
     if (!AnimToolDropFrames(
             cmd->GetFirstArg(),
             cmd->GetStr("output"),
@@ -140,6 +175,7 @@ static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli:
             cmd->GetInt("loop_count"),
 
             cmd->GetBool("minimize_size"),
+            cmd->GetBool("global_palette"),
             verbose,
 
             cmd->GetBool("lossless"),
@@ -147,12 +183,20 @@ static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli:
             cmd->GetInt("method"),
             cmd->GetInt("pass"),
 
+            cmd->GetBool("pipeline"),
+
             n_transforms,
-            transforms
+            transforms,
+
+            want_stats ? &stats : nullptr
     )) {
         return cli::ACTION_FAILED;
     }
 
+    if (want_stats) {
+        PrintStatsJson(&stats, n_transforms, transforms);
+    }
+
     return cli::ACTION_OK;;
 }
 
@@ -232,6 +276,26 @@ void CmdDropFramesInit(cli::Cmd* cmd) {
     });
 
 
+    cmd->AddFlag(cli::Flag{
+        .name = "pipeline",
+        .short_aliases = {'P'},
+        .desc = "Decode, transform and encode on separate threads. Speeds up jobs with multiple transforms or destinations.",
+        .type = cli::FLAG_BOOL,
+        .required = 0,
+        .multiple = 0,
+        .default_value = { .bool_value = 0 }
+    });
+
+    cmd->AddFlag(cli::Flag{
+        .name = "stats",
+        .desc = "Print the time spent per stage, the bytes read and written and the frame counts to stdout. "
+                "Format: json.",
+        .type = cli::FLAG_STR,
+        .required = 0,
+        .multiple = 0,
+        .default_value = { .str_value = "" }
+    });
+
     CmdAddOutputFlags(cmd);
 
     cmd->AddFlag(cli::Flag{
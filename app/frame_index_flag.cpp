@@ -0,0 +1,17 @@
+#include "frame_index_flag.h"
+#include "cli.h"
+
+#include "core/frameindex.h"
+
+void CmdAddFrameIndexFlag(cli::Cmd* cmd) {
+    cmd->AddFlag(cli::Flag{
+            .name = "frame_index",
+            .desc = "Keep the frame headers of a WebP or GIF input in a sidecar file next to it, "
+                    "named after it with " FRAME_INDEX_SIDECAR_SUFFIX ", so that later runs seek frames "
+                    "without scanning it. The sidecar is rebuilt when the input size or mtime changes.",
+            .type = cli::FLAG_BOOL,
+            .required = 0,
+            .multiple = 0,
+            .default_value = { .bool_value = 0 }
+    });
+}
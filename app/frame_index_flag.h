@@ -0,0 +1,13 @@
+#ifndef ANIMTOOL_FRAME_INDEX_FLAG_H
+#define ANIMTOOL_FRAME_INDEX_FLAG_H
+
+
+namespace cli {
+    struct Cmd;
+} // namespace cli
+
+// Adds `--frame_index`. Actions honor it with a FrameIndexSidecarBinding around their work.
+void CmdAddFrameIndexFlag(cli::Cmd* cmd);
+
+
+#endif //ANIMTOOL_FRAME_INDEX_FLAG_H
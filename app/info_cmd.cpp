@@ -1,4 +1,5 @@
 #include "cli.h"
+#include "frame_index_flag.h"
 
 #include "core/animrun.h"
 #include "core/webprun.h"
@@ -6,6 +7,8 @@
 #include "core/imgrun.h"
 #include "core/filefmt.h"
 #include "core/rawgif.h"
+#include "core/frameindex.h"
+#include "core/filemap.h"
 
 #include "webp/mux_types.h" // WebPData
 #include "../imageio/imageio_util.h" // ImgIoUtilReadFile
@@ -28,7 +31,7 @@ struct Context {
 };
 
 #define imginfo(fmt, ...) \
-    fprintf(stdout, fmt"\n", ##__VA_ARGS__)
+    fprintf(cli::Out(), fmt"\n", ##__VA_ARGS__)
 
 static int OnStart(void* ctx, const AnimInfo* info, int* stop) {
     auto thiz = reinterpret_cast<Context*>(ctx);
@@ -133,10 +136,100 @@ static int PrintInfo(const char* input, int detail, int opacity) {
     return 1;
 }
 
+static const char* GetWebPDisposalMethodName(int dispose) {
+    return dispose == FRAME_DISPOSE_BACKGROUND ? "BG" : "NONE";
+}
+
+// What OnStart prints, from the header of the frame index.
+static void PrintIndexHeaderInfo(const FrameIndexHeader& header) {
+    auto is_gif = header.format == FRAME_INDEX_GIF;
+
+    imginfo("Canvas size %dx%d", header.canvas_width, header.canvas_height);
+    imginfo("Background color %x", header.bgcolor);
+    // the GIF decoder only tells the loop count at the end
+    if (!is_gif && header.has_loop_count) {
+        imginfo("Loop count %d", header.loop_count);
+    }
+
+    if (is_gif) {
+        imginfo("[GIF]");
+        imginfo("    res %d", header.gif_color_res);
+        imginfo("    bg index %d", header.gif_bgcolor_index);
+        if (header.gif_color_count) {
+            imginfo("    cmap(%d)", header.gif_color_count);
+        }
+    }
+}
+
+// Same as the run above, from the frame headers alone: no pixel is decoded and no canvas allocated.
+static int PrintIndexInfo(const FrameIndex& index) {
+    const auto& header = index.header;
+    auto is_gif = header.format == FRAME_INDEX_GIF;
+
+    PrintIndexHeaderInfo(header);
+
+    for (size_t i=0; i<index.frames.size(); ++i) {
+        const auto& frame = index.frames[i];
+
+        cli::StrBuilder sb {};
+        if (is_gif) {
+            sb.AddText(" [GIF]");
+            if (frame.gif_interlace) {
+                sb.AddText(" interlaced");
+            }
+            if (frame.gif_transparent_index >= 0) {
+                sb.AddText(" trans=%d", frame.gif_transparent_index);
+            }
+            if (frame.gif_color_count) {
+                sb.AddText(" cmap(%d)", frame.gif_color_count);
+            }
+            sb.AddText(" [%d:%d:%d:%d]", frame.x_offset, frame.y_offset, frame.width, frame.height);
+            sb.AddText(" disp=%s", GetDisposalMethodName(frame.gif_dispose));
+        } else {
+            sb.AddText(" [WebP]");
+            sb.AddText(" [%d:%d:%d:%d]", frame.x_offset, frame.y_offset, frame.width, frame.height);
+            sb.AddText(" disp=%s%s", GetWebPDisposalMethodName(frame.dispose), frame.blend ? "" : " noblend");
+        }
+
+        imginfo("image#%d duration=%d%s", static_cast<int>(i), frame.end_ts - frame.start_ts, sb.buf);
+    }
+
+    imginfo("Total duration %d", index.frames.empty() ? 0 : index.frames.back().end_ts);
+    if (header.has_loop_count) {
+        imginfo("Loop count %d", header.loop_count);
+    }
+
+    return 1;
+}
+
+// Prints the info of a WebP or GIF from its frame index. `indexed` is 0 for other formats.
+static int PrintIndexInfo(const char* input, int detail, int* indexed) {
+    FileMap map;
+    checkf(FileMapOpen(input, &map), "The input file cannot be open %s", input);
+    defer(FileMapClose(&map));
+
+    *indexed = IsWebP(&map.data) || IsGIF(&map.data);
+    if (!*indexed) {
+        return 1;
+    }
+
+    // without the frames, the index is not worth going through the whole file
+    if (!detail) {
+        FrameIndexHeader header;
+        check(FrameIndexReadHeader(&map.data, &header));
+        PrintIndexHeaderInfo(header);
+        return 1;
+    }
+
+    std::shared_ptr<const FrameIndex> index;
+    check(FrameIndexGet(&map.data, input, &index));
+    return PrintIndexInfo(*index);
+}
+
 static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli::StrBuilder& error) {
     auto verbose = cmd->GetBool("verbose");
     if (verbose) {
-        logger::level = logger::LOG_DEBUG;
+        logger::SetLevel(logger::LOG_DEBUG);
     }
 
     auto input = cmd->GetFirstArg();
@@ -146,6 +239,19 @@ static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli:
             .opacity = cmd->GetBool("opacity")
     };
 
+    // only the opacity needs the pixels
+    if (!ctx.opacity) {
+        FrameIndexSidecarBinding sidecar(cmd->GetBool("frame_index"));
+
+        int indexed = 0;
+        if (!PrintIndexInfo(input, ctx.detail, &indexed)) {
+            return cli::ACTION_FAILED;
+        }
+        if (indexed) {
+            return cli::ACTION_OK;
+        }
+    }
+
     if (!DecRun(input, &ctx, kRunCallback)) {
         return cli::ACTION_FAILED;
     }
@@ -202,4 +308,6 @@ void CmdInfoInit(cli::Cmd* cmd) {
             .multiple = 0,
             .default_value = { .bool_value = 0 }
     });
-}
\ No newline at end of file
+
+    CmdAddFrameIndexFlag(cmd);
+}
@@ -0,0 +1,202 @@
+#include "job.h"
+
+#include "core/logger.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static const char* const kNotNestable[] = { "batch", "serve", "bench", "help" };
+// Flags setting state of the whole process, e.g. the single trace of AppAddTraceFlag
+static const char* const kNotNestableFlags[] = { "trace" };
+
+int JobReadManifest(const char* path, std::vector<Job>* jobs) {
+    FILE* file = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    if (!file) {
+        return 0;
+    }
+
+    std::string line;
+    int line_number = 0;
+    int c;
+    do {
+        c = fgetc(file);
+        if (c != EOF && c != '\n') {
+            line.push_back(static_cast<char>(c));
+            continue;
+        }
+
+        ++line_number;
+        auto start = line.find_first_not_of(" \t\r");
+        if (start != std::string::npos && line[start] != '#') {
+            jobs->push_back(Job {
+                .line_number = line_number,
+                .line = line.substr(start)
+            });
+        }
+        line.clear();
+    } while (c != EOF);
+
+    if (file != stdin) {
+        fclose(file);
+    }
+
+    return 1;
+}
+
+int JobSplitArgs(char* line, char* argv[], int max_args) {
+    int argc = 0;
+    char* src = line;
+    char* dst = line;
+
+    while (true) {
+        while (*src == ' ' || *src == '\t' || *src == '\r' || *src == '\n')
+            ++src;
+        if (*src == '\0')
+            break;
+
+        if (argc >= max_args)
+            return -1;
+        argv[argc++] = dst;
+
+        char quote = 0;
+        while (*src != '\0') {
+            if (quote) {
+                if (*src == quote) {
+                    quote = 0;
+                } else {
+                    *dst++ = *src;
+                }
+            } else if (*src == '\'' || *src == '"') {
+                quote = *src;
+            } else if (*src == ' ' || *src == '\t' || *src == '\r' || *src == '\n') {
+                break;
+            } else {
+                *dst++ = *src;
+            }
+            ++src;
+        }
+
+        if (quote)
+            return -1;
+
+        // src is at least one char ahead of dst when both are on a separator
+        if (*src != '\0')
+            ++src;
+        *dst++ = '\0';
+    }
+
+    return argc;
+}
+
+cli::ActionError JobRun(cli::App* app, int argc, char* argv[], cli::StrBuilder& error) {
+    if (argc < 1) {
+        error.AddText("Empty job");
+        return cli::ACTION_WRONG_ARGS;
+    }
+
+    auto cmd_name = argv[0];
+    for (auto name : kNotNestable) {
+        if (!strcmp(cmd_name, name)) {
+            error.AddText("`%s` can't run as a job", cmd_name);
+            return cli::ACTION_WRONG_ARGS;
+        }
+    }
+
+    auto cmd = app->FindCmd(cmd_name);
+    if (!cmd) {
+        error.AddText("Unrecognized command %s", cmd_name);
+        return cli::ACTION_WRONG_ARGS;
+    }
+
+    cli::CmdResult result {};
+    if (cmd->Parse(argc - 1, argv + 1, &result)) {
+        error.AddText("Invalid arguments for %s", cmd_name);
+        return cli::ACTION_WRONG_ARGS;
+    }
+
+    for (auto name : kNotNestableFlags) {
+        auto value = result.GetStr(name);
+        if (value && value[0]) {
+            error.AddText("`--%s` can't be given to a job, give it to the command running the jobs", name);
+            return cli::ACTION_WRONG_ARGS;
+        }
+    }
+
+    logger::JobLevelScope level_scope;
+    return cmd->action(cmd->context, &result, error);
+}
+
+// Captures what is printed to cli::Out() on the calling thread while alive.
+struct JobOutputCapture {
+    FILE* file;
+    FILE* outer;
+#ifndef _WIN32
+    char* bytes;
+    size_t size;
+#endif
+
+    JobOutputCapture(): file(nullptr), outer(cli::job_out) {
+#ifndef _WIN32
+        bytes = nullptr;
+        size = 0;
+        file = open_memstream(&bytes, &size);
+#else
+        file = tmpfile();
+#endif
+        if (file) {
+            cli::job_out = file;
+        }
+    }
+
+    ~JobOutputCapture() {
+        cli::job_out = outer;
+        if (file) {
+            fclose(file);
+        }
+#ifndef _WIN32
+        free(bytes);
+#endif
+    }
+
+    JobOutputCapture(const JobOutputCapture&) = delete;
+    JobOutputCapture& operator=(const JobOutputCapture&) = delete;
+
+    void AppendTo(std::string* output) {
+        fflush(file);
+#ifndef _WIN32
+        output->append(bytes, size);
+#else
+        rewind(file);
+        char chunk[4096];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            output->append(chunk, n);
+        }
+#endif
+    }
+};
+
+cli::ActionError JobRunLine(cli::App* app, const std::string& line, cli::StrBuilder& error, std::string* output) {
+    std::vector<char> buf(line.begin(), line.end());
+    buf.push_back('\0');
+
+    char* argv[MAX_N_JOB_ARGS];
+    auto argc = JobSplitArgs(buf.data(), argv, MAX_N_JOB_ARGS);
+    if (argc < 0) {
+        error.AddText("Unbalanced quotes or more than %d arguments", MAX_N_JOB_ARGS);
+        return cli::ACTION_WRONG_ARGS;
+    }
+
+    JobOutputCapture capture;
+    if (!capture.file) {
+        error.AddText("Cannot capture the output of the job: %s", strerror(errno));
+        return cli::ACTION_FAILED;
+    }
+
+    auto result = JobRun(app, argc, argv, error);
+    capture.AppendTo(output);
+
+    return result;
+}
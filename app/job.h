@@ -0,0 +1,31 @@
+#ifndef ANIMTOOL_JOB_H
+#define ANIMTOOL_JOB_H
+
+#include "cli.h"
+
+#include <string>
+#include <vector>
+
+#define MAX_N_JOB_ARGS 256
+
+struct Job {
+    int line_number;
+    std::string line;
+};
+
+// Reads one job per line of `path`, - for stdin. Blank lines and lines starting with # are skipped.
+int JobReadManifest(const char* path, std::vector<Job>* jobs);
+
+// Splits a command line into arguments in place, honoring single and double quotes.
+// Returns the number of arguments, or -1 if there are too many or a quote is not closed.
+int JobSplitArgs(char* line, char* argv[], int max_args);
+
+// Runs one subcommand of `app`, e.g. {"dropframes", "in.gif", "-o", "out.webp"}, as `app` would.
+// Commands that run other commands can't be nested. The log level the job sets only applies to it.
+cli::ActionError JobRun(cli::App* app, int argc, char* argv[], cli::StrBuilder& error);
+
+// Splits `line` and runs it with JobRun. What the job prints to cli::Out() is appended to `output`,
+// so that jobs running at the same time do not mix their results.
+cli::ActionError JobRunLine(cli::App* app, const std::string& line, cli::StrBuilder& error, std::string* output);
+
+#endif //ANIMTOOL_JOB_H
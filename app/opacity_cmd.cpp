@@ -20,7 +20,7 @@ static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli:
         return cli::ACTION_FAILED;
     }
 
-    fprintf(stdout, "%.2f\n", opacity);
+    fprintf(cli::Out(), "%.2f\n", opacity);
 
     return cli::ACTION_OK;
 }
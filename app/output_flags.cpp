@@ -9,7 +9,16 @@ void CmdAddOutputFlags(cli::Cmd* cmd) {
 
     cmd->AddFlag(cli::Flag{
             .name = "minimize_size",
-            .desc = "If true, minimize the output size (slow). Implicitly disables key-frame insertion.",
+            .desc = "If true, minimize the output size (slow). Implicitly disables key-frame insertion. For GIF, only the region that changed since the previous frame is written.",
+            .type = cli::FLAG_BOOL,
+            .required = 0,
+            .multiple = 0,
+            .default_value = { .bool_value = 0 }
+    });
+
+    cmd->AddFlag(cli::Flag{
+            .name = "global_palette",
+            .desc = "GIF only: pick one color table from the first frames and share it with every frame.",
             .type = cli::FLAG_BOOL,
             .required = 0,
             .multiple = 0,
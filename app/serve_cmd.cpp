@@ -0,0 +1,565 @@
+#include "serve_cmd.h"
+#include "cli.h"
+#include "job.h"
+
+#include "core/logger.h"
+#include "core/piccache.h"
+#include "utils/defer.h"
+#include "utils/parallel.h"
+#include "utils/pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// A request is one job line, as in a batch manifest, terminated by '\n'.
+// Each request is answered with a line "ok <ms> <n>" or "failed <ms> <n> <error>", followed by the <n> bytes
+// the job printed.
+#define MAX_REQUEST_SIZE (64 * 1024)
+
+#ifndef _WIN32
+
+// A client that stops reading its replies must not hold a worker forever
+#define REPLY_SEND_TIMEOUT_S 30
+
+static volatile sig_atomic_t g_stop = 0;
+static int g_wake_fd = -1; // written to wake the serving thread up from poll
+
+static void OnStopSignal(int) {
+    g_stop = 1;
+    if (g_wake_fd >= 0) {
+        char c = 0;
+        (void)!write(g_wake_fd, &c, 1);
+    }
+}
+
+struct LineReader {
+    int fd;
+    std::string buf;
+
+    // Takes a line already read. Returns 1 for a line, 0 if there is none yet and -1 for lines that are too long.
+    int TakeLine(std::string* line) {
+        auto end = buf.find('\n');
+        if (end != std::string::npos) {
+            line->assign(buf, 0, end);
+            buf.erase(0, end + 1);
+            return 1;
+        }
+        return buf.size() > MAX_REQUEST_SIZE ? -1 : 0;
+    }
+
+    // Reads what is available once. Returns 1 if something was read, 0 at the end of the stream and -1 on errors.
+    int ReadSome() {
+        char chunk[4096];
+        ssize_t n;
+        do {
+            n = read(fd, chunk, sizeof(chunk));
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) {
+            return n < 0 ? -1 : 0;
+        }
+        buf.append(chunk, n);
+        return 1;
+    }
+
+    // Reads exactly `n` bytes. Returns 1 on success and 0 otherwise.
+    int ReadBytes(size_t n, std::string* bytes) {
+        while (buf.size() < n) {
+            if (ReadSome() <= 0) {
+                return 0;
+            }
+        }
+        bytes->assign(buf, 0, n);
+        buf.erase(0, n);
+        return 1;
+    }
+
+    // Returns 1 for a line, 0 at the end of the stream and -1 on errors or lines that are too long.
+    int ReadLine(std::string* line) {
+        while (true) {
+            int ret = TakeLine(line);
+            if (ret) {
+                return ret;
+            }
+
+            ret = ReadSome();
+            if (ret <= 0) {
+                return ret < 0 || !buf.empty() ? -1 : 0;
+            }
+        }
+    }
+};
+
+static int WriteAll(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        auto n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        written += n;
+    }
+    return 1;
+}
+
+static int FillSocketAddress(const char* path, sockaddr_un* addr) {
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        return 0;
+    }
+    *addr = sockaddr_un {};
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return 1;
+}
+
+// Removes the socket file at `path` left behind by a daemon that did not exit cleanly, which would fail the
+// bind. Anything else there, a file or a socket still accepting connections, is left alone as in use.
+static int RemoveStaleSocket(const char* path, const sockaddr_un* addr, cli::StrBuilder& error) {
+    struct stat st;
+    if (lstat(path, &st)) {
+        if (errno == ENOENT) {
+            return 1;
+        }
+        error.AddText("Cannot check %s: %s", path, strerror(errno));
+        return 0;
+    }
+
+    if (!S_ISSOCK(st.st_mode)) {
+        error.AddText("Address in use: %s is not a socket", path);
+        return 0;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        error.AddText("Cannot create a socket: %s", strerror(errno));
+        return 0;
+    }
+    defer(close(fd));
+
+    if (!connect(fd, reinterpret_cast<const sockaddr*>(addr), sizeof(*addr))) {
+        error.AddText("Address in use: another daemon is serving on %s", path);
+        return 0;
+    }
+    if (errno != ECONNREFUSED) {
+        error.AddText("Address in use: %s (%s)", path, strerror(errno));
+        return 0;
+    }
+
+    if (unlink(path) && errno != ENOENT) {
+        error.AddText("Cannot remove the stale socket %s: %s", path, strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+// A client connection. Its requests are read by the serving thread and run on the pool one at a time, so
+// that a client waiting between requests takes no worker and replies keep the order of the requests.
+struct Connection {
+    LineReader reader;
+    int busy;   // a request of the connection is running
+    int closed; // nothing more will be read from the connection
+};
+
+// Runs one request and answers it, on a worker of the pool.
+static int ServeRequest(cli::App* app, int fd, const std::string& request) {
+    auto start = std::chrono::steady_clock::now();
+
+    cli::StrBuilder error;
+    std::string output;
+    auto result = JobRunLine(app, request, error, &output);
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    logger::d("%s %.1f ms: %s", result == cli::ACTION_OK ? "ok" : "failed", elapsed.count(), request.c_str());
+
+    char head[64];
+    snprintf(head, sizeof(head), "%s %.1f %zu", result == cli::ACTION_OK ? "ok" : "failed", elapsed.count(),
+             output.size());
+
+    std::string reply(head);
+    if (result != cli::ACTION_OK && error.cur != error.buf) {
+        std::string message(error.buf, error.cur);
+        std::replace(message.begin(), message.end(), '\n', ' ');
+        reply += " " + message;
+    }
+    reply += "\n";
+    reply += output;
+
+    return WriteAll(fd, reply);
+}
+
+// Requests run by the pool, reported back to the serving thread once answered.
+struct Requests {
+    struct Done {
+        int fd;
+        int ok; // the reply was written
+    };
+
+    std::mutex mutex;
+    std::vector<Done> done;
+    int wake_fd;
+
+    void Finish(int fd, int ok) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.push_back(Done { .fd = fd, .ok = ok });
+        }
+        char c = 0;
+        (void)!write(wake_fd, &c, 1);
+    }
+
+    std::vector<Done> TakeDone() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<Done> taken;
+        taken.swap(done);
+        return taken;
+    }
+};
+
+static int SetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static cli::ActionError Serve(cli::App* app, const char* socket_path, int n_threads, cli::StrBuilder& error) {
+    sockaddr_un addr;
+    if (!FillSocketAddress(socket_path, &addr)) {
+        error.AddText("Socket path is too long: %s", socket_path);
+        return cli::ACTION_WRONG_ARGS;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        error.AddText("Cannot create a socket: %s", strerror(errno));
+        return cli::ACTION_FAILED;
+    }
+    defer(close(listen_fd));
+
+    if (!RemoveStaleSocket(socket_path, &addr, error)) {
+        return cli::ACTION_FAILED;
+    }
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) || listen(listen_fd, SOMAXCONN)) {
+        error.AddText("Cannot listen on %s: %s", socket_path, strerror(errno));
+        return cli::ACTION_FAILED;
+    }
+    defer(unlink(socket_path));
+
+    int wake_fds[2];
+    if (pipe(wake_fds)) {
+        error.AddText("Cannot create a pipe: %s", strerror(errno));
+        return cli::ACTION_FAILED;
+    }
+    defer(close(wake_fds[0]); close(wake_fds[1]));
+    if (!SetNonBlocking(listen_fd) || !SetNonBlocking(wake_fds[0]) || !SetNonBlocking(wake_fds[1])) {
+        error.AddText("Cannot set up the socket: %s", strerror(errno));
+        return cli::ACTION_FAILED;
+    }
+
+    // No SA_RESTART, so that poll is interrupted
+    g_wake_fd = wake_fds[1];
+    defer(g_wake_fd = -1);
+    struct sigaction stop_action {};
+    stop_action.sa_handler = OnStopSignal;
+    sigaction(SIGINT, &stop_action, nullptr);
+    sigaction(SIGTERM, &stop_action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Workers inherit the blocked mask, leaving the signals to the serving thread
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+
+    Requests requests { .wake_fd = wake_fds[1] };
+    // At most n_threads requests are submitted at a time, so Submit never blocks the serving thread
+    ThreadPool pool(n_threads, n_threads);
+    int n_running = 0;
+
+    pthread_sigmask(SIG_UNBLOCK, &stop_signals, nullptr);
+
+    std::vector<std::unique_ptr<Connection>> connections;
+    // Requests read but not submitted yet, with at most one per connection
+    std::deque<std::pair<Connection*, std::string>> pending;
+
+    auto find_connection = [&connections](int fd) {
+        return std::find_if(connections.begin(), connections.end(), [fd](const std::unique_ptr<Connection>& c) {
+            return c->reader.fd == fd;
+        });
+    };
+
+    // Queues the next request of a connection that is not busy, or answers a malformed one.
+    auto take_request = [&pending](Connection* c) {
+        std::string request;
+        int ret = c->reader.TakeLine(&request);
+        if (ret > 0) {
+            c->busy = 1;
+            pending.emplace_back(c, std::move(request));
+        } else if (ret < 0 || (c->closed && !c->reader.buf.empty())) {
+            WriteAll(c->reader.fd, "failed 0.0 0 Malformed or oversized request\n");
+            c->reader.buf.clear();
+            c->closed = 1;
+        }
+    };
+
+    logger::i("Serving on %s with %d threads", socket_path, n_threads);
+
+    std::vector<pollfd> fds;
+    while (!g_stop) {
+        fds.clear();
+        fds.push_back(pollfd { .fd = wake_fds[0], .events = POLLIN });
+        fds.push_back(pollfd { .fd = listen_fd, .events = POLLIN });
+        for (auto& c : connections) {
+            if (!c->busy && !c->closed) {
+                fds.push_back(pollfd { .fd = c->reader.fd, .events = POLLIN });
+            }
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            error.AddText("Cannot wait for requests: %s", strerror(errno));
+            break;
+        }
+
+        if (fds[0].revents) {
+            char drained[64];
+            while (read(wake_fds[0], drained, sizeof(drained)) > 0) {}
+
+            for (auto& done : requests.TakeDone()) {
+                --n_running;
+                auto c = find_connection(done.fd)->get();
+                c->busy = 0;
+                if (!done.ok) {
+                    c->closed = 1;
+                    c->reader.buf.clear();
+                }
+                take_request(c);
+            }
+        }
+
+        for (size_t i=2; i<fds.size(); ++i) {
+            if (!fds[i].revents) {
+                continue;
+            }
+            auto c = find_connection(fds[i].fd)->get();
+            if (c->reader.ReadSome() <= 0) {
+                c->closed = 1;
+            }
+            take_request(c);
+        }
+
+        if (fds[1].revents) {
+            int fd;
+            while ((fd = accept(listen_fd, nullptr, nullptr)) >= 0) {
+                timeval timeout { .tv_sec = REPLY_SEND_TIMEOUT_S, .tv_usec = 0 };
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                connections.emplace_back(new Connection { .reader = LineReader { .fd = fd }, .busy = 0, .closed = 0 });
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+                error.AddText("Cannot accept connections: %s", strerror(errno));
+                break;
+            }
+        }
+
+        while (n_running < n_threads && !pending.empty()) {
+            auto c = pending.front().first;
+            auto request = std::move(pending.front().second);
+            pending.pop_front();
+
+            ++n_running;
+            int fd = c->reader.fd;
+            pool.Submit([app, fd, request, &requests]() {
+                requests.Finish(fd, ServeRequest(app, fd, request));
+            });
+        }
+
+        // Connections are closed once no request of theirs is left, so that workers never write to a reused fd
+        connections.erase(std::remove_if(connections.begin(), connections.end(), [](const std::unique_ptr<Connection>& c) {
+            if (c->busy || !c->closed) {
+                return false;
+            }
+            close(c->reader.fd);
+            return true;
+        }), connections.end());
+    }
+
+    logger::i("Stopping");
+    // Requests not started are dropped, those running stop at their reply
+    for (auto& c : connections) {
+        shutdown(c->reader.fd, SHUT_RDWR);
+    }
+    pool.Join();
+    for (auto& c : connections) {
+        close(c->reader.fd);
+    }
+
+    return g_stop ? cli::ACTION_OK : cli::ACTION_FAILED;
+}
+
+static cli::ActionError Connect(const char* socket_path, const char* manifest, cli::StrBuilder& error) {
+    sockaddr_un addr;
+    if (!FillSocketAddress(socket_path, &addr)) {
+        error.AddText("Socket path is too long: %s", socket_path);
+        return cli::ACTION_WRONG_ARGS;
+    }
+
+    std::vector<Job> jobs;
+    if (!JobReadManifest(manifest, &jobs)) {
+        error.AddText("Cannot read the manifest %s", manifest);
+        return cli::ACTION_FAILED;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        error.AddText("Cannot create a socket: %s", strerror(errno));
+        return cli::ACTION_FAILED;
+    }
+    defer(close(fd));
+
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+        error.AddText("Cannot connect to %s: %s", socket_path, strerror(errno));
+        return cli::ACTION_FAILED;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    LineReader reader { .fd = fd };
+    std::string reply;
+    std::string output;
+    int n_failed = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto& job : jobs) {
+        if (!WriteAll(fd, job.line + "\n") || reader.ReadLine(&reply) <= 0) {
+            error.AddText("Connection to %s lost at line %d", socket_path, job.line_number);
+            return cli::ACTION_FAILED;
+        }
+
+        char status[16];
+        double ms;
+        size_t output_size;
+        int head_end = 0;
+        if (sscanf(reply.c_str(), "%15s %lf %zu%n", status, &ms, &output_size, &head_end) != 3 ||
+            !reader.ReadBytes(output_size, &output)) {
+            error.AddText("Invalid reply from %s at line %d: %s", socket_path, job.line_number, reply.c_str());
+            return cli::ACTION_FAILED;
+        }
+        if (strcmp(status, "ok")) {
+            ++n_failed;
+        }
+
+        // the rest of the head is the error, if any
+        fprintf(stdout, "#%d %s %.1f%s: %s\n", job.line_number, status, ms, reply.c_str() + head_end, job.line.c_str());
+        fwrite(output.data(), 1, output.size(), stdout);
+        fflush(stdout);
+    }
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    fprintf(stdout, "%d jobs, %d failed, %.1f ms round trip\n",
+            static_cast<int>(jobs.size()), n_failed, elapsed.count());
+
+    return n_failed > 0 ? cli::ACTION_FAILED : cli::ACTION_OK;
+}
+
+#endif // _WIN32
+
+static cli::ActionError CmdAction(void* context, const cli::CmdResult* cmd, cli::StrBuilder& error) {
+#ifdef _WIN32
+    error.AddText("serve needs Unix domain sockets, which are not supported on this platform");
+    return cli::ACTION_FAILED;
+#else
+    auto app = reinterpret_cast<cli::App*>(context);
+    auto socket_path = cmd->GetStr("socket");
+
+    if (cmd->GetBool("connect")) {
+        auto manifest = cmd->GetFirstArg();
+        return Connect(socket_path, manifest ? manifest : "-", error);
+    }
+
+    PicCacheGetShared()->SetMaxBytes(static_cast<size_t>(std::max(cmd->GetInt("image_cache_mb"), 0)) << 20);
+
+    auto n_threads = cmd->GetInt("jobs");
+    if (n_threads <= 0) {
+        n_threads = ParallelGetThreadCount();
+    }
+
+    return Serve(app, socket_path, n_threads, error);
+#endif
+}
+
+void CmdServeInit(cli::Cmd* cmd, cli::App* app) {
+    *cmd = cli::Cmd {
+            .name = "serve",
+            .desc = "Run as a daemon taking jobs over a Unix domain socket.",
+            .usage = "[command options] [MANIFEST_FILE_PATH]",
+            .examples = {
+                    "animtool serve --socket /run/animtool.sock -j 8",
+                    "animtool serve --socket /run/animtool.sock --connect jobs.txt",
+                    "",
+                    "A request is a line with a command as in a batch manifest, e.g.",
+                    "    dropframes -o /path/to/output.webp -R 15 /path/to/input.gif",
+                    "Each request is answered with a line \"ok <ms> <n>\" or \"failed <ms> <n> <error>\",",
+                    "followed by the <n> bytes the command printed, e.g. the output of count.",
+                    "Outputs are written to the paths given in the request.",
+            },
+            .n_args = 0,
+            .args_desc = "With --connect, the manifest whose jobs are sent to the daemon, - or none for stdin.",
+            .context = app,
+            .action = CmdAction
+    };
+
+    cmd->AddFlag(cli::Flag{
+            .name = "socket",
+            .desc = "Path of the Unix domain socket.",
+            .type = cli::FLAG_STR,
+            .required = 1,
+            .multiple = 0
+    });
+
+    cmd->AddFlag(cli::Flag{
+            .name = "jobs",
+            .short_aliases = {'j'},
+            .desc = "Number of requests run at the same time, 0 for one per hardware thread.",
+            .type = cli::FLAG_INT,
+            .required = 0,
+            .multiple = 0,
+            .default_value = { .int_value = 0 }
+    });
+
+    cmd->AddFlag(cli::Flag{
+            .name = "connect",
+            .desc = "Send the jobs of the manifest to a running daemon, one at a time, instead of starting one.",
+            .type = cli::FLAG_BOOL,
+            .required = 0,
+            .multiple = 0,
+            .default_value = { .bool_value = 0 }
+    });
+
+    cmd->AddFlag(cli::Flag{
+            .name = "image_cache_mb",
+            .desc = "Memory for the decoded images shared by the animate jobs, in MiB. 0 to decode them every time.",
+            .type = cli::FLAG_INT,
+            .required = 0,
+            .multiple = 0,
+            .default_value = { .int_value = PIC_CACHE_DEFAULT_MAX_BYTES >> 20 }
+    });
+}
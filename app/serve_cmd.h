@@ -0,0 +1,14 @@
+#ifndef ANIMTOOL_SERVE_CMD_H
+#define ANIMTOOL_SERVE_CMD_H
+
+
+namespace cli {
+    struct Cmd;
+    struct App;
+} // namespace cli
+
+// The requests received by the daemon run commands of `app`.
+void CmdServeInit(cli::Cmd* cmd, cli::App* app);
+
+
+#endif //ANIMTOOL_SERVE_CMD_H
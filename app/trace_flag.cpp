@@ -0,0 +1,53 @@
+#include "trace_flag.h"
+#include "cli.h"
+#include "core/trace.h"
+
+struct TracedCmd {
+    void* context;
+    cli::ActionError (*action)(void* context, const cli::CmdResult* cmd, cli::StrBuilder& error);
+};
+
+static TracedCmd g_traced_cmds[MAX_N_CMDS];
+
+static cli::ActionError TracedAction(void* context, const cli::CmdResult* cmd, cli::StrBuilder& error) {
+    auto traced = reinterpret_cast<const TracedCmd*>(context);
+
+    auto path = cmd->GetStr("trace");
+    if (!path || !path[0]) {
+        return traced->action(traced->context, cmd, error);
+    }
+
+    TraceStart();
+    auto result = traced->action(traced->context, cmd, error);
+    TraceStop();
+
+    if (!TraceWriteChromeJson(path) && result == cli::ACTION_OK) {
+        error.AddText("Failed to write the trace to %s", path);
+        return cli::ACTION_FAILED;
+    }
+
+    return result;
+}
+
+void AppAddTraceFlag(cli::App* app) {
+    for (int i=0; i<app->n_cmds; ++i) {
+        auto& cmd = app->cmds[i];
+
+        g_traced_cmds[i] = TracedCmd {
+            .context = cmd.context,
+            .action = cmd.action
+        };
+        cmd.context = &g_traced_cmds[i];
+        cmd.action = TracedAction;
+
+        cmd.AddFlag(cli::Flag{
+            .name = "trace",
+            .desc = "Record where the time goes, per thread, and write it to this file as Chrome trace JSON "
+                    "(chrome://tracing, ui.perfetto.dev).",
+            .type = cli::FLAG_STR,
+            .required = 0,
+            .multiple = 0,
+            .default_value = { .str_value = "" }
+        });
+    }
+}
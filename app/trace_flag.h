@@ -0,0 +1,14 @@
+#ifndef ANIMTOOL_TRACE_FLAG_H
+#define ANIMTOOL_TRACE_FLAG_H
+
+
+namespace cli {
+    struct App;
+} // namespace cli
+
+// Adds `--trace FILE` to every command of the app added so far. A command run with it
+// records its scopes and writes them to FILE as Chrome trace JSON when it is done.
+void AppAddTraceFlag(cli::App* app);
+
+
+#endif //ANIMTOOL_TRACE_FLAG_H
@@ -0,0 +1,682 @@
+// Times the hot kernels of animtoolcore on deterministic synthetic inputs.
+//
+// Prints one tab separated line per kernel and input size, after a header line:
+//   kernel  variant  width  height  iterations  ns_per_iter  mpix_per_s
+// ns_per_iter is the median of several samples, each running the kernel for at least --min-time-ms.
+//
+// Results that animtoolcore computes two ways, like a frame decoded in sequence or by seeking, or a
+// row composited with SSE2 or without, are first checked to match (see Self-checks below), and a
+// mismatch ends the run with an error.
+// --check runs these checks only.
+//
+// Usage: animtool_bench [--filter SUBSTRING] [--min-time-ms N] [--samples N] [--check]
+
+#include "core/animrun.h"
+#include "core/blurutils.h"
+#include "core/cg.h"
+#include "core/colormap.h"
+#include "core/composite.h"
+#include "core/decrun.h"
+#include "core/picutils.h"
+#include "core/quantizer.h"
+#include "core/dkm.hpp"
+
+#include "utils/defer.h"
+
+#include "webp/encode.h"
+#include "webp/mux.h"
+#include "gif_lib.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Kernels must not fail on these inputs, so any failure ends the run instead of skewing the numbers.
+#define ensure(code) \
+    do {            \
+        if (!(code)) {\
+            fprintf(stderr, "ERROR: Check `%s` failed. @%s:%d\n", #code, __FILE__, __LINE__); \
+            exit(1);        \
+        }                \
+    } while(0)
+
+struct BenchOptions {
+    const char* filter;
+    int min_time_ms;
+    int n_samples;
+    int check_only;
+};
+
+static BenchOptions g_options = {
+    .filter = nullptr,
+    .min_time_ms = 100,
+    .n_samples = 5,
+    .check_only = 0,
+};
+
+static const cg::Size kSizes[] = {
+    { .width = 64, .height = 64 },
+    { .width = 480, .height = 480 },
+    { .width = 1920, .height = 1080 },
+};
+
+static int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Each call of `iteration` runs the kernel once and returns the nanoseconds spent in the kernel itself,
+// leaving out whatever setup the next call needs.
+typedef std::function<int64_t()> BenchIteration;
+
+static void Run(const char* kernel, const char* variant, int width, int height, const BenchIteration& iteration) {
+    if (g_options.filter && !strstr(kernel, g_options.filter)) {
+        return;
+    }
+
+    // warm up caches and allocators
+    iteration();
+
+    const int64_t min_time_ns = static_cast<int64_t>(g_options.min_time_ms) * 1000000;
+    std::vector<double> samples;
+    int64_t n_iterations = 0;
+    for (int i=0; i<g_options.n_samples; ++i) {
+        int64_t spent = 0;
+        int64_t n = 0;
+        do {
+            spent += iteration();
+            ++n;
+        } while (spent < min_time_ns);
+
+        samples.push_back(static_cast<double>(spent) / static_cast<double>(n));
+        n_iterations += n;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    auto ns_per_iter = samples[samples.size() / 2];
+    auto mpix_per_s = static_cast<double>(width) * height / ns_per_iter * 1e3;
+
+    fprintf(stdout, "%s\t%s\t%d\t%d\t%lld\t%.0f\t%.2f\n", kernel, variant, width, height,
+            static_cast<long long>(n_iterations), ns_per_iter, mpix_per_s);
+    fflush(stdout);
+}
+
+template <typename F>
+static int64_t Measure(F fn) {
+    auto start = NowNs();
+    fn();
+    return NowNs() - start;
+}
+
+// xorshift32, so that inputs are the same on every platform
+static uint32_t NextRandom(uint32_t* state) {
+    auto x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// Smooth gradients with noise, a few flat shapes and a transparent border fading in,
+// like a sticker rendered over a transparent canvas.
+static void InitSyntheticPic(WebPPicture* pic, int width, int height, uint32_t seed) {
+    ensure(WebPPictureInit(pic));
+    pic->use_argb = 1;
+    pic->width = width;
+    pic->height = height;
+    ensure(WebPPictureAlloc(pic));
+
+    uint32_t state = seed;
+    const int border = std::max(1, std::min(width, height) / 16);
+    for (int y=0; y<height; ++y) {
+        auto line = pic->argb + pic->argb_stride * y;
+        for (int x=0; x<width; ++x) {
+            auto noise = NextRandom(&state);
+            int r = x * 255 / width;
+            int g = y * 255 / height;
+            int b = ((x / 16) ^ (y / 16)) & 1 ? 200 : 40;
+            if (((x - width / 2) * (x - width / 2) + (y - height / 2) * (y - height / 2)) * 16 < width * width) {
+                r = 250; g = 220; b = 30;
+            }
+            r = std::min(255, r + static_cast<int>(noise & 0xF));
+            g = std::min(255, g + static_cast<int>((noise >> 4) & 0xF));
+            b = std::min(255, b + static_cast<int>((noise >> 8) & 0xF));
+
+            auto edge = std::min(std::min(x, y), std::min(width - 1 - x, height - 1 - y));
+            int a = edge >= border ? 255 : edge * 255 / border;
+
+            line[x] = cg::Color(r, g, b, a).ToARGB();
+        }
+    }
+}
+
+static void CopyArgb(WebPPicture* dst, const WebPPicture* src) {
+    for (int y=0; y<src->height; ++y) {
+        memcpy(dst->argb + dst->argb_stride * y, src->argb + src->argb_stride * y, src->width * sizeof(uint32_t));
+    }
+}
+
+static void QuantizerVisit(void* ctx, int i, uint8_t r, uint8_t g, uint8_t b) {
+    auto cmap = reinterpret_cast<ColorMapObject*>(ctx);
+    auto& color = cmap->Colors[i+1];
+    color.Red = r;
+    color.Green = g;
+    color.Blue = b;
+}
+
+static void BenchQuantizer(const WebPPicture* pic) {
+    Run("wu_add_pixel", "serial", pic->width, pic->height, [pic]() {
+        WuQuantizer quantizer;
+        ensure(quantizer.Init(pic->width, pic->height));
+        return Measure([&]() {
+            for (int y=0; y<pic->height; ++y) {
+                auto line = pic->argb + pic->argb_stride * y;
+                for (int x=0; x<pic->width; ++x) {
+                    quantizer.AddPixel(x, y, (line[x] >> 16) & 0xFF, (line[x] >> 8) & 0xFF, line[x] & 0xFF);
+                }
+            }
+        });
+    });
+
+    Run("wu_add_pixel", "parallel", pic->width, pic->height, [pic]() {
+        WuQuantizer quantizer;
+        ensure(quantizer.Init(pic->width, pic->height));
+        WuHistogramBands bands; // kept across frames, as the GIF encoder does
+        return Measure([&]() {
+            ensure(quantizer.AddPixels(pic->argb, pic->argb_stride, &bands));
+        });
+    });
+
+    Run("wu_build", "255", pic->width, pic->height, [pic]() {
+        WuQuantizer quantizer;
+        ensure(quantizer.Init(pic->width, pic->height));
+        ensure(quantizer.AddPixels(pic->argb, pic->argb_stride));
+
+        auto color_map = GifMakeMapObject(256, nullptr);
+        ensure(color_map);
+        defer(GifFreeMapObject(color_map));
+
+        return Measure([&]() {
+            ensure(quantizer.Build(255, color_map, QuantizerVisit));
+        });
+    });
+}
+
+// AnimEncoderGif maps every pixel through InverseColorMap, which replaced the per-pixel FindIndex scan
+static void BenchInverseColorMap(const WebPPicture* pic) {
+    WuQuantizer quantizer;
+    ensure(quantizer.Init(pic->width, pic->height));
+    ensure(quantizer.AddPixels(pic->argb, pic->argb_stride));
+
+    auto color_map = GifMakeMapObject(256, nullptr);
+    ensure(color_map);
+    defer(GifFreeMapObject(color_map));
+    ensure(quantizer.Build(255, color_map, QuantizerVisit));
+
+    std::unique_ptr<InverseColorMap> inverse_map(new InverseColorMap());
+    std::vector<uint8_t> indices(pic->width);
+
+    for (int exact=0; exact<=1; ++exact) {
+        Run("inverse_color_map", exact ? "exact" : "box", pic->width, pic->height, [&]() {
+            return Measure([&]() {
+                ensure(inverse_map->Init(&quantizer, color_map, 1, exact));
+                for (int y=0; y<pic->height; ++y) {
+                    inverse_map->MapRow(pic->argb + pic->argb_stride * y, pic->width, indices.data());
+                }
+            });
+        });
+    }
+}
+
+static void BenchGaussianBlur(const WebPPicture* pic) {
+    WebPPicture work;
+    InitSyntheticPic(&work, pic->width, pic->height, 1);
+    defer(WebPPictureFree(&work));
+    std::vector<uint8_t> scratch;
+
+    // the cost should not depend on sigma
+    static const int kSigmas[] = { 2, 10, 80 };
+    for (auto sigma : kSigmas) {
+        char variant[32];
+        snprintf(variant, sizeof(variant), "s%d", sigma);
+        Run("gaussian_blur", variant, pic->width, pic->height, [&]() {
+            CopyArgb(&work, pic);
+            return Measure([&]() {
+                ensure(BoxGaussianBlurARGB(work.argb, work.width, work.height, work.argb_stride, 0, sigma, &scratch));
+            });
+        });
+    }
+}
+
+// A layer of a quarter of the canvas drawn at its center, as overlay and underlay do.
+static void BenchPicMerge(const WebPPicture* pic) {
+    WebPPicture layer;
+    InitSyntheticPic(&layer, std::max(1, pic->width / 2), std::max(1, pic->height / 2), 7);
+    defer(WebPPictureFree(&layer));
+
+    WebPPicture canvas;
+    InitSyntheticPic(&canvas, pic->width, pic->height, 1);
+    defer(WebPPictureFree(&canvas));
+
+    cg::Point point = { .x = (pic->width - layer.width) / 2, .y = (pic->height - layer.height) / 2 };
+
+    struct Merger {
+        const char* name;
+        CompositeMode mode;
+    };
+    static const Merger kMergers[] = {
+        { .name = "blend", .mode = COMPOSITE_OVER },
+        { .name = "rev_blend", .mode = COMPOSITE_UNDER },
+        { .name = "mask", .mode = COMPOSITE_MASK },
+    };
+
+    for (auto& merger : kMergers) {
+        Run("pic_merge", merger.name, pic->width, pic->height, [&]() {
+            CopyArgb(&canvas, pic);
+            return Measure([&]() {
+                ensure(PicMerge(&canvas, &layer, point, merger.mode));
+            });
+        });
+    }
+}
+
+static void SumVisitor(void* ctx, int x, int y, uint8_t r, uint8_t g, uint8_t b, uint8_t a, int* stop) {
+    *reinterpret_cast<uint64_t*>(ctx) += r + g + b + a;
+}
+
+static void BenchAnimFrame(WebPPicture* pic) {
+    AnimFrame frame;
+    AnimFrameInitWithPic(&frame, pic);
+
+    Run("anim_frame_enumerate", "pic", pic->width, pic->height, [&]() {
+        uint64_t sum = 0;
+        auto ns = Measure([&]() {
+            ensure(AnimFrameEnumerate(&frame, 0, 0, -1, -1, &sum, SumVisitor));
+        });
+        ensure(sum > 0);
+        return ns;
+    });
+
+    Run("anim_frame_get_opacity", "pic", pic->width, pic->height, [&]() {
+        float opacity = 0;
+        return Measure([&]() {
+            ensure(AnimFrameGetOpacity(&frame, &opacity));
+        });
+    });
+}
+
+// The points `cluster` collects from a frame.
+static void BenchKmeans(const WebPPicture* pic) {
+    std::vector<std::array<float, 4>> points;
+    points.reserve(pic->width * pic->height);
+    for (int y=0; y<pic->height; ++y) {
+        for (int x=0; x<pic->width; ++x) {
+            auto color = cg::Color::FromARGB(pic->argb[pic->argb_stride * y + x]);
+            points.push_back({color.r/255.0f, color.g/255.0f, color.b/255.0f, color.a/255.0f});
+        }
+    }
+
+    static const uint32_t kClusters[] = { 4, 16 };
+    for (auto k : kClusters) {
+        char variant[32];
+        snprintf(variant, sizeof(variant), "k%u", k);
+        Run("kmeans_lloyd", variant, pic->width, pic->height, [&]() {
+            // a fixed seed, so that every run converges through the same iterations
+            dkm::clustering_parameters<float> parameters(k);
+            parameters.set_random_seed(1);
+            return Measure([&]() {
+                auto result = dkm::kmeans_lloyd(points, parameters);
+                ensure(std::get<0>(result).size() == k);
+            });
+        });
+    }
+}
+
+// CoWPic copies the decoded frame before rescaling it.
+static void BenchRescale(const WebPPicture* pic) {
+    struct Target {
+        const char* name;
+        int width;
+        int height;
+    };
+    const Target targets[] = {
+        { .name = "half", .width = std::max(1, pic->width / 2), .height = std::max(1, pic->height / 2) },
+        { .name = "240", .width = 240, .height = std::max(1, pic->height * 240 / pic->width) },
+    };
+
+    for (auto& target : targets) {
+        Run("webp_picture_rescale", target.name, pic->width, pic->height, [&]() {
+            WebPPicture copy;
+            ensure(WebPPictureInit(&copy));
+            defer(WebPPictureFree(&copy));
+            return Measure([&]() {
+                ensure(WebPPictureCopy(pic, &copy));
+                ensure(WebPPictureRescale(&copy, target.width, target.height));
+            });
+        });
+    }
+}
+
+// Self-checks
+
+// A frame as decoded, in RGBA order.
+struct CheckedFrame {
+    int width;
+    int height;
+    int start_ts;
+    int end_ts;
+    std::vector<uint32_t> rgba;
+};
+
+static void CollectPixel(void* ctx, int x, int y, uint8_t r, uint8_t g, uint8_t b, uint8_t a, int* stop) {
+    reinterpret_cast<CheckedFrame*>(ctx)->rgba.push_back(
+            static_cast<uint32_t>(r) << 24 | static_cast<uint32_t>(g) << 16 | static_cast<uint32_t>(b) << 8 | a);
+}
+
+static int CollectOnStart(void* ctx, const AnimInfo* anim_info, int* stop) {
+    return 1;
+}
+
+static int CollectOnFrame(void* ctx, const AnimFrame* frame, int start_ts, int end_ts, int* stop) {
+    auto frames = reinterpret_cast<std::vector<CheckedFrame>*>(ctx);
+    frames->emplace_back();
+    auto& checked = frames->back();
+    checked.width = frame->type == ANIME_FRAME_PIC ? frame->pic->width : frame->rgba.width;
+    checked.height = frame->type == ANIME_FRAME_PIC ? frame->pic->height : frame->rgba.height;
+    checked.start_ts = start_ts;
+    checked.end_ts = end_ts;
+    return AnimFrameEnumerate(frame, 0, 0, -1, -1, &checked, CollectPixel);
+}
+
+static int CollectOnEnd(void* ctx, const AnimInfo* anim_info) {
+    return 1;
+}
+
+static const AnimDecRunCallback kCollectCallback = {
+    .on_start = CollectOnStart,
+    .on_frame = CollectOnFrame,
+    .on_end = CollectOnEnd,
+};
+
+// What a frame of the generated animations looks like.
+struct CheckFrameSpec {
+    int x_offset;
+    int y_offset;
+    int width;
+    int height;
+    int dispose; // GIF disposal mode, WebP only tells DISPOSE_BACKGROUND from the others
+    int blend; // WebP only
+    int transparent; // some pixels are left transparent
+};
+
+#define CHECK_CANVAS_WIDTH 40
+#define CHECK_CANVAS_HEIGHT 30
+
+// Full opaque frames are key frames, so seeks start at more than one of them.
+static const CheckFrameSpec kCheckFrames[] = {
+    { .x_offset = 0, .y_offset = 0, .width = 40, .height = 30, .dispose = DISPOSE_DO_NOT, .blend = 1, .transparent = 0 },
+    { .x_offset = 4, .y_offset = 4, .width = 20, .height = 10, .dispose = DISPOSE_BACKGROUND, .blend = 1, .transparent = 1 },
+    { .x_offset = 10, .y_offset = 8, .width = 16, .height = 12, .dispose = DISPOSE_PREVIOUS, .blend = 0, .transparent = 1 },
+    { .x_offset = 2, .y_offset = 14, .width = 30, .height = 16, .dispose = DISPOSE_DO_NOT, .blend = 1, .transparent = 1 },
+    { .x_offset = 0, .y_offset = 0, .width = 40, .height = 30, .dispose = DISPOSE_BACKGROUND, .blend = 1, .transparent = 0 },
+    { .x_offset = 6, .y_offset = 2, .width = 24, .height = 20, .dispose = DISPOSE_PREVIOUS, .blend = 1, .transparent = 1 },
+    { .x_offset = 0, .y_offset = 0, .width = 40, .height = 30, .dispose = DISPOSE_DO_NOT, .blend = 0, .transparent = 1 },
+    { .x_offset = 8, .y_offset = 6, .width = 12, .height = 18, .dispose = DISPOSE_BACKGROUND, .blend = 0, .transparent = 1 },
+    { .x_offset = 14, .y_offset = 10, .width = 26, .height = 20, .dispose = DISPOSE_DO_NOT, .blend = 1, .transparent = 1 },
+};
+
+#define CHECK_N_FRAMES static_cast<int>(sizeof(kCheckFrames) / sizeof(kCheckFrames[0]))
+
+static int AppendGifBytes(GifFileType* gif, const GifByteType* bytes, int size) {
+    auto out = reinterpret_cast<std::vector<uint8_t>*>(gif->UserData);
+    out->insert(out->end(), bytes, bytes + size);
+    return size;
+}
+
+// Index 0 is transparent, the others random colors. Odd frames have a local color table.
+static void MakeCheckGif(std::vector<uint8_t>* out) {
+    uint32_t state = 0x9E3779B9;
+    int gif_error = 0;
+    auto gif = EGifOpen(out, AppendGifBytes, &gif_error);
+    ensure(gif);
+
+    auto random_map = [&state]() {
+        auto map = GifMakeMapObject(256, nullptr);
+        ensure(map);
+        for (int i=0; i<256; ++i) {
+            auto color = NextRandom(&state);
+            map->Colors[i] = GifColorType { .Red = static_cast<GifByteType>(color),
+                                            .Green = static_cast<GifByteType>(color >> 8),
+                                            .Blue = static_cast<GifByteType>(color >> 16) };
+        }
+        return map;
+    };
+
+    auto global_map = random_map();
+    defer(GifFreeMapObject(global_map));
+    ensure(EGifPutScreenDesc(gif, CHECK_CANVAS_WIDTH, CHECK_CANVAS_HEIGHT, 8, 3, global_map) == GIF_OK);
+
+    std::vector<GifPixelType> line;
+    for (int i=0; i<CHECK_N_FRAMES; ++i) {
+        auto& spec = kCheckFrames[i];
+
+        GraphicsControlBlock gcb {
+            .DisposalMode = spec.dispose,
+            .UserInputFlag = false,
+            .DelayTime = 2 + i % 3,
+            .TransparentColor = spec.transparent ? 0 : NO_TRANSPARENT_COLOR
+        };
+        GifByteType extension[4];
+        ensure(EGifGCBToExtension(&gcb, extension) == sizeof(extension));
+        ensure(EGifPutExtension(gif, GRAPHICS_EXT_FUNC_CODE, sizeof(extension), extension) == GIF_OK);
+
+        ColorMapObject* local_map = (i % 2) ? random_map() : nullptr;
+        defer(GifFreeMapObject(local_map));
+        ensure(EGifPutImageDesc(gif, spec.x_offset, spec.y_offset, spec.width, spec.height, i == 5, local_map) == GIF_OK);
+
+        line.resize(spec.width);
+        for (int y=0; y<spec.height; ++y) {
+            for (int x=0; x<spec.width; ++x) {
+                auto index = NextRandom(&state) & 0xFF;
+                line[x] = static_cast<GifPixelType>(spec.transparent && (x + y) % 5 == 0 ? 0 : std::max(1u, index));
+            }
+            ensure(EGifPutLine(gif, line.data(), spec.width) == GIF_OK);
+        }
+    }
+
+    ensure(EGifCloseFile(gif, &gif_error) == GIF_OK);
+}
+
+// Lossless frames, so that alpha is kept exactly, with partly transparent pixels.
+static void MakeCheckWebP(WebPData* out) {
+    uint32_t state = 0x7F4A7C15;
+    auto mux = WebPMuxNew();
+    ensure(mux);
+    defer(WebPMuxDelete(mux));
+
+    for (int i=0; i<CHECK_N_FRAMES; ++i) {
+        auto& spec = kCheckFrames[i];
+
+        WebPPicture pic;
+        ensure(WebPPictureInit(&pic));
+        defer(WebPPictureFree(&pic));
+        pic.use_argb = 1;
+        pic.width = spec.width;
+        pic.height = spec.height;
+        ensure(WebPPictureAlloc(&pic));
+        for (int y=0; y<spec.height; ++y) {
+            for (int x=0; x<spec.width; ++x) {
+                auto color = NextRandom(&state) & 0x00FFFFFF;
+                uint32_t alpha = !spec.transparent ? 0xFF : (x + y) % 5 == 0 ? 0 : (x * 7 + y * 3) % 4 == 0 ? 0x80 : 0xFF;
+                pic.argb[pic.argb_stride * y + x] = alpha << 24 | color;
+            }
+        }
+
+        WebPConfig config;
+        ensure(WebPConfigInit(&config));
+        config.lossless = 1;
+        config.exact = 1;
+
+        WebPMemoryWriter writer;
+        WebPMemoryWriterInit(&writer);
+        defer(WebPMemoryWriterClear(&writer));
+        pic.writer = WebPMemoryWrite;
+        pic.custom_ptr = &writer;
+        ensure(WebPEncode(&config, &pic));
+
+        WebPMuxFrameInfo frame {};
+        frame.bitstream = WebPData { .bytes = writer.mem, .size = writer.size };
+        frame.x_offset = spec.x_offset;
+        frame.y_offset = spec.y_offset;
+        frame.duration = 20 + 10 * (i % 3);
+        frame.id = WEBP_CHUNK_ANMF;
+        frame.dispose_method = spec.dispose == DISPOSE_BACKGROUND ? WEBP_MUX_DISPOSE_BACKGROUND : WEBP_MUX_DISPOSE_NONE;
+        frame.blend_method = spec.blend ? WEBP_MUX_BLEND : WEBP_MUX_NO_BLEND;
+        ensure(WebPMuxPushFrame(mux, &frame, 1) == WEBP_MUX_OK);
+    }
+
+    ensure(WebPMuxSetCanvasSize(mux, CHECK_CANVAS_WIDTH, CHECK_CANVAS_HEIGHT) == WEBP_MUX_OK);
+    WebPMuxAnimParams params { .bgcolor = 0xFF336699, .loop_count = 0 };
+    ensure(WebPMuxSetAnimationParams(mux, &params) == WEBP_MUX_OK);
+    ensure(WebPMuxAssemble(mux, out) == WEBP_MUX_OK);
+}
+
+// Seeking decodes from a key frame with the composition rules of the sequential decoders re-done,
+// so every frame is decoded both ways and compared.
+static void CheckSeekedFrames(const char* name, const WebPData* data) {
+    std::vector<CheckedFrame> frames;
+    ensure(DecRunWithData(data, &frames, kCollectCallback));
+    ensure(static_cast<int>(frames.size()) == CHECK_N_FRAMES);
+
+    for (int i=0; i<=CHECK_N_FRAMES; ++i) {
+        std::vector<CheckedFrame> seeked;
+        ensure(DecRunFrameWithData(data, i, &seeked, kCollectCallback));
+
+        if (i == CHECK_N_FRAMES) {
+            ensure(seeked.empty());
+            break;
+        }
+
+        ensure(seeked.size() == 1);
+        auto& expected = frames[i];
+        auto& actual = seeked[0];
+        if (actual.width != expected.width || actual.height != expected.height ||
+            actual.start_ts != expected.start_ts || actual.end_ts != expected.end_ts || actual.rgba != expected.rgba) {
+            fprintf(stderr, "ERROR: Frame %d of the %s seeked is not the one decoded in sequence\n", i, name);
+            exit(1);
+        }
+    }
+
+    fprintf(stderr, "seek %s: %d frames match\n", name, CHECK_N_FRAMES);
+}
+
+static void CheckSeek() {
+    std::vector<uint8_t> gif;
+    MakeCheckGif(&gif);
+    WebPData gif_data { .bytes = gif.data(), .size = gif.size() };
+    CheckSeekedFrames("gif", &gif_data);
+
+    WebPData webp_data;
+    WebPDataInit(&webp_data);
+    defer(WebPDataClear(&webp_data));
+    MakeCheckWebP(&webp_data);
+    CheckSeekedFrames("webp", &webp_data);
+}
+
+// Every alpha pair under random colors, then short rows at every offset for the vector tails.
+static void CheckCompositeRow() {
+    uint32_t state = 0x2545F491;
+    std::vector<uint32_t> dst(256 * 256);
+    std::vector<uint32_t> src(dst.size());
+    for (size_t i=0; i<dst.size(); ++i) {
+        dst[i] = (static_cast<uint32_t>(i) >> 8) << 24 | (NextRandom(&state) & 0x00FFFFFF);
+        src[i] = (static_cast<uint32_t>(i) & 0xFF) << 24 | (NextRandom(&state) & 0x00FFFFFF);
+    }
+
+    static const CompositeMode kModes[] = { COMPOSITE_OVER, COMPOSITE_UNDER, COMPOSITE_MASK };
+    static const char* kModeNames[] = { "over", "under", "mask" };
+
+    auto compare = [&](int mode_index, int offset, int n, int null_src) {
+        auto mode = kModes[mode_index];
+        auto row_src = null_src ? nullptr : src.data() + offset;
+        std::vector<uint32_t> expected(dst.begin() + offset, dst.begin() + offset + n);
+        std::vector<uint32_t> actual(expected);
+        CompositeRowScalar(expected.data(), row_src, n, mode);
+        CompositeRow(actual.data(), row_src, n, mode);
+        if (actual != expected) {
+            fprintf(stderr, "ERROR: CompositeRow %s of %d pixels at %d%s differs from the scalar path\n",
+                    kModeNames[mode_index], n, offset, null_src ? " with no src" : "");
+            exit(1);
+        }
+    };
+
+    for (int mode_index=0; mode_index<3; ++mode_index) {
+        compare(mode_index, 0, static_cast<int>(dst.size()), 0);
+        for (int n=0; n<=40; ++n) {
+            for (int offset=0; offset<8; ++offset) {
+                compare(mode_index, offset, n, 0);
+                compare(mode_index, offset, n, 1);
+            }
+        }
+    }
+
+    fprintf(stderr, "composite_row: matches the scalar path\n");
+}
+
+static void RunChecks() {
+    CheckSeek();
+    CheckCompositeRow();
+}
+
+static int ParseArgs(int argc, char* argv[]) {
+    for (int i=1; i<argc; ++i) {
+        if (i + 1 < argc && !strcmp(argv[i], "--filter")) {
+            g_options.filter = argv[++i];
+        } else if (i + 1 < argc && !strcmp(argv[i], "--min-time-ms")) {
+            g_options.min_time_ms = std::max(1, atoi(argv[++i]));
+        } else if (i + 1 < argc && !strcmp(argv[i], "--samples")) {
+            g_options.n_samples = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--check")) {
+            g_options.check_only = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [--filter SUBSTRING] [--min-time-ms N] [--samples N] [--check]\n", argv[0]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (!ParseArgs(argc, argv)) {
+        return -1;
+    }
+
+    RunChecks();
+    if (g_options.check_only) {
+        return 0;
+    }
+
+    fprintf(stdout, "kernel\tvariant\twidth\theight\titerations\tns_per_iter\tmpix_per_s\n");
+
+    for (auto size : kSizes) {
+        WebPPicture pic;
+        InitSyntheticPic(&pic, size.width, size.height, 0x2545F491);
+        defer(WebPPictureFree(&pic));
+
+        BenchQuantizer(&pic);
+        BenchInverseColorMap(&pic);
+        BenchGaussianBlur(&pic);
+        BenchPicMerge(&pic);
+        BenchAnimFrame(&pic);
+        BenchKmeans(&pic);
+        BenchRescale(&pic);
+    }
+
+    return 0;
+}
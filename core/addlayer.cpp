@@ -22,9 +22,11 @@ struct Context {
     int total_duration_so_far;
 
     const char* output;
+    AnimEncoderBuffer* output_buffer; // instead of output
     const char* format;
     // global: WebPAnimEncoderOptions
     int minimize_size;
+    int global_palette;
     int verbose;
 
     // per-frame: WebPConfig
@@ -50,9 +52,12 @@ static int OnStart(void* ctx, const AnimInfo* info, int* stop) {
     AnimEncoderOptions encoder_options {
             .verbose = thiz->verbose,
             .minimize_size = thiz->minimize_size,
+            .global_palette = thiz->global_palette,
             .bgcolor = info->bgcolor
     };
-    auto encoder = AnimEncoderNew(thiz->format, info->canvas_width, info->canvas_height, &encoder_options);
+    auto encoder = thiz->output_buffer ?
+            AnimEncoderNewWithBuffer(thiz->format, info->canvas_width, info->canvas_height, &encoder_options, thiz->output_buffer) :
+            AnimEncoderNewWithFile(thiz->format, info->canvas_width, info->canvas_height, &encoder_options, thiz->output);
     check(encoder);
     thiz->encoder = encoder;
 
@@ -87,9 +92,11 @@ static int OnFrame(void* ctx, const AnimFrame* frame, int start_ts, int end_ts,
 
 static int OnEnd(void* ctx, const AnimInfo* anim_info) {
     auto thiz = reinterpret_cast<Context*>(ctx);
-    defer(AnimEncoderDelete(thiz->encoder));
+    auto encoder = thiz->encoder;
+    thiz->encoder = nullptr;
+    defer(AnimEncoderDelete(encoder));
 
-    check(AnimEncoderExport(thiz->encoder, thiz->total_duration_so_far, anim_info->loop_count, thiz->output));
+    check(AnimEncoderFinish(encoder, thiz->total_duration_so_far, anim_info->loop_count));
 
     return 1;
 }
@@ -104,18 +111,23 @@ static AnimDecRunCallback kRunCallback {
 
 
 
-int AnimToolAddLayer(
+// Decodes input_data when it is given, input otherwise, and encodes into output_buffer
+// when it is given, into the output file otherwise.
+static int AddLayer(
         const char* input,
-        const char* layer_path,
-        int overlay, // or else underlay
+        const WebPData* input_data,
+        WebPPicture* layer,
+        int overlay,
         int center,
-        int x, int y, // ignored if center == 1
+        int x, int y,
         const char* rgba_str,
 
         const char* output,
+        AnimEncoderBuffer* output_buffer,
         const char* format,
         // global: WebPAnimEncoderOptions
         int minimize_size,
+        int global_palette,
         int verbose,
 
         // per-frame: WebPConfig
@@ -124,18 +136,14 @@ int AnimToolAddLayer(
         int method,
         int pass
         ) {
-    WebPPicture layer;
-    check(WebPPictureInit(&layer));
-    defer(WebPPictureFree(&layer));
-    check(PicInitWithFile(&layer, layer_path));
     auto tint_color = cg::Color::FromRGBA(RGBAFrom(rgba_str));
     if (tint_color.a > 0) {
-        PicTint(&layer, tint_color);
+        PicTint(layer, tint_color);
     }
 
 
     Context ctx{
-        .layer = &layer,
+        .layer = layer,
         .overlay = overlay,
         .center = center,
         .point = cg::Point {
@@ -143,18 +151,88 @@ int AnimToolAddLayer(
             .y = y
         },
         .output = output,
+        .output_buffer = output_buffer,
         .format = format,
         .minimize_size = minimize_size,
+        .global_palette = global_palette,
         .verbose = verbose,
         .lossless = lossless,
         .quality = quality,
         .method = method,
         .pass = pass,
     };
+    // a run stopped before its end leaves its encoder, and the output is discarded with it
+    defer(if (ctx.encoder) AnimEncoderDelete(ctx.encoder); );
 
-    check(DecRun(input, &ctx, kRunCallback));
+    if (input_data) {
+        check(DecRunWithData(input_data, &ctx, kRunCallback));
+    } else {
+        check(DecRun(input, &ctx, kRunCallback));
+    }
 
     return 1;
 }
 
+int AnimToolAddLayer(
+        const char* input,
+        const char* layer_path,
+        int overlay, // or else underlay
+        int center,
+        int x, int y, // ignored if center == 1
+        const char* rgba_str,
+
+        const char* output,
+        const char* format,
+        // global: WebPAnimEncoderOptions
+        int minimize_size,
+        int global_palette,
+        int verbose,
+
+        // per-frame: WebPConfig
+        int lossless,
+        float quality,
+        int method,
+        int pass
+        ) {
+    WebPPicture layer;
+    check(WebPPictureInit(&layer));
+    defer(WebPPictureFree(&layer));
+    check(PicInitWithFile(&layer, layer_path));
+
+    return AddLayer(input, nullptr, &layer, overlay, center, x, y, rgba_str, output, nullptr, format,
+                    minimize_size, global_palette, verbose, lossless, quality, method, pass);
+}
+
+int AnimToolAddLayerWithData(
+        const WebPData* input,
+        const WebPData* layer_data,
+        int overlay, // or else underlay
+        int center,
+        int x, int y, // ignored if center == 1
+        const char* rgba_str,
+
+        AnimEncoderBuffer* output,
+        const char* format,
+        // global: WebPAnimEncoderOptions
+        int minimize_size,
+        int global_palette,
+        int verbose,
+
+        // per-frame: WebPConfig
+        int lossless,
+        float quality,
+        int method,
+        int pass
+        ) {
+    require(input && output);
+
+    WebPPicture layer;
+    check(WebPPictureInit(&layer));
+    defer(WebPPictureFree(&layer));
+    check(PicInitWithData(&layer, layer_data));
+
+    return AddLayer(nullptr, input, &layer, overlay, center, x, y, rgba_str, nullptr, output, format,
+                    minimize_size, global_palette, verbose, lossless, quality, method, pass);
+}
+
 
@@ -5,6 +5,9 @@
 #ifndef ANIMTOOL_ADDLAYER_H
 #define ANIMTOOL_ADDLAYER_H
 
+typedef struct WebPData WebPData;
+typedef struct AnimEncoderBuffer AnimEncoderBuffer;
+
 int AnimToolAddLayer(
         const char* input,
         const char* layer_path,
@@ -17,6 +20,30 @@ int AnimToolAddLayer(
         const char* format,
         // global: WebPAnimEncoderOptions
         int minimize_size,
+        int global_palette,
+        int verbose,
+
+        // per-frame: WebPConfig
+        int lossless,
+        float quality,
+        int method,
+        int pass
+);
+
+// Same as above, with the input and the layer in memory. The output is appended to `output`.
+int AnimToolAddLayerWithData(
+        const WebPData* input,
+        const WebPData* layer_data,
+        int overlay, // or else underlay
+        int center,
+        int x, int y,
+        const char* rgba_str,
+
+        AnimEncoderBuffer* output,
+        const char* format,
+        // global: WebPAnimEncoderOptions
+        int minimize_size,
+        int global_palette,
         int verbose,
 
         // per-frame: WebPConfig
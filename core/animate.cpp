@@ -5,6 +5,7 @@
 #include "animate.h"
 #include "animenc.h"
 #include "picutils.h"
+#include "piccache.h"
 #include "clrparse.h"
 
 #include "webp/encode.h"
@@ -12,14 +13,39 @@
 
 #include "cg.h"
 #include "check.h"
+#include "stagetime.h"
+#include "trace.h"
 #include "utils/defer.h"
+#include "utils/parallel.h"
+#include "utils/pool.h"
+#include "utils/queue.h"
 
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 
+// Images are read either from files or from the caller's memory, and decoded once through the shared cache.
+struct AnimateInputs {
+    const char* const* image_paths;
+    const WebPData* images;     // instead of image_paths
+    const WebPData* background; // instead of the path of a `file:` background
+
+    int LoadImage(WebPPicture* pic, int i) const {
+        auto cache = PicCacheGetShared();
+        return images ? cache->Load(pic, &images[i]) : cache->LoadFile(pic, image_paths[i]);
+    }
+
+    int LoadBackground(WebPPicture* pic, const char* bg_path) const {
+        auto cache = PicCacheGetShared();
+        return background ? cache->Load(pic, background) : cache->LoadFile(pic, bg_path);
+    }
+};
+
 
 static int BackgroundInit(WebPPicture* pic,
-    const char* const image_paths[],
+    const AnimateInputs& inputs,
     int n_images,
     const char* background,
     int bg_blur_radius,
@@ -40,10 +66,10 @@ static int BackgroundInit(WebPPicture* pic,
     cg::Size canvas_size {};
     if (width == 0 || height == 0) {
         if (!strcmp(bg_type, "file")) {
-            check(PicInitWithFile(pic, bg_content));
+            check(inputs.LoadBackground(pic, bg_content));
             logger::d("implied size from bg %d:%d", pic->width, pic->height);
         } else {
-            check(PicInitWithFile(pic, image_paths[0]));
+            check(inputs.LoadImage(pic, 0));
             logger::d("implied size from first frame %d:%d", pic->width, pic->height);
         }
 
@@ -57,22 +83,22 @@ static int BackgroundInit(WebPPicture* pic,
 
     if (!strcmp(bg_type, "file")) {
         if (pic->width == 0) {
-            check(PicInitWithFile(pic, bg_content));
+            check(inputs.LoadBackground(pic, bg_content));
         }
         check(PicFill(pic, canvas_size));
         if (bg_blur_radius > 0) {
-            check(PicBlur(pic, bg_blur_radius));
+            check(PicBlur(pic, bg_blur_radius, 0, nullptr));
         }
     } else if (!strcmp(bg_type, "frame")) {
         auto frame_idx = atoi(bg_content);
         require(frame_idx < n_images);
         WebPPictureFree(pic);
-        check(PicInitWithFile(pic, image_paths[frame_idx]));
+        check(inputs.LoadImage(pic, frame_idx));
 
         check(PicFill(pic, canvas_size));
 
         if (bg_blur_radius > 0) {
-            check(PicBlur(pic, bg_blur_radius));
+            check(PicBlur(pic, bg_blur_radius, 0, nullptr));
         }
     } else if (!strcmp(bg_type, "color")) {
         pic->width = width;
@@ -88,8 +114,96 @@ static int BackgroundInit(WebPPicture* pic,
 }
 
 
-int AnimToolAnimate(
-        const char* const image_paths[],
+// Most images an animation decodes and fits ahead of the encoder, each holding a canvas.
+#define ANIMATE_MAX_LOOKAHEAD 8
+
+typedef std::shared_ptr<WebPPicture> SharedPic;
+
+// Makes the canvases of the images, the background with an image fit over it, on a pool of threads.
+// Up to `lookahead` images past the one being encoded are in the works; canvases are taken in order.
+struct CanvasPrefetcher {
+    CanvasPrefetcher(const AnimateInputs& inputs, const WebPPicture* bg, int n_images, int lookahead):
+            inputs(inputs), bg(bg), n_images(n_images), n_submitted(0), aborted(0),
+            stage_times(StageTimesGetBound()) {
+        for (int i=0; i<lookahead; ++i) {
+            slots.emplace_back(new BoundedQueue<SharedPic>(1));
+        }
+        pool.reset(new ThreadPool(lookahead, lookahead));
+    }
+
+    CanvasPrefetcher(const CanvasPrefetcher&) = delete;
+    CanvasPrefetcher& operator=(const CanvasPrefetcher&) = delete;
+
+    ~CanvasPrefetcher() {
+        // images still in the works are dropped when the encoder gives up early
+        aborted = 1;
+        pool.reset();
+    }
+
+    // Waits for the canvas of image i, i being 0, 1, 2...
+    int Take(int i, SharedPic* canvas) {
+        const int lookahead = static_cast<int>(slots.size());
+        while (n_submitted < n_images && n_submitted < i + lookahead) {
+            check(Submit(n_submitted++));
+        }
+
+        {
+            TraceScope trace("queue_pop");
+            check(slots[i % lookahead]->Pop(canvas));
+        }
+        checkf(*canvas, "Failed to load image %d", i);
+
+        return 1;
+    }
+
+private:
+    // Image i goes to slot i % lookahead, which image i - lookahead has left by then.
+    int Submit(int i) {
+        return pool->Submit([this, i]() {
+            StageTimesBinding binding(stage_times);
+
+            SharedPic canvas;
+            if (aborted || !MakeCanvas(i, &canvas)) {
+                canvas.reset();
+            }
+            slots[i % slots.size()]->Push(std::move(canvas));
+        });
+    }
+
+    int MakeCanvas(int i, SharedPic* out) {
+        WebPPicture pic;
+        check(WebPPictureInit(&pic));
+        defer(WebPPictureFree(&pic));
+        pic.use_argb = 1;
+        check(inputs.LoadImage(&pic, i));
+
+        SharedPic canvas(new WebPPicture(), [](WebPPicture* p) {
+            WebPPictureFree(p);
+            delete p;
+        });
+        check(WebPPictureInit(canvas.get()));
+        check(WebPPictureCopy(bg, canvas.get()));
+        check(PicDrawOverFit(canvas.get(), &pic, 1));
+
+        *out = std::move(canvas);
+        return 1;
+    }
+
+    const AnimateInputs& inputs;
+    const WebPPicture* bg;
+    const int n_images;
+    int n_submitted;
+    std::atomic<int> aborted;
+    StageTimes* stage_times;
+
+    std::vector<std::unique_ptr<BoundedQueue<SharedPic>>> slots;
+    std::unique_ptr<ThreadPool> pool;
+};
+
+
+// Encodes into output_buffer when it is given, into the output file otherwise.
+static int Animate(
+        const AnimateInputs& inputs,
         int n_images,
         const char* background,
         int bg_blur_radius,
@@ -97,9 +211,11 @@ int AnimToolAnimate(
         int height,
         int duration,
         const char* output,
+        AnimEncoderBuffer* output_buffer,
         const char* format,
         // global: WebPAnimEncoderOptions
         int minimize_size,
+        int global_palette,
         int verbose,
 
         // per-frame: WebPConfig
@@ -114,6 +230,7 @@ int AnimToolAnimate(
     AnimEncoderOptions encoder_options {
         .verbose = verbose,
         .minimize_size = minimize_size,
+        .global_palette = global_palette,
     };
 
     AnimFrameOptions frame_options {
@@ -129,42 +246,98 @@ int AnimToolAnimate(
     WebPPicture bg;
     check(WebPPictureInit(&bg));
     defer(WebPPictureFree(&bg));
-    check(BackgroundInit(&bg, image_paths, n_images, background, bg_blur_radius, width, height));
+    check(BackgroundInit(&bg, inputs, n_images, background, bg_blur_radius, width, height));
 
 
-    auto encoder = AnimEncoderNew(format, width, height, &encoder_options);
+    auto encoder = output_buffer ?
+            AnimEncoderNewWithBuffer(format, width, height, &encoder_options, output_buffer) :
+            AnimEncoderNewWithFile(format, width, height, &encoder_options, output);
     check(encoder);
     defer(if (encoder) AnimEncoderDelete(encoder); );
 
 
-    WebPPicture canvas;
-    check(WebPPictureInit(&canvas));
-    defer(WebPPictureFree(&canvas));
-    canvas.use_argb = 1;
-
+    // decoding and fitting are independent per image, only the encoder needs them in order
+    auto lookahead = std::min(n_images, std::min(ParallelGetThreadCount(), ANIMATE_MAX_LOOKAHEAD));
+    CanvasPrefetcher prefetcher(inputs, &bg, n_images, lookahead);
 
     int total_duration_so_far = 0;
     for (int i=0; i<n_images; ++i) {
 
-        WebPPicture pic;
-        check(WebPPictureInit(&pic));
-        defer(WebPPictureFree(&pic));
-        pic.use_argb = 1;
-        check(PicInitWithFile(&pic, image_paths[i]));
-
-        check(WebPPictureCopy(&bg, &canvas));
-        check(PicDrawOverFit(&canvas, &pic, 1));
+        SharedPic canvas;
+        check(prefetcher.Take(i, &canvas));
 
         auto end_ts = total_duration_so_far + duration;
-        check(AnimEncoderAddFrame(encoder, &canvas, total_duration_so_far, end_ts, &frame_options));
+        check(AnimEncoderAddFrame(encoder, canvas.get(), total_duration_so_far, end_ts, &frame_options));
         total_duration_so_far = end_ts;
     }
 
-    check(AnimEncoderExport(encoder, total_duration_so_far, 0, output));
+    check(AnimEncoderFinish(encoder, total_duration_so_far, 0));
 
     return 1;
 }
 
+int AnimToolAnimate(
+        const char* const image_paths[],
+        int n_images,
+        const char* background,
+        int bg_blur_radius,
+        int width,
+        int height,
+        int duration,
+        const char* output,
+        const char* format,
+        // global: WebPAnimEncoderOptions
+        int minimize_size,
+        int global_palette,
+        int verbose,
+
+        // per-frame: WebPConfig
+        int lossless,
+        float quality,
+        int method,
+        int pass
+) {
+    AnimateInputs inputs {
+        .image_paths = image_paths
+    };
+
+    return Animate(inputs, n_images, background, bg_blur_radius, width, height, duration, output, nullptr, format,
+                   minimize_size, global_palette, verbose, lossless, quality, method, pass);
+}
+
+int AnimToolAnimateWithData(
+        const WebPData images[],
+        int n_images,
+        const char* background,
+        const WebPData* background_image,
+        int bg_blur_radius,
+        int width,
+        int height,
+        int duration,
+        AnimEncoderBuffer* output,
+        const char* format,
+        // global: WebPAnimEncoderOptions
+        int minimize_size,
+        int global_palette,
+        int verbose,
+
+        // per-frame: WebPConfig
+        int lossless,
+        float quality,
+        int method,
+        int pass
+) {
+    require(images && output);
+
+    AnimateInputs inputs {
+        .images = images,
+        .background = background_image
+    };
+
+    return Animate(inputs, n_images, background, bg_blur_radius, width, height, duration, nullptr, output, format,
+                   minimize_size, global_palette, verbose, lossless, quality, method, pass);
+}
+
 
 
 int AnimToolAnimateLite(
@@ -181,6 +354,7 @@ int AnimToolAnimateLite(
             image_paths, n_images, background, bg_blur_radius, width, height, duration, output, "webp",
 
             0, // minimize_size
+            0, // global_palette
             0, // verbose
 
             0, // lossless
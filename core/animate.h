@@ -10,6 +10,9 @@
 extern "C" {
 #endif
 
+typedef struct WebPData WebPData;
+typedef struct AnimEncoderBuffer AnimEncoderBuffer;
+
 
 int AnimToolAnimate(
         const char*const image_paths[],
@@ -23,6 +26,32 @@ int AnimToolAnimate(
         const char* format,
         // global: WebPAnimEncoderOptions
         int minimize_size,
+        int global_palette,
+        int verbose,
+
+        // per-frame: WebPConfig
+        int lossless,
+        float quality,
+        int method,
+        int pass
+);
+
+// Same as above, with the images in memory. A `file:` background is read from background_image,
+// the path after `file:` is ignored. The output is appended to `output`.
+int AnimToolAnimateWithData(
+        const WebPData images[],
+        int n_images,
+        const char* background,
+        const WebPData* background_image,
+        int bg_blur_radius,
+        int width,
+        int height,
+        int duration,
+        AnimEncoderBuffer* output,
+        const char* format,
+        // global: WebPAnimEncoderOptions
+        int minimize_size,
+        int global_palette,
         int verbose,
 
         // per-frame: WebPConfig
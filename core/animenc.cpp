@@ -4,9 +4,14 @@
 
 #include "animenc.h"
 #include "quantizer.h"
+#include "colormap.h"
+#include "stagetime.h"
+#include "trace.h"
+#include "cg.h"
 
 #include "webp/encode.h"
 #include "webp/mux.h"
+#include "webp/format_constants.h" // RIFF_HEADER_SIZE, CHUNK_HEADER_SIZE, ANIM_CHUNK_SIZE
 #include "../imageio/imageio_util.h"
 
 #include "check_gif.h"
@@ -16,18 +21,50 @@
 #include "check.h"
 #include "logger.h"
 #include "utils/defer.h"
+#include "utils/tmppath.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cmath>
-#include <unordered_map>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 struct AnimEncoder {
 public:
     virtual int Init(int canvas_width, int canvas_height, const AnimEncoderOptions* options) = 0;
     virtual int AddFrame(WebPPicture* pic, int start_ts, int end_ts, const AnimFrameOptions* options) = 0;
-    virtual int Export(int final_ts, int loop_count, const char* output_path) = 0;
+    // writes whatever has not been written to the sink yet
+    virtual int Finish(int final_ts, int loop_count) = 0;
     virtual const char* GetFileExt() const = 0;
-    virtual ~AnimEncoder() = default;;
+    virtual ~AnimEncoder() {
+        // still owned when the encoder did not finish
+        if (owns_sink) AnimEncoderSinkDiscard(&sink);
+        AnimEncoderBufferClear(&buffer);
+    }
+
+    // GIF writes in small blocks, which are not traced one by one.
+    int Write(const uint8_t* bytes, size_t size, int traced = 1) {
+        StageScope scope(STAGE_WRITE, traced);
+        check(sink.write(sink.ctx, bytes, size));
+        bytes_written += size;
+        return 1;
+    }
+
+    AnimEncoderSink sink {};
+    size_t bytes_written = 0; // to the sink
+    int owns_sink = 0;
+    std::string output_path; // of the sink it owns
+    AnimEncoderBuffer buffer {}; // behind the sink of encoders made by AnimEncoderNew
 };
 
 
@@ -82,40 +119,34 @@ public:
         return 1;
     }
 
-    static int SetLoopCount(int loop_count, WebPData* const webp_data) {
-        int ok = 1;
-        WebPMuxError err;
-        uint32_t features;
-        WebPMuxAnimParams new_params;
-        WebPMux* const mux = WebPMuxCreate(webp_data, 1);
-        if (mux == nullptr) return 0;
-
-        err = WebPMuxGetFeatures(mux, &features);
-        ok = (err == WEBP_MUX_OK);
-        if (!ok || !(features & ANIMATION_FLAG)) goto End;
-
-        err = WebPMuxGetAnimationParams(mux, &new_params);
-        ok = (err == WEBP_MUX_OK);
-        if (ok) {
-            new_params.loop_count = loop_count;
-            err = WebPMuxSetAnimationParams(mux, &new_params);
-            ok = (err == WEBP_MUX_OK);
-        }
-        if (ok) {
-            WebPDataClear(webp_data);
-            err = WebPMuxAssemble(mux, webp_data);
-            ok = (err == WEBP_MUX_OK);
-        }
+    static uint32_t GetLE32(const uint8_t* bytes) {
+        return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+    }
 
-        End:
-        WebPMuxDelete(mux);
-        if (!ok) {
-            logger::e("Error during loop-count setting");
+    // Writes the loop count straight into the ANIM chunk of the assembled file, instead of
+    // rebuilding the whole file through WebPMux. Still images have no ANIM chunk and are left as they are.
+    static void PatchLoopCount(int loop_count, WebPData* const webp_data) {
+        auto bytes = const_cast<uint8_t*>(webp_data->bytes);
+        auto size = webp_data->size;
+        if (size < RIFF_HEADER_SIZE || memcmp(bytes, "RIFF", 4) || memcmp(bytes + 8, "WEBP", 4))
+            return;
+
+        size_t offset = RIFF_HEADER_SIZE;
+        while (offset + CHUNK_HEADER_SIZE <= size) {
+            auto chunk_size = GetLE32(bytes + offset + 4);
+            if (!memcmp(bytes + offset, "ANIM", 4)) {
+                if (chunk_size >= ANIM_CHUNK_SIZE && offset + CHUNK_HEADER_SIZE + ANIM_CHUNK_SIZE <= size) {
+                    auto loop = bytes + offset + CHUNK_HEADER_SIZE + 4; // after the background color
+                    loop[0] = loop_count & 0xff;
+                    loop[1] = (loop_count >> 8) & 0xff;
+                }
+                return;
+            }
+            offset += CHUNK_HEADER_SIZE + chunk_size + (chunk_size & 1);
         }
-        return ok;
     }
 
-    int Export(int final_ts, int loop_count, const char* output_path) override {
+    int Finish(int final_ts, int loop_count) override {
         require(impl);
 
         checkf(WebPAnimEncoderAdd(impl, nullptr, final_ts, nullptr), "%s", WebPAnimEncoderGetError(impl));
@@ -123,104 +154,46 @@ public:
         WebPData webp_out_data;
         WebPDataInit(&webp_out_data);
         defer(WebPDataClear(&webp_out_data));
-        checkf(WebPAnimEncoderAssemble(impl, &webp_out_data), "%s", WebPAnimEncoderGetError(impl));
-
-        if (loop_count > 0) {
-            logger::d("SetLoopCount %d", loop_count);
-            check(AnimEncoderWebP::SetLoopCount(loop_count, &webp_out_data));
-        }
-
-        check(ImgIoUtilWriteFile(output_path, webp_out_data.bytes, webp_out_data.size));
-        logger::i("File created at %s", output_path);
-
-        return 1;
-    }
-};
-
-class ByteArray {
-private:
-    int capacity;
-    GifByteType* buffer;
-    int count;
-
-public:
-    ByteArray(): capacity(0), buffer(0), count(0) {
-    }
-
-    ~ByteArray() {
-        if (buffer)
-            free(buffer);
-    }
-
-    const GifByteType* GetBytes() const {
-        return buffer;
-    }
-
-    int GetCount() const {
-        return count;
-    }
+        {
+            StageScope scope(STAGE_MUX);
+            checkf(WebPAnimEncoderAssemble(impl, &webp_out_data), "%s", WebPAnimEncoderGetError(impl));
 
-    int Append(const GifByteType* bytes, int size) {
-        if (count + size > capacity) {
-            int new_cap = (count + size - capacity) * 2 + capacity;
-            auto new_buf = reinterpret_cast<GifByteType*>(malloc(new_cap));
-            check(new_buf);
-
-            if (buffer) {
-                memcpy(new_buf, buffer, count);
-                free(buffer);
+            if (loop_count > 0) {
+                logger::d("SetLoopCount %d", loop_count);
+                PatchLoopCount(loop_count, &webp_out_data);
             }
-
-            buffer = new_buf;
-            capacity = new_cap;
         }
 
-        memcpy(buffer + count, bytes, size);
-        count += size;
+        check(Write(webp_out_data.bytes, webp_out_data.size));
 
         return 1;
     }
 };
 
-
 struct AnimEncoderGif : public AnimEncoder {
     static int FileOutputFunc(GifFileType * fileType, const GifByteType * bytes, int size) {
         auto encoder = reinterpret_cast<AnimEncoderGif*>(fileType->UserData);
-        check(encoder->buffer.Append(bytes, size));
+        check(encoder->Write(bytes, size, 0));
         return size;
     }
     static const uint8_t    COLOR_RES = 8;             // color位数, 0~8 
     static const int        COLOR_COUNT = 1 << COLOR_RES;       // color数量，这里使用256
     static const int TRANSPARENT_INDEX = 0;
-
-    static int Distance(GifColorType l, GifColorType r) {
-        return (l.Red - r.Red) * (l.Red - r.Red) +
-               (l.Green - r.Green) * (l.Green - r.Green) +
-               (l.Blue - r.Blue) * (l.Blue - r.Blue);
-    }
-
-    static int FindIndex(const ColorMapObject* cmo, GifColorType color) {
-        int min_dist = 0;
-        int min_idx = -1;
-        for (int i=TRANSPARENT_INDEX + 1; i<cmo->ColorCount; ++i) {
-            auto dist = Distance(cmo->Colors[i], color);
-            if (min_idx < 0 || min_dist > dist) {
-                min_idx = i;
-                min_dist = dist;
-            }
-        }
-
-        return min_idx;
-    }
+    static const uint32_t ALPHA_THRESHOLD = 64; // more transparent pixels are written as TRANSPARENT_INDEX
+    static const int GLOBAL_PALETTE_SAMPLE_FRAMES = 16;
+    static const int GLOBAL_PALETTE_SAMPLE_PIXELS = 1 << 23; // keeps the quantizer's 32-bit moments from overflowing
 
 public:
     ~AnimEncoderGif() override {
         if (impl) {
             int gif_error = 0;
-            if (!DGifCloseFile(impl, &gif_error)) {
-                log_gif_error("DGifCloseFile", gif_error);
+            if (!EGifCloseFile(impl, &gif_error)) {
+                log_gif_error("EGifCloseFile", gif_error);
             }
         }
+        if (global_color_map) {
+            GifFreeMapObject(global_color_map);
+        }
     }
 
     const char* GetFileExt() const override {
@@ -237,7 +210,30 @@ public:
 
         EGifSetGifVersion(impl, 1);
 
-        check_gif(EGifPutScreenDesc(impl, canvas_width, canvas_height, COLOR_RES, 0, 0), impl);
+        this->canvas_width = canvas_width;
+        this->canvas_height = canvas_height;
+        exact_colors = !options->gif_box_colors;
+        delta_frames = options->minimize_size;
+        if (delta_frames) {
+            // the canvas starts out transparent
+            canvas.assign(canvas_width * canvas_height, 0);
+            pending.resize(canvas_width * canvas_height);
+            next.resize(canvas_width * canvas_height);
+        }
+
+        // the screen descriptor carries the global color table, so it waits for the sampled frames
+        global_palette = options->global_palette;
+        if (global_palette) {
+            int canvas_pixels = std::max(1, canvas_width * canvas_height);
+            n_sample_frames = std::max(1, std::min(GLOBAL_PALETTE_SAMPLE_FRAMES, GLOBAL_PALETTE_SAMPLE_PIXELS / canvas_pixels));
+            return 1;
+        }
+
+        return PutHeader(nullptr);
+    }
+
+    int PutHeader(const ColorMapObject* global_color_map) {
+        check_gif(EGifPutScreenDesc(impl, canvas_width, canvas_height, COLOR_RES, 0, global_color_map), impl);
 
         static const GifByteType aeLen = 11;
         static const char *aeBytes = { "NETSCAPE2.0" };
@@ -259,16 +255,54 @@ public:
         color.Blue = b;
     }
 
-    int AddFrame(WebPPicture* pic, int start_ts, int end_ts, const AnimFrameOptions* options) override {
-        require(impl);
-        require(pic->use_argb);
+    // GIF only has on/off transparency, so delta frames compare pixels after thresholding alpha.
+    static uint32_t Visible(uint32_t argb) {
+        return ((argb >> 24) < ALPHA_THRESHOLD) ? 0 : (argb | 0xff000000);
+    }
 
-        int end_ts_ten_ms = static_cast<int>(round(end_ts / 10.0));
-        int delay_ten_ms = end_ts_ten_ms - duration_ten_ms;
-        duration_ten_ms = end_ts_ten_ms;
+    // Bounding rect of the pixels where `pred(x, y)` holds, or an empty rect if there are none.
+    template <typename P>
+    static cg::Rect BoundsOf(int width, int height, P pred) {
+        int left = width, top = height, right = 0, bottom = 0;
+        for (int y=0; y<height; ++y) {
+            for (int x=0; x<width; ++x) {
+                if (!pred(x, y))
+                    continue;
+                left = std::min(left, x);
+                right = std::max(right, x + 1);
+                top = std::min(top, y);
+                bottom = y + 1;
+            }
+        }
+
+        if (left >= right)
+            return cg::Rect { .origin = {0, 0}, .size = {0, 0} };
+        return cg::Rect { .origin = {left, top}, .size = {right - left, bottom - top} };
+    }
+
+    static cg::Rect Union(const cg::Rect& a, const cg::Rect& b) {
+        if (a.Width() <= 0) return b;
+        if (b.Width() <= 0) return a;
+
+        auto left = std::min(a.Left(), b.Left());
+        auto top = std::min(a.Top(), b.Top());
+        return cg::Rect {
+            .origin = {left, top},
+            .size = {std::max(a.Right(), b.Right()) - left, std::max(a.Bottom(), b.Bottom()) - top}
+        };
+    }
+
+    // Writes `rect` of a canvas sized frame as one GIF image.
+    // Pixels equal to `base`, when given, are written as TRANSPARENT_INDEX so the canvas below shows through.
+    int PutImage(const uint32_t* argb, int argb_stride, const uint32_t* base, cg::Rect rect,
+                 int disposal, int delay_ten_ms) {
+        // GIF images can't be empty, an unchanged pixel keeps the canvas as it is.
+        if (rect.Width() <= 0) {
+            rect = cg::Rect { .origin = {0, 0}, .size = {1, 1} };
+        }
 
         GraphicsControlBlock gcb {
-            .DisposalMode = DISPOSE_BACKGROUND,
+            .DisposalMode = disposal,
             .UserInputFlag = false,
             .DelayTime = delay_ten_ms,
             .TransparentColor = TRANSPARENT_INDEX
@@ -278,71 +312,206 @@ public:
         check_gif(EGifGCBToExtension(&gcb, extension), impl);
         check_gif(EGifPutExtension(impl, GRAPHICS_EXT_FUNC_CODE, sizeof(extension), extension), impl);
 
-        auto color_map = GifMakeMapObject(COLOR_COUNT, nullptr);
-        check(color_map);
+        auto origin = argb + argb_stride * rect.Top() + rect.Left();
+
+        ColorMapObject* color_map = nullptr;
         defer(GifFreeMapObject(color_map));
 
-        WuQuantizer quantizer;
-        check(quantizer.Init(pic->width, pic->height));
+        // with a global palette, inverse_map already maps to the global color table
+        if (!global_palette) {
+            StageScope scope(STAGE_QUANTIZE);
 
+            color_map = GifMakeMapObject(COLOR_COUNT, nullptr);
+            check(color_map);
 
-        for (int y=0; y<pic->height; ++y) {
-            auto argb_line = pic->argb + pic->argb_stride * y;
-            for (int x=0; x<pic->width; ++x) {
-                GifColorType pixel = {
-                        .Red = static_cast<GifByteType>((argb_line[x] >> 16) & 0x000000FF),
-                        .Green = static_cast<GifByteType>((argb_line[x] >> 8) & 0x000000FF),
-                        .Blue = static_cast<GifByteType>(argb_line[x] & 0x000000FF)
-                };
-
-                quantizer.AddPixel(x, y, pixel.Red, pixel.Green, pixel.Blue);
-            }
+            WuQuantizer quantizer;
+            check(quantizer.Init(rect.Width(), rect.Height()));
+            check(quantizer.AddPixels(origin, argb_stride, &histogram_bands));
+
+            check(quantizer.Build(COLOR_COUNT - TRANSPARENT_INDEX - 1, color_map, QuantizerVisit));
+
+            check(inverse_map.Init(&quantizer, color_map, TRANSPARENT_INDEX + 1, exact_colors));
         }
 
-        check(quantizer.Build(COLOR_COUNT - TRANSPARENT_INDEX - 1, color_map, QuantizerVisit));
+        check_gif(EGifPutImageDesc(impl, rect.Left(), rect.Top(), rect.Width(), rect.Height(), false, color_map), impl);
 
+        index_line.resize(rect.Width());
+        auto indices = index_line.data();
 
-        check_gif(EGifPutImageDesc(impl, 0, 0, pic->width, pic->height, false, color_map), impl);
+        for (int y=0; y<rect.Height(); ++y) {
+            auto argb_line = origin + argb_stride * y;
 
-        std::unordered_map<uint32_t, uint8_t> cached_index_map;
+            {
+                StageScope scope(STAGE_QUANTIZE, 0);
 
-        for (int y=0; y<pic->height; ++y) {
-            auto argb_line = pic->argb + pic->argb_stride * y;
-            for (int x=0; x<pic->width; ++x) {
-                auto pixel = argb_line[x];
-                auto rgb = pixel & 0x00FFFFFF;
-                auto alpha = pixel >> 24;
-                if (alpha < 64) {
-                    check_gif(EGifPutPixel(impl, 0), impl);
+                inverse_map.MapRow(argb_line, rect.Width(), indices);
+                if (base) {
+                    auto base_line = base + argb_stride * (rect.Top() + y) + rect.Left();
+                    for (int x=0; x<rect.Width(); ++x) {
+                        auto keep = ((argb_line[x] >> 24) < ALPHA_THRESHOLD) | (argb_line[x] == base_line[x]);
+                        indices[x] = keep ? TRANSPARENT_INDEX : indices[x];
+                    }
                 } else {
-                    if (cached_index_map.find(rgb) != cached_index_map.end()) {
-                        check_gif(EGifPutPixel(impl, cached_index_map[rgb]), impl);
-                    } else {
-
-                        GifColorType color = {
-                                .Red = static_cast<GifByteType>((rgb >> 16) & 0x000000FF),
-                                .Green = static_cast<GifByteType>((rgb >> 8) & 0x000000FF),
-                                .Blue = static_cast<GifByteType>(rgb & 0x000000FF)
-                        };
-
-                        auto color_index = FindIndex(color_map, color);
-                        requiref(color_index > TRANSPARENT_INDEX, "map count %d, index=%d", color_map->ColorCount, color_index);
-                        auto color_index_uint8 = static_cast<uint8_t>(color_index);
-
-                        cached_index_map[rgb] = color_index_uint8;
-                        check_gif(EGifPutPixel(impl, color_index_uint8), impl);
+                    for (int x=0; x<rect.Width(); ++x) {
+                        indices[x] = ((argb_line[x] >> 24) < ALPHA_THRESHOLD) ? TRANSPARENT_INDEX : indices[x];
                     }
                 }
             }
+
+            check_gif(EGifPutLine(impl, indices, rect.Width()), impl);
+        }
+
+        return 1;
+    }
+
+    // A frame's disposal depends on the frame after it: DISPOSE_DO_NOT unless the next frame turns
+    // visible pixels transparent, which only DISPOSE_BACKGROUND can do. The rect is grown to cover them.
+    int PutPending(const uint32_t* next) {
+        auto width = canvas_width;
+        auto& pending_frame = pending;
+        auto cleared = BoundsOf(canvas_width, canvas_height, [&](int x, int y) {
+            auto i = y * width + x;
+            return pending_frame[i] != 0 && (!next || next[i] == 0);
+        });
+
+        auto disposal = cleared.Width() > 0 ? DISPOSE_BACKGROUND : DISPOSE_DO_NOT;
+        pending_rect = Union(pending_rect, cleared);
+
+        check(PutImage(pending.data(), canvas_width, canvas.data(), pending_rect,
+                       disposal, pending_delay_ten_ms));
+
+        // what the canvas looks like once the pending frame has been disposed of
+        canvas.swap(pending);
+        if (disposal == DISPOSE_BACKGROUND) {
+            for (int y=pending_rect.Top(); y<pending_rect.Bottom(); ++y) {
+                std::fill_n(canvas.data() + y * canvas_width + pending_rect.Left(), pending_rect.Width(), 0);
+            }
+        }
+
+        return 1;
+    }
+
+    int AddDeltaFrame(const uint32_t* argb, int argb_stride, int delay_ten_ms) {
+        for (int y=0; y<canvas_height; ++y) {
+            auto argb_line = argb + argb_stride * y;
+            std::transform(argb_line, argb_line + canvas_width, next.data() + y * canvas_width, Visible);
+        }
+
+        if (has_pending) {
+            if (next == pending) {
+                pending_delay_ten_ms += delay_ten_ms;
+                return 1;
+            }
+            check(PutPending(next.data()));
+        }
+
+        auto width = canvas_width;
+        auto& base = canvas;
+        auto& frame = next;
+        pending_rect = BoundsOf(canvas_width, canvas_height, [&](int x, int y) {
+            auto i = y * width + x;
+            return frame[i] != base[i];
+        });
+        pending.swap(next);
+        pending_delay_ten_ms = delay_ten_ms;
+        has_pending = 1;
+
+        return 1;
+    }
+
+    int AddFrame(WebPPicture* pic, int start_ts, int end_ts, const AnimFrameOptions* options) override {
+        require(impl);
+        require(pic->use_argb);
+
+        int end_ts_ten_ms = static_cast<int>(round(end_ts / 10.0));
+        int delay_ten_ms = end_ts_ten_ms - duration_ten_ms;
+        duration_ten_ms = end_ts_ten_ms;
+
+        if (global_palette && !global_color_map) {
+            return AddSampleFrame(pic, delay_ten_ms);
+        }
+
+        return PutFrame(pic->argb, pic->argb_stride, pic->width, pic->height, delay_ten_ms);
+    }
+
+    int PutFrame(const uint32_t* argb, int argb_stride, int width, int height, int delay_ten_ms) {
+        if (delta_frames) {
+            require(width == canvas_width && height == canvas_height);
+            return AddDeltaFrame(argb, argb_stride, delay_ten_ms);
+        }
+
+        cg::Rect rect { .origin = {0, 0}, .size = {width, height} };
+        return PutImage(argb, argb_stride, nullptr, rect, DISPOSE_BACKGROUND, delay_ten_ms);
+    }
+
+    // Frames are held back and fed to one quantizer until there are enough of them to pick the global palette.
+    int AddSampleFrame(WebPPicture* pic, int delay_ten_ms) {
+        require(pic->width == canvas_width && pic->height == canvas_height);
+
+        if (!sample_quantizer) {
+            sample_quantizer.reset(new WuQuantizer());
+            check(sample_quantizer);
+            check(sample_quantizer->Init(canvas_width, canvas_height));
+        }
+        {
+            StageScope scope(STAGE_QUANTIZE);
+            check(sample_quantizer->AddPixels(pic->argb, pic->argb_stride, &histogram_bands));
+        }
+
+        samples.emplace_back();
+        auto& sample = samples.back();
+        sample.argb.resize(canvas_width * canvas_height);
+        for (int y=0; y<canvas_height; ++y) {
+            auto argb_line = pic->argb + pic->argb_stride * y;
+            std::copy(argb_line, argb_line + canvas_width, sample.argb.data() + y * canvas_width);
         }
+        sample.delay_ten_ms = delay_ten_ms;
+
+        if (static_cast<int>(samples.size()) < n_sample_frames)
+            return 1;
+
+        return PutGlobalPalette();
+    }
+
+    int PutGlobalPalette() {
+        global_color_map = GifMakeMapObject(COLOR_COUNT, nullptr);
+        check(global_color_map);
+
+        if (samples.empty())
+            return PutHeader(global_color_map);
+
+        {
+            StageScope scope(STAGE_QUANTIZE);
+            check(sample_quantizer->Build(COLOR_COUNT - TRANSPARENT_INDEX - 1, global_color_map, QuantizerVisit));
+            check(inverse_map.Init(sample_quantizer.get(), global_color_map, TRANSPARENT_INDEX + 1, exact_colors));
+            sample_quantizer.reset();
+        }
+
+        check(PutHeader(global_color_map));
+
+        for (auto& sample : samples) {
+            check(PutFrame(sample.argb.data(), canvas_width, canvas_width, canvas_height, sample.delay_ten_ms));
+        }
+        samples.clear();
+        samples.shrink_to_fit();
 
         return 1;
     }
 
 
-    int Export(int final_ts, int loop_count, const char* output_path) override {
+    int Finish(int final_ts, int loop_count) override {
         require(impl);
 
+        if (global_palette && !global_color_map) {
+            check(PutGlobalPalette());
+        }
+
+        // The last frame is disposed of entirely, so the loop restarts from an empty canvas.
+        if (has_pending) {
+            check(PutPending(nullptr));
+            has_pending = 0;
+        }
+
         int gif_error = 0;
         if (!EGifCloseFile(impl, &gif_error)) {
             log_gif_error("EGifCloseFile", gif_error);
@@ -350,20 +519,195 @@ public:
         }
         impl = 0;
 
-        require(buffer.GetCount() > 0);
-        check(ImgIoUtilWriteFile(output_path, buffer.GetBytes(), buffer.GetCount()));
-
-        logger::i("File created at %s", output_path);
-
         return 1;
     }
 private:
     GifFileType* impl;
-    ByteArray buffer;
     int duration_ten_ms;
+    InverseColorMap inverse_map;
+    int exact_colors; // pixels get their nearest palette color, not the one of their quantizer box
+    WuHistogramBands histogram_bands; // shared by the quantizers of every frame
+    std::vector<GifPixelType> index_line;
+
+    // minimize_size: write only what changed since the previous frame
+    int delta_frames;
+    int canvas_width;
+    int canvas_height;
+    std::vector<uint32_t> canvas;   // visible pixels below the pending frame
+    std::vector<uint32_t> pending;  // frame waiting for its successor to pick its disposal
+    std::vector<uint32_t> next;
+    cg::Rect pending_rect;
+    int pending_delay_ten_ms;
+    int has_pending;
+
+    // global_palette: one color table, picked from the first n_sample_frames frames
+    struct SampleFrame {
+        std::vector<uint32_t> argb;
+        int delay_ten_ms;
+    };
+    int global_palette;
+    int n_sample_frames;
+    std::unique_ptr<WuQuantizer> sample_quantizer;
+    std::vector<SampleFrame> samples;
+    ColorMapObject* global_color_map;
 };
 
-AnimEncoder* AnimEncoderNew(const char* format, int canvas_width, int canvas_height, const AnimEncoderOptions* options) {
+void AnimEncoderBufferInit(AnimEncoderBuffer* buffer) {
+    buffer->bytes = nullptr;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+void AnimEncoderBufferClear(AnimEncoderBuffer* buffer) {
+    free(buffer->bytes);
+    AnimEncoderBufferInit(buffer);
+}
+
+static int MemorySinkWrite(void* ctx, const uint8_t* bytes, size_t size) {
+    auto buffer = reinterpret_cast<AnimEncoderBuffer*>(ctx);
+    if (buffer->size + size > buffer->capacity) {
+        auto new_cap = std::max(buffer->size + size, buffer->capacity * 2);
+        auto new_buf = reinterpret_cast<uint8_t*>(realloc(buffer->bytes, new_cap));
+        checkf(new_buf, "OOM");
+
+        buffer->bytes = new_buf;
+        buffer->capacity = new_cap;
+    }
+
+    memcpy(buffer->bytes + buffer->size, bytes, size);
+    buffer->size += size;
+
+    return 1;
+}
+
+void AnimEncoderSinkInitMemory(AnimEncoderSink* sink, AnimEncoderBuffer* buffer) {
+    sink->ctx = buffer;
+    sink->write = MemorySinkWrite;
+    sink->close = nullptr;
+    sink->discard = nullptr;
+}
+
+static int FdSinkWrite(void* ctx, const uint8_t* bytes, size_t size) {
+    auto fd = static_cast<int>(reinterpret_cast<intptr_t>(ctx));
+    while (size > 0) {
+#ifdef _WIN32
+        auto n = _write(fd, bytes, static_cast<unsigned>(std::min<size_t>(size, INT_MAX)));
+#else
+        auto n = ::write(fd, bytes, size);
+#endif
+        if (n < 0 && errno == EINTR)
+            continue;
+        checkf(n > 0, "write failed: %s", strerror(errno));
+
+        bytes += n;
+        size -= n;
+    }
+    return 1;
+}
+
+void AnimEncoderSinkInitFd(AnimEncoderSink* sink, int fd) {
+    sink->ctx = reinterpret_cast<void*>(static_cast<intptr_t>(fd));
+    sink->write = FdSinkWrite;
+    sink->close = nullptr;
+    sink->discard = nullptr;
+}
+
+struct FileSink {
+    FILE* file;
+    std::string path;
+    std::string tmp_path; // empty for stdout
+};
+
+static int FileSinkWrite(void* ctx, const uint8_t* bytes, size_t size) {
+    auto file_sink = reinterpret_cast<FileSink*>(ctx);
+    checkf(fwrite(bytes, 1, size, file_sink->file) == size, "Failed to write to %s", file_sink->path.c_str());
+    return 1;
+}
+
+static void FileSinkDiscard(void* ctx) {
+    auto file_sink = reinterpret_cast<FileSink*>(ctx);
+    defer(delete file_sink);
+
+    if (file_sink->tmp_path.empty()) {
+        fflush(stdout);
+        return;
+    }
+
+    fclose(file_sink->file);
+    remove(file_sink->tmp_path.c_str());
+}
+
+static int FileSinkClose(void* ctx) {
+    auto file_sink = reinterpret_cast<FileSink*>(ctx);
+    defer(delete file_sink);
+
+    if (file_sink->tmp_path.empty()) {
+        checkf(fflush(stdout) == 0, "Failed to write to %s", file_sink->path.c_str());
+        return 1;
+    }
+
+    auto tmp_path = file_sink->tmp_path.c_str();
+    auto path = file_sink->path.c_str();
+    if (fclose(file_sink->file) != 0) {
+        remove(tmp_path);
+        notreached("Failed to write to %s", path);
+    }
+
+#ifdef _WIN32
+    // rename does not replace existing files there
+    remove(path);
+#endif
+    if (rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        notreached("Failed to create %s: %s", path, strerror(errno));
+    }
+
+    return 1;
+}
+
+int AnimEncoderSinkOpenFile(AnimEncoderSink* sink, const char* output_path) {
+    require(output_path);
+
+    auto file_sink = new FileSink { .file = nullptr, .path = output_path, .tmp_path = {} };
+    if (!strcmp(output_path, "-")) {
+        file_sink->file = ImgIoUtilSetBinaryMode(stdout);
+    } else {
+        file_sink->tmp_path = TempPathFor(output_path);
+        file_sink->file = fopen(file_sink->tmp_path.c_str(), "wb");
+    }
+    if (!file_sink->file) {
+        delete file_sink;
+        notreached("Cannot open output file %s", output_path);
+    }
+
+    sink->ctx = file_sink;
+    sink->write = FileSinkWrite;
+    sink->close = FileSinkClose;
+    sink->discard = FileSinkDiscard;
+
+    return 1;
+}
+
+int AnimEncoderSinkClose(AnimEncoderSink* sink) {
+    int ok = 1;
+    if (sink->close) {
+        ok = sink->close(sink->ctx);
+    }
+    *sink = AnimEncoderSink {};
+    return ok;
+}
+
+void AnimEncoderSinkDiscard(AnimEncoderSink* sink) {
+    if (sink->discard) {
+        sink->discard(sink->ctx);
+    } else if (sink->close) {
+        sink->close(sink->ctx);
+    }
+    *sink = AnimEncoderSink {};
+}
+
+
+static AnimEncoder* AnimEncoderCreate(const char* format) {
     require(format);
 
     AnimEncoder* encoder = 0;
@@ -378,6 +722,10 @@ AnimEncoder* AnimEncoderNew(const char* format, int canvas_width, int canvas_hei
         notreached("Unknown AnimEncoder format `%s`", format);
     }
 
+    return encoder;
+}
+
+static AnimEncoder* AnimEncoderInit(AnimEncoder* encoder, int canvas_width, int canvas_height, const AnimEncoderOptions* options) {
     if (!encoder->Init(canvas_width, canvas_height, options)) {
         AnimEncoderDelete(encoder);
         return 0;
@@ -386,19 +734,112 @@ AnimEncoder* AnimEncoderNew(const char* format, int canvas_width, int canvas_hei
     return encoder;
 }
 
+AnimEncoder* AnimEncoderNew(const char* format, int canvas_width, int canvas_height, const AnimEncoderOptions* options) {
+    auto encoder = AnimEncoderCreate(format);
+    check(encoder);
+
+    AnimEncoderSinkInitMemory(&encoder->sink, &encoder->buffer);
+
+    return AnimEncoderInit(encoder, canvas_width, canvas_height, options);
+}
+
+AnimEncoder* AnimEncoderNewWithSink(const char* format, int canvas_width, int canvas_height, const AnimEncoderOptions* options,
+                                    const AnimEncoderSink* sink) {
+    require(sink && sink->write);
+
+    auto encoder = AnimEncoderCreate(format);
+    check(encoder);
+
+    encoder->sink = *sink;
+
+    return AnimEncoderInit(encoder, canvas_width, canvas_height, options);
+}
+
+AnimEncoder* AnimEncoderNewWithFile(const char* format, int canvas_width, int canvas_height, const AnimEncoderOptions* options,
+                                    const char* output_path) {
+    auto encoder = AnimEncoderCreate(format);
+    check(encoder);
+
+    if (!AnimEncoderSinkOpenFile(&encoder->sink, output_path)) {
+        AnimEncoderDelete(encoder);
+        return 0;
+    }
+    encoder->owns_sink = 1;
+    encoder->output_path = output_path;
+
+    return AnimEncoderInit(encoder, canvas_width, canvas_height, options);
+}
+
+AnimEncoder* AnimEncoderNewWithBuffer(const char* format, int canvas_width, int canvas_height, const AnimEncoderOptions* options,
+                                      AnimEncoderBuffer* buffer) {
+    require(buffer);
+
+    AnimEncoderSink sink;
+    AnimEncoderSinkInitMemory(&sink, buffer);
+
+    return AnimEncoderNewWithSink(format, canvas_width, canvas_height, options, &sink);
+}
+
+
 
 int AnimEncoderAddFrame(AnimEncoder* encoder, WebPPicture* pic, int start_ts, int end_ts, const AnimFrameOptions* options) {
+    StageScope scope(STAGE_ENCODE);
     return encoder->AddFrame(pic, start_ts, end_ts, options);
 }
 
+int AnimEncoderFinish(AnimEncoder* encoder, int final_ts, int loop_count) {
+    StageScope scope(STAGE_ENCODE);
+    check(encoder->Finish(final_ts, loop_count));
+
+    if (encoder->owns_sink) {
+        StageScope write_scope(STAGE_WRITE); // flushes
+        encoder->owns_sink = 0;
+        check(AnimEncoderSinkClose(&encoder->sink));
+        logger::i("File created at %s", encoder->output_path.c_str());
+    }
+
+    return 1;
+}
+
 int AnimEncoderExport(AnimEncoder* encoder, int final_ts, int loop_count, const char* output_path) {
-    return encoder->Export(final_ts, loop_count, output_path);
+    require(encoder->sink.ctx == &encoder->buffer);
+    TraceScope trace("export");
+
+    // GIF frames have been encoded into the buffer already, the rest goes straight to the file
+    AnimEncoderSink file_sink;
+    check(AnimEncoderSinkOpenFile(&file_sink, output_path));
+    encoder->sink = file_sink;
+    encoder->owns_sink = 1;
+    encoder->output_path = output_path;
+
+    // only what reaches the file counts as written
+    encoder->bytes_written = 0;
+    check(encoder->Write(encoder->buffer.bytes, encoder->buffer.size));
+    AnimEncoderBufferClear(&encoder->buffer);
+
+    return AnimEncoderFinish(encoder, final_ts, loop_count);
+}
+
+size_t AnimEncoderGetBytesWritten(const AnimEncoder* encoder) {
+    return encoder->bytes_written;
 }
 
 const char* AnimEncoderGetFileExt(const AnimEncoder* encoder) {
     return encoder->GetFileExt();
 }
 
+const char* AnimEncoderFormatGetFileExt(const char* format) {
+    require(format);
+
+    if (!strcasecmp(format, "webp") || strlen(format) == 0) {
+        return ".webp";
+    } else if (!strcasecmp(format, "gif")) {
+        return ".gif";
+    } else {
+        notreached("Unknown AnimEncoder format `%s`", format);
+    }
+}
+
 void AnimEncoderDelete(AnimEncoder* encoder) {
    delete encoder;
 }
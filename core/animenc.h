@@ -5,6 +5,7 @@
 #ifndef MERCURY_ANIMENC_H
 #define MERCURY_ANIMENC_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 struct AnimEncoder;
@@ -12,6 +13,8 @@ struct AnimEncoder;
 struct AnimEncoderOptions {
     int verbose;
     int minimize_size;
+    int global_palette; // GIF: one color table shared by all frames
+    int gif_box_colors; // GIF: pixels get the color of their quantizer box, faster than their nearest color
     uint32_t bgcolor;
 };
 
@@ -25,11 +28,57 @@ struct AnimFrameOptions {
 
 typedef struct WebPPicture WebPPicture;
 
+// Where encoded bytes go. GIF bytes are written as frames are added, WebP bytes once assembled.
+// `write` returns 1 on success. `close`, if any, is called once by AnimEncoderSinkClose when the output
+// is complete. `discard`, if any, is called instead by AnimEncoderSinkDiscard when it is abandoned.
+struct AnimEncoderSink {
+    void* ctx;
+    int (*write)(void* ctx, const uint8_t* bytes, size_t size);
+    int (*close)(void* ctx);
+    void (*discard)(void* ctx);
+};
+
+// Growable output of AnimEncoderSinkInitMemory, `bytes` is owned until AnimEncoderBufferClear.
+struct AnimEncoderBuffer {
+    uint8_t* bytes;
+    size_t size;
+    size_t capacity;
+};
+
+void AnimEncoderBufferInit(AnimEncoderBuffer* buffer);
+void AnimEncoderBufferClear(AnimEncoderBuffer* buffer);
+
+// "-" writes to stdout. Files are written to a temporary file renamed to output_path once closed, so
+// output_path is left untouched by a discarded output and may be the file being read.
+int AnimEncoderSinkOpenFile(AnimEncoderSink* sink, const char* output_path);
+// the caller keeps the ownership of fd
+void AnimEncoderSinkInitFd(AnimEncoderSink* sink, int fd);
+void AnimEncoderSinkInitMemory(AnimEncoderSink* sink, AnimEncoderBuffer* buffer);
+int AnimEncoderSinkClose(AnimEncoderSink* sink);
+void AnimEncoderSinkDiscard(AnimEncoderSink* sink);
+
 
+// Encodes into memory until AnimEncoderExport writes the file.
 AnimEncoder* AnimEncoderNew(const char* format, int canvas_width, int canvas_height, const AnimEncoderOptions* options);
+// Streams into `sink`, which must stay valid until AnimEncoderFinish and is not closed by the encoder.
+AnimEncoder* AnimEncoderNewWithSink(const char* format, int canvas_width, int canvas_height, const AnimEncoderOptions* options,
+                                    const AnimEncoderSink* sink);
+// Streams into output_path, which is replaced by AnimEncoderFinish and left untouched otherwise.
+AnimEncoder* AnimEncoderNewWithFile(const char* format, int canvas_width, int canvas_height, const AnimEncoderOptions* options,
+                                    const char* output_path);
+// Streams into `buffer`, which is owned by the caller.
+AnimEncoder* AnimEncoderNewWithBuffer(const char* format, int canvas_width, int canvas_height, const AnimEncoderOptions* options,
+                                      AnimEncoderBuffer* buffer);
 int AnimEncoderAddFrame(AnimEncoder* encoder, WebPPicture* pic, int start_ts, int end_ts, const AnimFrameOptions* options);
+// For encoders made by AnimEncoderNewWith*: writes what is left.
+int AnimEncoderFinish(AnimEncoder* encoder, int final_ts, int loop_count);
+// For encoders made by AnimEncoderNew.
 int AnimEncoderExport(AnimEncoder* encoder, int final_ts, int loop_count, const char* output_path);
 const char* AnimEncoderGetFileExt(const AnimEncoder* encoder);
+// The extension of the files the encoders of `format` make, e.g. ".gif", before any is made.
+const char* AnimEncoderFormatGetFileExt(const char* format);
+// Bytes written to the sink so far, or to the file for encoders exported by AnimEncoderExport.
+size_t AnimEncoderGetBytesWritten(const AnimEncoder* encoder);
 
 void AnimEncoderDelete(AnimEncoder* encoder);
 
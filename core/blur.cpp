@@ -21,9 +21,11 @@ struct Context {
     int total_duration_so_far;
 
     const char* output;
+    AnimEncoderBuffer* output_buffer; // instead of output
     const char* format;
     // global: WebPAnimEncoderOptions
     int minimize_size;
+    int global_palette;
     int verbose;
 
     // per-frame: WebPConfig
@@ -31,6 +33,8 @@ struct Context {
     float quality;
     int method;
     int pass;
+
+    std::vector<uint8_t> blur_scratch; // reused by every frame
 };
 
 
@@ -41,9 +45,12 @@ static int OnStart(void* ctx, const AnimInfo* info, int* stop) {
     AnimEncoderOptions encoder_options {
             .verbose = thiz->verbose,
             .minimize_size = thiz->minimize_size,
+            .global_palette = thiz->global_palette,
             .bgcolor = info->bgcolor
     };
-    auto encoder = AnimEncoderNew(thiz->format, info->canvas_width, info->canvas_height, &encoder_options);
+    auto encoder = thiz->output_buffer ?
+            AnimEncoderNewWithBuffer(thiz->format, info->canvas_width, info->canvas_height, &encoder_options, thiz->output_buffer) :
+            AnimEncoderNewWithFile(thiz->format, info->canvas_width, info->canvas_height, &encoder_options, thiz->output);
     check(encoder);
     thiz->encoder = encoder;
     return 1;
@@ -56,7 +63,7 @@ static int BlurOneFrame(Context* thiz, const AnimFrame* frame, int start_ts, int
 
     check(AnimFrameExportToPic(frame, &decoded_frame));
 
-    check(PicBlur(&decoded_frame, thiz->blur_radius));
+    check(PicBlur(&decoded_frame, thiz->blur_radius, 0, &thiz->blur_scratch));
 
     AnimFrameOptions frame_options {
             .lossless = thiz->lossless,
@@ -97,9 +104,11 @@ static int OnFrame(void* ctx, const AnimFrame* frame, int start_ts, int end_ts,
 
 static int OnEnd(void* ctx, const AnimInfo* anim_info) {
     auto thiz = reinterpret_cast<Context*>(ctx);
-    defer(AnimEncoderDelete(thiz->encoder));
+    auto encoder = thiz->encoder;
+    thiz->encoder = nullptr;
+    defer(AnimEncoderDelete(encoder));
 
-    check(AnimEncoderExport(thiz->encoder, thiz->total_duration_so_far, anim_info->loop_count, thiz->output));
+    check(AnimEncoderFinish(encoder, thiz->total_duration_so_far, anim_info->loop_count));
 
     return 1;
 }
@@ -114,14 +123,19 @@ static AnimDecRunCallback kRunCallback {
 
 
 
-int AnimToolBlur(
+// Decodes image_data when it is given, image_path otherwise, and encodes into output_buffer
+// when it is given, into the output file otherwise.
+static int Blur(
         const char* image_path,
+        const WebPData* image_data,
         int index_of_frame,
         int blur_radius,
         const char* output,
+        AnimEncoderBuffer* output_buffer,
         const char* format,
         // global: WebPAnimEncoderOptions
         int minimize_size,
+        int global_palette,
         int verbose,
 
         // per-frame: WebPConfig
@@ -134,16 +148,75 @@ int AnimToolBlur(
         .index_of_frame = index_of_frame,
         .blur_radius = blur_radius,
         .output = output,
+        .output_buffer = output_buffer,
         .format = format,
         .minimize_size = minimize_size,
+        .global_palette = global_palette,
         .verbose = verbose,
         .lossless = lossless,
         .quality = quality,
         .method = method,
         .pass = pass,
     };
-
-    check(DecRun(image_path, &ctx, kRunCallback));
+    // a run stopped before its end leaves its encoder, and the output is discarded with it
+    defer(if (ctx.encoder) AnimEncoderDelete(ctx.encoder); );
+
+    if (index_of_frame >= 0) {
+        // the run seeks to the frame, the only one it passes on
+        ctx.frame_count = index_of_frame;
+        if (image_data) {
+            check(DecRunFrameWithData(image_data, index_of_frame, &ctx, kRunCallback));
+        } else {
+            check(DecRunFrame(image_path, index_of_frame, &ctx, kRunCallback));
+        }
+    } else if (image_data) {
+        check(DecRunWithData(image_data, &ctx, kRunCallback));
+    } else {
+        check(DecRun(image_path, &ctx, kRunCallback));
+    }
 
     return 1;
 }
+
+int AnimToolBlur(
+        const char* image_path,
+        int index_of_frame,
+        int blur_radius,
+        const char* output,
+        const char* format,
+        // global: WebPAnimEncoderOptions
+        int minimize_size,
+        int global_palette,
+        int verbose,
+
+        // per-frame: WebPConfig
+        int lossless,
+        float quality,
+        int method,
+        int pass
+) {
+    return Blur(image_path, nullptr, index_of_frame, blur_radius, output, nullptr, format,
+                minimize_size, global_palette, verbose, lossless, quality, method, pass);
+}
+
+int AnimToolBlurWithData(
+        const WebPData* image_data,
+        int index_of_frame,
+        int blur_radius,
+        AnimEncoderBuffer* output,
+        const char* format,
+        // global: WebPAnimEncoderOptions
+        int minimize_size,
+        int global_palette,
+        int verbose,
+
+        // per-frame: WebPConfig
+        int lossless,
+        float quality,
+        int method,
+        int pass
+) {
+    require(image_data && output);
+    return Blur(nullptr, image_data, index_of_frame, blur_radius, nullptr, output, format,
+                minimize_size, global_palette, verbose, lossless, quality, method, pass);
+}
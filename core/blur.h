@@ -9,6 +9,9 @@
 extern "C" {
 #endif
 
+typedef struct WebPData WebPData;
+typedef struct AnimEncoderBuffer AnimEncoderBuffer;
+
 int AnimToolBlur(
     const char* image_path,
     int index_of_frame,
@@ -17,6 +20,26 @@ int AnimToolBlur(
     const char* format,
         // global: WebPAnimEncoderOptions
     int minimize_size,
+    int global_palette,
+    int verbose,
+
+        // per-frame: WebPConfig
+    int lossless,
+    float quality,
+    int method,
+    int pass
+);
+
+// Same as above, with the image in memory. The output is appended to `output`.
+int AnimToolBlurWithData(
+    const WebPData* image_data,
+    int index_of_frame,
+    int blur_radius,
+    AnimEncoderBuffer* output,
+    const char* format,
+        // global: WebPAnimEncoderOptions
+    int minimize_size,
+    int global_palette,
     int verbose,
 
         // per-frame: WebPConfig
@@ -3,291 +3,265 @@
 //
 
 #include "blurutils.h"
-#include <stdlib.h>
+
+#include "check.h"
+#include "utils/parallel.h"
+
 #include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <vector>
 
-using namespace std;
-void superFastBlur(unsigned char *pix, int w, int h, int radius)
-{
-    int div;
-    int wm, hm, wh;
-    int *vMIN, *vMAX;
-    unsigned char *r, *g, *b, *dv;
-    int rsum, gsum, bsum, x, y, i, p, p1, p2, yp, yi, yw;
-
-    if (radius < 1) return;
-
-    wm = w - 1;
-    hm = h - 1;
-    wh = w * h;
-    div = radius + radius + 1;
-    vMIN = (int *)malloc(sizeof(int) * max(w, h));
-    vMAX = (int *)malloc(sizeof(int) * max(w, h));
-    r = (unsigned char *)malloc(sizeof(unsigned char) * wh);
-    g = (unsigned char *)malloc(sizeof(unsigned char) * wh);
-    b = (unsigned char *)malloc(sizeof(unsigned char) * wh);
-    dv = (unsigned char *)malloc(sizeof(unsigned char) * 256 * div);
-
-    for (i = 0; i < 256 * div; i++)
-        dv[i] = (i / div);
-
-    yw = yi = 0;
-
-    for (y = 0; y < h; y++)
-    {
-        rsum = gsum = bsum = 0;
-        for (i = -radius; i <= radius; i++)
-        {
-            p = (yi + min(wm, max(i, 0))) * 3;
-            bsum += pix[p];
-            gsum += pix[p + 1];
-            rsum += pix[p + 2];
-        }
-        for (x = 0; x < w; x++)
-        {
-            r[yi] = dv[rsum];
-            g[yi] = dv[gsum];
-            b[yi] = dv[bsum];
-
-            if (y == 0)
-            {
-                vMIN[x] = min(x + radius + 1, wm);
-                vMAX[x] = max(x - radius, 0);
-            }
-            p1 = (yw + vMIN[x]) * 3;
-            p2 = (yw + vMAX[x]) * 3;
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-            bsum += pix[p1] - pix[p2];
-            gsum += pix[p1 + 1] - pix[p2 + 1];
-            rsum += pix[p1 + 2] - pix[p2 + 2];
+#define BLUR_N_BOXES 3
+// Fewer rows per band are not worth a thread.
+#define BLUR_MIN_BAND_ROWS 32
+// Transposes go by square tiles of this many pixels, so both sides stay in cache.
+#define BLUR_TILE_SIZE 32
 
-            yi++;
-        }
-        yw += w;
+// Radii of the boxes whose succession has a variance closest to sigma^2:
+// the widths are the two odd numbers around the ideal one, mixed.
+static void BoxRadiiForGauss(float sigma, int radii[BLUR_N_BOXES]) {
+    const int n = BLUR_N_BOXES;
+    const double variance = static_cast<double>(sigma) * sigma;
+
+    auto w_ideal = std::sqrt(12 * variance / n + 1);
+    auto wl = static_cast<int>(std::floor(w_ideal));
+    if (wl % 2 == 0) {
+        --wl;
     }
+    auto wu = wl + 2;
 
-    for (x = 0; x < w; x++)
-    {
-        rsum = gsum = bsum = 0;
-        yp = -radius * w;
-        for (i = -radius; i <= radius; i++)
-        {
-            yi = max(0, yp) + x;
-            rsum += r[yi];
-            gsum += g[yi];
-            bsum += b[yi];
-            yp += w;
-        }
-        yi = x;
-        for (y = 0; y < h; y++)
-        {
-            pix[yi * 3] = dv[bsum];
-            pix[yi * 3 + 1] = dv[gsum];
-            pix[yi * 3 + 2] = dv[rsum];
-
-            if (x == 0)
-            {
-                vMIN[y] = min(y + radius + 1, hm) * w;
-                vMAX[y] = max(y - radius, 0) * w;
-            }
-            p1 = x + vMIN[y];
-            p2 = x + vMAX[y];
+    auto m_ideal = (12 * variance - n * wl * wl - 4 * n * wl - 3 * n) / (-4 * wl - 4);
+    auto m = static_cast<int>(std::lround(m_ideal));
 
-            rsum += r[p1] - r[p2];
-            gsum += g[p1] - g[p2];
-            bsum += b[p1] - b[p2];
+    for (int i=0; i<n; ++i) {
+        radii[i] = ((i < m ? wl : wu) - 1) / 2;
+    }
+}
 
-            yi += w;
+// Sum of the 2 * radius + 1 pixels around pixel 0 of a row, edges repeated. O(min(radius, width)).
+template <int C>
+static void BoxInitSum(const uint8_t* src, int width, int radius, int acc[C]) {
+    const int last = width - 1;
+    const int n_inside = std::min(radius, last);
+    for (int c=0; c<C; ++c) {
+        acc[c] = (radius + 1) * src[c] + (radius - n_inside) * src[last * C + c];
+    }
+    for (int i=1; i<=n_inside; ++i) {
+        for (int c=0; c<C; ++c) {
+            acc[c] += src[i * C + c];
         }
     }
+}
 
-    free(r);
-    free(g);
-    free(b);
+// Writes C bytes, keeping the bits of `keep_mask` of the 4 byte pixel already at dst.
+template <int C>
+static inline void StorePixel(uint8_t* dst, uint32_t value, uint32_t keep_mask) {
+    if (C == 4 && keep_mask) {
+        uint32_t old;
+        memcpy(&old, dst, 4);
+        value = (old & keep_mask) | (value & ~keep_mask);
+    }
+    memcpy(dst, &value, C);
+}
 
-    free(vMIN);
-    free(vMAX);
-    free(dv);
+#if defined(__SSE2__)
+template <int C>
+static inline __m128i LoadPixel(const uint8_t* p) {
+    uint32_t v = 0;
+    memcpy(&v, p, C);
+    auto zero = _mm_setzero_si128();
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(v)), zero), zero);
 }
 
-void GaussianBlur(unsigned char* img,  int width, int height, int channels, int radius)
-{
-    radius = min(max(1, radius), 248);
-    unsigned int kernelSize = 1 + radius * 2;
-    unsigned int* kernel = (unsigned int*)malloc(kernelSize* sizeof(unsigned int));
-    memset(kernel, 0, kernelSize* sizeof(unsigned int));
-    int(*mult)[256] = (int(*)[256])malloc(kernelSize * 256 * sizeof(int));
-    memset(mult, 0, kernelSize * 256 * sizeof(int));
-
-    int	xStart = 0;
-    int	yStart = 0;
-    width = xStart + width - max(0, (xStart + width) - width);
-    height = yStart + height - max(0, (yStart + height) - height);
-    int imageSize = width*height;
-    int widthstep = width*channels;
-    if (channels == 3 || channels == 4)
-    {
-        unsigned char *    CacheImg = nullptr;
-        CacheImg = (unsigned char *)malloc(sizeof(unsigned char) * imageSize * 6);
-        if (CacheImg == nullptr) return;
-        unsigned char *    rCache = CacheImg;
-        unsigned char *    gCache = CacheImg + imageSize;
-        unsigned char *    bCache = CacheImg + imageSize * 2;
-        unsigned char *    r2Cache = CacheImg + imageSize * 3;
-        unsigned char *    g2Cache = CacheImg + imageSize * 4;
-        unsigned char *    b2Cache = CacheImg + imageSize * 5;
-        int sum = 0;
-        for (int K = 1; K < radius; K++){
-            unsigned int szi = radius - K;
-            kernel[radius + K] = kernel[szi] = szi*szi;
-            sum += kernel[szi] + kernel[szi];
-            for (int j = 0; j < 256; j++){
-                mult[radius + K][j] = mult[szi][j] = kernel[szi] * j;
-            }
-        }
-        kernel[radius] = radius*radius;
-        sum += kernel[radius];
-        for (int j = 0; j < 256; j++){
-            mult[radius][j] = kernel[radius] * j;
-        }
-        for (int Y = 0; Y < height; ++Y) {
-            unsigned char*     LinePS = img + Y*widthstep;
-            unsigned char*     LinePR = rCache + Y*width;
-            unsigned char*     LinePG = gCache + Y*width;
-            unsigned char*     LinePB = bCache + Y*width;
-            for (int X = 0; X < width; ++X) {
-                int     p2 = X*channels;
-                LinePR[X] = LinePS[p2];
-                LinePG[X] = LinePS[p2 + 1];
-                LinePB[X] = LinePS[p2 + 2];
-            }
-        }
-        int kernelsum = 0;
-        for (int K = 0; K < kernelSize; K++){
-            kernelsum += kernel[K];
-        }
-        float fkernelsum = 1.0f / kernelsum;
-        for (int Y = yStart; Y < height; Y++){
-            int heightStep = Y * width;
-            unsigned char*     LinePR = rCache + heightStep;
-            unsigned char*     LinePG = gCache + heightStep;
-            unsigned char*     LinePB = bCache + heightStep;
-            for (int X = xStart; X < width; X++){
-                int cb = 0;
-                int cg = 0;
-                int cr = 0;
-                for (int K = 0; K < kernelSize; K++){
-                    unsigned    int     readPos = ((X - radius + K + width) % width);
-                    int * pmult = mult[K];
-                    cr += pmult[LinePR[readPos]];
-                    cg += pmult[LinePG[readPos]];
-                    cb += pmult[LinePB[readPos]];
-                }
-                unsigned int p = heightStep + X;
-                r2Cache[p] = cr* fkernelsum;
-                g2Cache[p] = cg* fkernelsum;
-                b2Cache[p] = cb* fkernelsum;
-            }
-        }
-        for (int X = xStart; X < width; X++){
-            int WidthComp = X*channels;
-            int WidthStep = width*channels;
-            unsigned char*     LinePS = img + X*channels;
-            unsigned char*     LinePR = r2Cache + X;
-            unsigned char*     LinePG = g2Cache + X;
-            unsigned char*     LinePB = b2Cache + X;
-            for (int Y = yStart; Y < height; Y++){
-                int cb = 0;
-                int cg = 0;
-                int cr = 0;
-                for (int K = 0; K < kernelSize; K++){
-                    unsigned int   readPos = ((Y - radius + K + height) % height) * width;
-                    int * pmult = mult[K];
-                    cr += pmult[LinePR[readPos]];
-                    cg += pmult[LinePG[readPos]];
-                    cb += pmult[LinePB[readPos]];
-                }
-                int    p = Y*WidthStep;
-                LinePS[p] = (unsigned char)(cr * fkernelsum);
-                LinePS[p + 1] = (unsigned char)(cg * fkernelsum);
-                LinePS[p + 2] = (unsigned char)(cb* fkernelsum);
+// One pixel per step, its channels in the lanes. Same float math as the scalar version.
+template <int C>
+static void BoxRowSSE2(const uint8_t* src, uint8_t* dst, int width, int radius, uint32_t keep_mask) {
+    const int last = width - 1;
+    const auto scale = _mm_set1_ps(1.0f / (2 * radius + 1));
+    const auto half = _mm_set1_ps(0.5f);
 
+    int init[4] = {};
+    BoxInitSum<C>(src, width, radius, init);
+    auto acc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(init));
 
-            }
-        }
-        free(CacheImg);
+    for (int x=0; x<width; ++x) {
+        auto v = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(acc), scale), half));
+        v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+        StorePixel<C>(dst + x * C, static_cast<uint32_t>(_mm_cvtsi128_si32(v)), keep_mask);
+
+        auto in_pixel = LoadPixel<C>(src + std::min(x + radius + 1, last) * C);
+        auto out_pixel = LoadPixel<C>(src + std::max(x - radius, 0) * C);
+        acc = _mm_add_epi32(acc, _mm_sub_epi32(in_pixel, out_pixel));
     }
-    else if (channels == 1)
-    {
-        unsigned char *    CacheImg = nullptr;
-        CacheImg = (unsigned char *)malloc(sizeof(unsigned char) * imageSize * 2);
-        if (CacheImg == nullptr) return;
-        unsigned char *    rCache = CacheImg;
-        unsigned char *    r2Cache = CacheImg + imageSize;
-
-        int sum = 0;
-        for (int K = 1; K < radius; K++){
-            unsigned int szi = radius - K;
-            kernel[radius + K] = kernel[szi] = szi*szi;
-            sum += kernel[szi] + kernel[szi];
-            for (int j = 0; j < 256; j++){
-                mult[radius + K][j] = mult[szi][j] = kernel[szi] * j;
-            }
-        }
-        kernel[radius] = radius*radius;
-        sum += kernel[radius];
-        for (int j = 0; j < 256; j++){
-            mult[radius][j] = kernel[radius] * j;
+}
+#endif
+
+// A box blur of one row of packed pixels, from src to dst, in O(width).
+template <int C>
+static void BoxRow(const uint8_t* src, uint8_t* dst, int width, int radius, uint32_t keep_mask) {
+#if defined(__SSE2__)
+    if constexpr (C >= 3) {
+        BoxRowSSE2<C>(src, dst, width, radius, keep_mask);
+        return;
+    }
+#endif
+
+    const int last = width - 1;
+    const float scale = 1.0f / (2 * radius + 1);
+
+    int acc[C];
+    BoxInitSum<C>(src, width, radius, acc);
+
+    for (int x=0; x<width; ++x) {
+        uint8_t pixel[4] = {};
+        for (int c=0; c<C; ++c) {
+            pixel[c] = static_cast<uint8_t>(acc[c] * scale + 0.5f);
         }
-        for (int Y = 0; Y < height; ++Y) {
-            unsigned char*     LinePS = img + Y*widthstep;
-            unsigned char*     LinePR = rCache + Y*width;
-            for (int X = 0; X < width; ++X) {
-                LinePR[X] = LinePS[X];
-            }
+        uint32_t value;
+        memcpy(&value, pixel, 4);
+        StorePixel<C>(dst + x * C, value, keep_mask);
+
+        auto in_pixel = src + std::min(x + radius + 1, last) * C;
+        auto out_pixel = src + std::max(x - radius, 0) * C;
+        for (int c=0; c<C; ++c) {
+            acc[c] += in_pixel[c] - out_pixel[c];
         }
-        int kernelsum = 0;
-        for (int K = 0; K < kernelSize; K++){
-            kernelsum += kernel[K];
+    }
+}
+
+// Runs the box passes over a row in place, ping-ponging between two row buffers.
+// Only the last pass writes the row, which is where the bits of keep_mask are kept.
+template <int C>
+static void BlurRow(uint8_t* row, int width, const int radii[BLUR_N_BOXES], int n_passes, uint32_t keep_mask,
+                    uint8_t* buf0, uint8_t* buf1) {
+    memcpy(buf0, row, static_cast<size_t>(width) * C);
+
+    uint8_t* src = buf0;
+    uint8_t* spare = buf1;
+    int n_done = 0;
+    for (int i=0; i<BLUR_N_BOXES; ++i) {
+        if (!radii[i]) {
+            continue;
         }
-        float fkernelsum = 1.0f / kernelsum;
-        for (int Y = yStart; Y < height; Y++){
-            int heightStep = Y * width;
-            unsigned char*     LinePR = rCache + heightStep;
-            for (int X = xStart; X < width; X++){
-                int cb = 0;
-                int cg = 0;
-                int cr = 0;
-                for (int K = 0; K < kernelSize; K++){
-                    unsigned    int     readPos = ( (X - radius + K+width)%width);
-                    int * pmult = mult[K];
-                    cr += pmult[LinePR[readPos]];
-                }
-                unsigned int p = heightStep + X;
-                r2Cache[p] = cr * fkernelsum;
-            }
+
+        auto last_pass = ++n_done == n_passes;
+        auto dst = last_pass ? row : spare;
+        BoxRow<C>(src, dst, width, radii[i], last_pass ? keep_mask : 0);
+        spare = src;
+        src = dst;
+    }
+}
+
+// Each band gets two rows of `row_bufs`, which has room for ParallelGetThreadCount() bands.
+template <int C>
+static int BlurRows(uint8_t* pixels, int width, int height, size_t stride, const int radii[BLUR_N_BOXES], int n_passes,
+                    uint32_t keep_mask, uint8_t* row_bufs) {
+    const size_t row_size = static_cast<size_t>(width) * C;
+    return ParallelForBands(ParallelGetSharedPool(), ParallelBandCount(height, BLUR_MIN_BAND_ROWS), height, [&](int band, int start, int end) {
+        auto buf0 = row_bufs + row_size * 2 * band;
+        for (int y=start; y<end; ++y) {
+            BlurRow<C>(pixels + stride * y, width, radii, n_passes, keep_mask, buf0, buf0 + row_size);
         }
-        for (int X = xStart; X < width; X++){
-            int WidthComp = X*channels;
-            int WidthStep = width*channels;
-            unsigned char*     LinePS = img + X*channels;
-            unsigned char*     LinePR = r2Cache + X;
-            for (int Y = yStart; Y < height; Y++){
-                int cb = 0;
-                int cg = 0;
-                int cr = 0;
-                for (int K = 0; K < kernelSize; K++){
-                    unsigned int   readPos = ((Y - radius + K+height)%height) * width;
-                    int * pmult = mult[K];
-                    cr += pmult[LinePR[readPos]];
+        return 1;
+    });
+}
+
+// Row x of dst, for x in [x_start, x_end), gets column x of src, which has `height` rows.
+template <int C>
+static void Transpose(const uint8_t* src, size_t src_stride, uint8_t* dst, size_t dst_stride, int x_start, int x_end, int height) {
+    for (int tile_x=x_start; tile_x<x_end; tile_x+=BLUR_TILE_SIZE) {
+        auto tile_x_end = std::min(tile_x + BLUR_TILE_SIZE, x_end);
+        for (int tile_y=0; tile_y<height; tile_y+=BLUR_TILE_SIZE) {
+            auto tile_y_end = std::min(tile_y + BLUR_TILE_SIZE, height);
+            for (int x=tile_x; x<tile_x_end; ++x) {
+                auto dst_line = dst + dst_stride * x;
+                for (int y=tile_y; y<tile_y_end; ++y) {
+                    memcpy(dst_line + y * C, src + src_stride * y + x * C, C);
                 }
-                int    p = Y*WidthStep;
-                LinePS[p] = (unsigned char)(cr* fkernelsum);
             }
         }
-        free(CacheImg);
     }
-    free(kernel);
-    free(mult);
-}
\ No newline at end of file
+}
+
+// The scratch holds the transposed image, then the row buffers of the bands.
+template <int C>
+static int BoxGaussianBlurT(uint8_t* pixels, int width, int height, size_t stride, const int radii[BLUR_N_BOXES], int n_passes,
+                            uint32_t keep_mask, std::vector<uint8_t>* scratch) {
+    const size_t image_size = static_cast<size_t>(width) * height * C;
+    const size_t row_bufs_size = static_cast<size_t>(std::max(width, height)) * C * 2 * ParallelGetThreadCount();
+
+    std::vector<uint8_t> local_scratch;
+    if (!scratch) {
+        scratch = &local_scratch;
+    }
+    if (scratch->size() < image_size + row_bufs_size) {
+        scratch->resize(image_size + row_bufs_size);
+    }
+    auto t = scratch->data();
+    auto row_bufs = t + image_size;
+
+    check(BlurRows<C>(pixels, width, height, stride, radii, n_passes, keep_mask, row_bufs));
+
+    // columns are blurred as the rows of a transposed copy, so every pass reads memory in order
+    const size_t t_stride = static_cast<size_t>(height) * C;
+
+    check(ParallelForBands(ParallelGetSharedPool(), ParallelBandCount(width, BLUR_MIN_BAND_ROWS), width, [&](int band, int start, int end) {
+        Transpose<C>(pixels, stride, t, t_stride, start, end, height);
+        return 1;
+    }));
+
+    check(BlurRows<C>(t, height, width, t_stride, radii, n_passes, keep_mask, row_bufs));
+
+    check(ParallelForBands(ParallelGetSharedPool(), ParallelBandCount(height, BLUR_MIN_BAND_ROWS), height, [&](int band, int start, int end) {
+        Transpose<C>(t, t_stride, pixels, stride, start, end, width);
+        return 1;
+    }));
+
+    return 1;
+}
+
+static int BoxGaussianBlurWithMask(uint8_t* pixels, int width, int height, int stride, int channels, float sigma,
+                                   uint32_t keep_mask, std::vector<uint8_t>* scratch) {
+    require(pixels && stride >= width * channels);
+    if (width <= 0 || height <= 0) {
+        return 1;
+    }
+
+    int radii[BLUR_N_BOXES];
+    BoxRadiiForGauss(sigma, radii);
+    int n_passes = 0;
+    for (auto radius : radii) {
+        n_passes += radius > 0;
+    }
+    if (!n_passes) {
+        return 1;
+    }
+
+    switch (channels) {
+        case 1:
+            return BoxGaussianBlurT<1>(pixels, width, height, stride, radii, n_passes, 0, scratch);
+        case 3:
+            return BoxGaussianBlurT<3>(pixels, width, height, stride, radii, n_passes, 0, scratch);
+        case 4:
+            return BoxGaussianBlurT<4>(pixels, width, height, stride, radii, n_passes, keep_mask, scratch);
+        default:
+            notreached("Unsupported number of channels %d", channels);
+    }
+}
+
+int BoxGaussianBlur(uint8_t* pixels, int width, int height, int stride, int channels, float sigma,
+                    std::vector<uint8_t>* scratch) {
+    return BoxGaussianBlurWithMask(pixels, width, height, stride, channels, sigma, 0, scratch);
+}
+
+int BoxGaussianBlurARGB(uint32_t* argb, int width, int height, int argb_stride, int blur_alpha, float sigma,
+                        std::vector<uint8_t>* scratch) {
+    // pixels are loaded and stored as native uint32_t, so the mask works whatever the byte order
+    return BoxGaussianBlurWithMask(reinterpret_cast<uint8_t*>(argb), width, height, argb_stride * 4, 4, sigma,
+                                   blur_alpha ? 0 : 0xFF000000u, scratch);
+}
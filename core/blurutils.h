@@ -5,7 +5,20 @@
 #ifndef ANIMTOOL_BLURUTILS_H
 #define ANIMTOOL_BLURUTILS_H
 
-void superFastBlur(unsigned char *pix, int w, int h, int radius);
-void GaussianBlur(unsigned char* img,  int width, int height, int channels, int radius);
+#include <stdint.h>
+
+#include <vector>
+
+// Approximates a Gaussian blur of standard deviation `sigma` with three box blurs, so each pixel
+// costs the same whatever the sigma. Pixels past the edges repeat the edge pixel.
+// `pixels` has `channels` (1, 3 or 4) interleaved bytes per pixel and rows `stride` bytes apart.
+// Rows, then columns through a transposed copy, are split into bands over threads.
+// All the memory it needs comes from `scratch` when given, grown as needed and kept for the next call.
+int BoxGaussianBlur(uint8_t* pixels, int width, int height, int stride, int channels, float sigma,
+                    std::vector<uint8_t>* scratch);
+
+// Same, in place on ARGB pixels rows `argb_stride` pixels apart. Alpha is left as is unless `blur_alpha`.
+int BoxGaussianBlurARGB(uint32_t* argb, int width, int height, int argb_stride, int blur_alpha, float sigma,
+                        std::vector<uint8_t>* scratch);
 
 #endif //ANIMTOOL_BLURUTILS_H
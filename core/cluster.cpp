@@ -85,8 +85,10 @@ static AnimDecRunCallback kRunCallback {
 };
 
 
-int AnimToolCluster(
+// Decodes image_data when it is given, image_path otherwise.
+static int Cluster(
         const char* image_path,
+        const WebPData* image_data,
         int index_of_frame,
         int x, int y, int width, int height,
         int k,
@@ -108,7 +110,42 @@ int AnimToolCluster(
 
     defer(delete ctx.points);
 
-    check(DecRun(image_path, &ctx, kRunCallback));
+    if (index_of_frame >= 0) {
+        // the run seeks to the frame, the only one it passes on
+        ctx.frame_count = index_of_frame;
+        if (image_data) {
+            check(DecRunFrameWithData(image_data, index_of_frame, &ctx, kRunCallback));
+        } else {
+            check(DecRunFrame(image_path, index_of_frame, &ctx, kRunCallback));
+        }
+    } else if (image_data) {
+        check(DecRunWithData(image_data, &ctx, kRunCallback));
+    } else {
+        check(DecRun(image_path, &ctx, kRunCallback));
+    }
 
     return 1;
+}
+
+int AnimToolCluster(
+        const char* image_path,
+        int index_of_frame,
+        int x, int y, int width, int height,
+        int k,
+        uint32_t* argbs,
+        uint32_t* counts
+) {
+    return Cluster(image_path, nullptr, index_of_frame, x, y, width, height, k, argbs, counts);
+}
+
+int AnimToolClusterWithData(
+        const WebPData* image_data,
+        int index_of_frame,
+        int x, int y, int width, int height,
+        int k,
+        uint32_t* argbs,
+        uint32_t* counts
+) {
+    require(image_data);
+    return Cluster(nullptr, image_data, index_of_frame, x, y, width, height, k, argbs, counts);
 }
\ No newline at end of file
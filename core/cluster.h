@@ -11,6 +11,8 @@
 extern "C" {
 #endif
 
+typedef struct WebPData WebPData;
+
 int AnimToolCluster(
         const char* image_path,
         int index_of_frame,
@@ -20,6 +22,16 @@ int AnimToolCluster(
         uint32_t* counts
 );
 
+// Same as above, with the image in memory.
+int AnimToolClusterWithData(
+        const WebPData* image_data,
+        int index_of_frame,
+        int x, int y, int width, int height,
+        int k,
+        uint32_t* argbs,
+        uint32_t* counts
+);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,150 @@
+#ifndef ANIMTOOL_COLORMAP_H
+#define ANIMTOOL_COLORMAP_H
+
+#include "quantizer.h"
+
+#include "gif_lib.h"
+
+#include "check.h"
+
+#include <cstdint>
+#include <vector>
+
+// Maps RGB colors to palette indices through a 32x32x32 table of the quantizer's boxes.
+// In exact mode, every color gets its nearest palette entry, like a full scan of the palette would give.
+// The search is then limited to the entries which can be the nearest one for the color's cell,
+// found the first time a cell is hit.
+class InverseColorMap {
+public:
+    static const int N_CELLS = 32 * 32 * 32;
+
+    static int CellOf(uint32_t rgb) {
+        return ((rgb >> 9) & 0x7C00) | ((rgb >> 6) & 0x03E0) | ((rgb >> 3) & 0x001F);
+    }
+
+    int Init(WuQuantizer* quantizer, const ColorMapObject* cmap, int first_index, int exact) {
+        _cmap = cmap;
+        _first_index = first_index;
+        _exact = exact;
+
+        check(quantizer->GetInverseMap(_cells, first_index));
+
+        if (_exact) {
+            _candidates.clear();
+            _candidates_start.assign(N_CELLS, -1);
+            _candidates_count.assign(N_CELLS, 0);
+        }
+
+        return 1;
+    }
+
+    // Maps a row of ARGB pixels, alpha is ignored.
+    void MapRow(const uint32_t* argb, int width, uint8_t* indices) {
+        if (!_exact) {
+            // no branches, the cell computation vectorizes and only the table read is a gather
+            for (int x=0; x<width; ++x) {
+                indices[x] = _cells[CellOf(argb[x])];
+            }
+            return;
+        }
+
+        uint32_t prev_rgb = 0;
+        uint8_t prev_index = 0;
+        for (int x=0; x<width; ++x) {
+            auto rgb = argb[x] & 0x00FFFFFF;
+            if (x == 0 || rgb != prev_rgb) {
+                prev_rgb = rgb;
+                prev_index = Lookup(rgb);
+            }
+            indices[x] = prev_index;
+        }
+    }
+
+    uint8_t Lookup(uint32_t rgb) {
+        auto cell = CellOf(rgb);
+        if (!_exact) {
+            return _cells[cell];
+        }
+
+        if (_candidates_start[cell] < 0) {
+            FindCandidates(cell);
+        }
+
+        const int r = (rgb >> 16) & 0xFF;
+        const int g = (rgb >> 8) & 0xFF;
+        const int b = rgb & 0xFF;
+
+        auto candidates = _candidates.data() + _candidates_start[cell];
+        int min_dist = -1;
+        uint8_t min_idx = 0;
+        for (int k=0; k<_candidates_count[cell]; ++k) {
+            auto& color = _cmap->Colors[candidates[k]];
+            auto dist = (color.Red - r) * (color.Red - r) +
+                        (color.Green - g) * (color.Green - g) +
+                        (color.Blue - b) * (color.Blue - b);
+            if (min_dist < 0 || dist < min_dist) {
+                min_dist = dist;
+                min_idx = candidates[k];
+            }
+        }
+
+        return min_idx;
+    }
+
+private:
+    static int AxisMinDist(int c, int lo, int hi) {
+        if (c < lo) return lo - c;
+        if (c > hi) return c - hi;
+        return 0;
+    }
+
+    static int AxisMaxDist(int c, int lo, int hi) {
+        return (c - lo > hi - c) ? c - lo : hi - c;
+    }
+
+    // An entry can only be the nearest one for some color of the cell if its distance to the cell
+    // is no more than the smallest distance within which some entry covers the whole cell.
+    void FindCandidates(int cell) {
+        const int r_lo = ((cell >> 10) & 0x1F) << 3;
+        const int g_lo = ((cell >> 5) & 0x1F) << 3;
+        const int b_lo = (cell & 0x1F) << 3;
+
+        int min_dists[256];
+        int min_max_dist = -1;
+        for (int i=_first_index; i<_cmap->ColorCount; ++i) {
+            auto& color = _cmap->Colors[i];
+
+            auto dr = AxisMinDist(color.Red, r_lo, r_lo + 7);
+            auto dg = AxisMinDist(color.Green, g_lo, g_lo + 7);
+            auto db = AxisMinDist(color.Blue, b_lo, b_lo + 7);
+            min_dists[i] = dr * dr + dg * dg + db * db;
+
+            auto mr = AxisMaxDist(color.Red, r_lo, r_lo + 7);
+            auto mg = AxisMaxDist(color.Green, g_lo, g_lo + 7);
+            auto mb = AxisMaxDist(color.Blue, b_lo, b_lo + 7);
+            auto max_dist = mr * mr + mg * mg + mb * mb;
+            if (min_max_dist < 0 || max_dist < min_max_dist) {
+                min_max_dist = max_dist;
+            }
+        }
+
+        _candidates_start[cell] = static_cast<int>(_candidates.size());
+        for (int i=_first_index; i<_cmap->ColorCount; ++i) {
+            if (min_dists[i] <= min_max_dist) {
+                _candidates.push_back(static_cast<uint8_t>(i));
+            }
+        }
+        _candidates_count[cell] = static_cast<int>(_candidates.size()) - _candidates_start[cell];
+    }
+
+    uint8_t _cells[N_CELLS];
+    const ColorMapObject* _cmap;
+    int _first_index;
+    int _exact;
+
+    std::vector<uint8_t> _candidates;
+    std::vector<int> _candidates_start;
+    std::vector<int> _candidates_count;
+};
+
+#endif //ANIMTOOL_COLORMAP_H
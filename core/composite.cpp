@@ -0,0 +1,155 @@
+#include "composite.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Straight alpha over, in integers:
+//   wt = at * 255, wb = ab * (255 - at), w = wt + wb
+//   a = w / 255, c = (ct * wt + cb * wb) / w
+// which is cg::Blend scaled by 255 * 255. Both quotients are floored.
+static inline uint32_t Over(uint32_t bottom, uint32_t top) {
+    uint32_t at = top >> 24;
+    uint32_t ab = bottom >> 24;
+    if (at == 255) {
+        return top;
+    }
+    if (at == 0) {
+        return ab ? bottom : 0;
+    }
+
+    uint32_t wt = at * 255;
+    uint32_t wb = ab * (255 - at);
+    uint32_t w = wt + wb;
+
+    uint32_t argb = (w / 255) << 24;
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t ct = (top >> shift) & 0xFF;
+        uint32_t cb = (bottom >> shift) & 0xFF;
+        argb |= ((ct * wt + cb * wb) / w) << shift;
+    }
+    return argb;
+}
+
+static void OverRowScalar(uint32_t* dst, const uint32_t* src, int n, int under) {
+    for (int i=0; i<n; ++i) {
+        dst[i] = under ? Over(src[i], dst[i]) : Over(dst[i], src[i]);
+    }
+}
+
+#if defined(__SSE2__)
+// Every product and sum is an integer below 2^24, so exact in float, and a correctly rounded
+// quotient below 256 of a divisor up to 255 * 255 truncates to the exact floor.
+static inline __m128i OverSSE2(__m128i bottom, __m128i top) {
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    const __m128 k255 = _mm_set1_ps(255.0f);
+
+    auto at = _mm_cvtepi32_ps(_mm_srli_epi32(top, 24));
+    auto ab = _mm_cvtepi32_ps(_mm_srli_epi32(bottom, 24));
+
+    auto wt = _mm_mul_ps(at, k255);
+    auto wb = _mm_mul_ps(ab, _mm_sub_ps(k255, at));
+    auto w = _mm_add_ps(wt, wb);
+
+    // both transparent: 0, with w made 1 to keep the lanes finite
+    auto transparent = _mm_castps_si128(_mm_cmpeq_ps(w, _mm_setzero_ps()));
+    w = _mm_max_ps(w, _mm_set1_ps(1.0f));
+
+    auto argb = _mm_slli_epi32(_mm_cvttps_epi32(_mm_div_ps(w, k255)), 24);
+
+#define OVER_CHANNEL(shift) \
+    do { \
+        auto ct = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(top, shift), mask)); \
+        auto cb = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(bottom, shift), mask)); \
+        auto c = _mm_div_ps(_mm_add_ps(_mm_mul_ps(ct, wt), _mm_mul_ps(cb, wb)), w); \
+        argb = _mm_or_si128(argb, _mm_slli_epi32(_mm_cvttps_epi32(c), shift)); \
+    } while (0)
+
+    OVER_CHANNEL(16);
+    OVER_CHANNEL(8);
+    OVER_CHANNEL(0);
+#undef OVER_CHANNEL
+
+    return _mm_andnot_si128(transparent, argb);
+}
+
+static void OverRowSSE2(uint32_t* dst, const uint32_t* src, int n, int under) {
+    const __m128i opaque = _mm_set1_epi32(0xFF);
+
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        auto s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        auto bottom = under ? s : d;
+        auto top = under ? d : s;
+
+        // most layers are opaque or transparent in large areas
+        auto at = _mm_srli_epi32(top, 24);
+        int opaque_lanes = _mm_movemask_epi8(_mm_cmpeq_epi32(at, opaque));
+        if (opaque_lanes == 0xFFFF) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), top);
+            continue;
+        }
+        int transparent_lanes = _mm_movemask_epi8(_mm_cmpeq_epi32(at, _mm_setzero_si128()));
+        if (transparent_lanes == 0xFFFF && !under) {
+            auto ab_zero = _mm_cmpeq_epi32(_mm_srli_epi32(bottom, 24), _mm_setzero_si128());
+            if (_mm_movemask_epi8(ab_zero) == 0) {
+                continue;
+            }
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), OverSSE2(bottom, top));
+    }
+
+    OverRowScalar(dst + i, src + i, n - i, under);
+}
+#endif
+
+// Over and under with a transparent source only clear what is fully transparent already.
+static void ClearTransparentRow(uint32_t* dst, int n) {
+    for (int i=0; i<n; ++i) {
+        dst[i] = (dst[i] >> 24) ? dst[i] : 0;
+    }
+}
+
+static void MaskRow(uint32_t* dst, const uint32_t* src, int n) {
+    if (!src) {
+        for (int i=0; i<n; ++i) {
+            dst[i] &= 0x00FFFFFF;
+        }
+        return;
+    }
+
+    for (int i=0; i<n; ++i) {
+        dst[i] = (dst[i] & 0x00FFFFFF) | (src[i] & 0xFF000000);
+    }
+}
+
+void CompositeRowScalar(uint32_t* dst, const uint32_t* src, int n, CompositeMode mode) {
+    switch (mode) {
+        case COMPOSITE_OVER:
+        case COMPOSITE_UNDER:
+            if (!src) {
+                ClearTransparentRow(dst, n);
+                return;
+            }
+
+            OverRowScalar(dst, src, n, mode == COMPOSITE_UNDER);
+            return;
+
+        case COMPOSITE_MASK:
+            MaskRow(dst, src, n);
+            return;
+    }
+}
+
+void CompositeRow(uint32_t* dst, const uint32_t* src, int n, CompositeMode mode) {
+#if defined(__SSE2__)
+    if (src && (mode == COMPOSITE_OVER || mode == COMPOSITE_UNDER)) {
+        OverRowSSE2(dst, src, n, mode == COMPOSITE_UNDER);
+        return;
+    }
+#endif
+
+    CompositeRowScalar(dst, src, n, mode);
+}
@@ -0,0 +1,20 @@
+#ifndef ANIMTOOL_COMPOSITE_H
+#define ANIMTOOL_COMPOSITE_H
+
+#include <stdint.h>
+
+typedef enum CompositeMode {
+    COMPOSITE_OVER, // src over dst, as cg::Blend(dst, src)
+    COMPOSITE_UNDER, // src under dst, as cg::RevBlend(dst, src)
+    COMPOSITE_MASK // dst colors with src alpha, as cg::Mask(dst, src)
+} CompositeMode;
+
+// Composites n ARGB pixels of src into dst. A null src is transparent.
+// Over and under use exact integer math on straight alpha: each channel is the floor of the exact
+// result, which cg::Blend misses by 1 at times due to float rounding. SSE2 and scalar outputs are identical.
+void CompositeRow(uint32_t* dst, const uint32_t* src, int n, CompositeMode mode);
+
+// Same, always on the scalar path CompositeRow takes without SSE2.
+void CompositeRowScalar(uint32_t* dst, const uint32_t* src, int n, CompositeMode mode);
+
+#endif //ANIMTOOL_COMPOSITE_H
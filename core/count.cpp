@@ -70,8 +70,10 @@ static AnimDecRunCallback kRunCallback {
 };
 
 
-int AnimToolCount(
+// Decodes image_data when it is given, image_path otherwise.
+static int Count(
         const char* image_path,
+        const WebPData* image_data,
         int index_of_frame,
         int x, int y, int width, int height,
         CountPredicate red,
@@ -93,13 +95,52 @@ int AnimToolCount(
         .result = 0
     };
 
-    check(DecRun(image_path, &ctx, kRunCallback));
+    if (index_of_frame >= 0) {
+        // the run seeks to the frame, the only one it passes on
+        ctx.frame_count = index_of_frame;
+        if (image_data) {
+            check(DecRunFrameWithData(image_data, index_of_frame, &ctx, kRunCallback));
+        } else {
+            check(DecRunFrame(image_path, index_of_frame, &ctx, kRunCallback));
+        }
+    } else if (image_data) {
+        check(DecRunWithData(image_data, &ctx, kRunCallback));
+    } else {
+        check(DecRun(image_path, &ctx, kRunCallback));
+    }
 
     *count = ctx.result;
 
     return 1;
 }
 
+int AnimToolCount(
+        const char* image_path,
+        int index_of_frame,
+        int x, int y, int width, int height,
+        CountPredicate red,
+        CountPredicate green,
+        CountPredicate blue,
+        CountPredicate alpha,
+        int* count
+) {
+    return Count(image_path, nullptr, index_of_frame, x, y, width, height, red, green, blue, alpha, count);
+}
+
+int AnimToolCountWithData(
+        const WebPData* image_data,
+        int index_of_frame,
+        int x, int y, int width, int height,
+        CountPredicate red,
+        CountPredicate green,
+        CountPredicate blue,
+        CountPredicate alpha,
+        int* count
+) {
+    require(image_data);
+    return Count(nullptr, image_data, index_of_frame, x, y, width, height, red, green, blue, alpha, count);
+}
+
 const CountPredicate CountPredicateDefault = {
         .larger = -1,
         .larger_equal = -1,
@@ -221,8 +262,9 @@ int ParsePredicates(const char* predicates,
     return 0;
 }
 
-int AnimToolCountStr(
+static int CountStr(
         const char* image_path,
+        const WebPData* image_data,
         int index_of_frame,
         int x, int y, int width, int height,
         const char* predicates,
@@ -237,5 +279,26 @@ int AnimToolCountStr(
         return 0;
     }
 
-    return AnimToolCount(image_path, index_of_frame, x, y, width, height, red, green, blue, alpha, count);
-}
\ No newline at end of file
+    return Count(image_path, image_data, index_of_frame, x, y, width, height, red, green, blue, alpha, count);
+}
+
+int AnimToolCountStr(
+        const char* image_path,
+        int index_of_frame,
+        int x, int y, int width, int height,
+        const char* predicates,
+        int* count
+) {
+    return CountStr(image_path, nullptr, index_of_frame, x, y, width, height, predicates, count);
+}
+
+int AnimToolCountStrWithData(
+        const WebPData* image_data,
+        int index_of_frame,
+        int x, int y, int width, int height,
+        const char* predicates,
+        int* count
+) {
+    require(image_data);
+    return CountStr(nullptr, image_data, index_of_frame, x, y, width, height, predicates, count);
+}
@@ -10,6 +10,8 @@
 extern "C" {
 #endif
 
+typedef struct WebPData WebPData;
+
 typedef struct CountPredicate {
     int larger;
     int larger_equal;
@@ -36,6 +38,25 @@ int AnimToolCountStr(
         int* count
 );
 
+// Same as above, with the image in memory.
+int AnimToolCountWithData(
+        const WebPData* image_data,
+        int index_of_frame,
+        int x, int y, int width, int height,
+        CountPredicate red,
+        CountPredicate green,
+        CountPredicate blue,
+        CountPredicate alpha,
+        int* count
+);
+int AnimToolCountStrWithData(
+        const WebPData* image_data,
+        int index_of_frame,
+        int x, int y, int width, int height,
+        const char* predicates,
+        int* count
+);
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,28 +8,107 @@
 #include "gifrun.h"
 #include "imgrun.h"
 #include "filefmt.h"
+#include "filemap.h"
+#include "frameindex.h"
+#include "stagetime.h"
+#include "trace.h"
 
 #include "webp/encode.h" // WebPPicture
 #include "webp/mux_types.h" // WebPData
-#include "../imageio/imageio_util.h" // ImgIoUtilReadFile
 
 #include "check.h"
 #include "logger.h"
 #include "utils/defer.h"
 
+// Decoding is timed as STAGE_DECODE, the callbacks are left out.
+struct TimedRun {
+    void* ctx;
+    AnimDecRunCallback callback;
+};
+
+static int TimedOnStart(void* ctx, const AnimInfo* anim_info, int* stop) {
+    auto thiz = reinterpret_cast<TimedRun*>(ctx);
+    StageScope untimed(STAGE_NONE);
+    return thiz->callback.on_start(thiz->ctx, anim_info, stop);
+}
+
+static int TimedOnFrame(void* ctx, const AnimFrame* frame, int start_ts, int end_ts, int* stop) {
+    auto thiz = reinterpret_cast<TimedRun*>(ctx);
+    StageScope untimed(STAGE_NONE);
+    TraceScope trace("on_frame");
+    return thiz->callback.on_frame(thiz->ctx, frame, start_ts, end_ts, stop);
+}
+
+static int TimedOnEnd(void* ctx, const AnimInfo* anim_info) {
+    auto thiz = reinterpret_cast<TimedRun*>(ctx);
+    StageScope untimed(STAGE_NONE);
+    return thiz->callback.on_end(thiz->ctx, anim_info);
+}
+
+static const AnimDecRunCallback kTimedCallback = {
+    .on_start = TimedOnStart,
+    .on_frame = TimedOnFrame,
+    .on_end = TimedOnEnd,
+};
+
+// Passes frame `index` only to the callback, for decoders that cannot seek.
+struct FilteredRun {
+    void* ctx;
+    AnimDecRunCallback callback;
+    int index;
+    int frame_count;
+};
+
+static int FilteredOnStart(void* ctx, const AnimInfo* anim_info, int* stop) {
+    auto thiz = reinterpret_cast<FilteredRun*>(ctx);
+    return thiz->callback.on_start(thiz->ctx, anim_info, stop);
+}
+
+static int FilteredOnFrame(void* ctx, const AnimFrame* frame, int start_ts, int end_ts, int* stop) {
+    auto thiz = reinterpret_cast<FilteredRun*>(ctx);
+    if (thiz->frame_count++ != thiz->index) {
+        return 1;
+    }
+
+    check(thiz->callback.on_frame(thiz->ctx, frame, start_ts, end_ts, stop));
+    *stop = 1;
+    return 1;
+}
+
+static int FilteredOnEnd(void* ctx, const AnimInfo* anim_info) {
+    auto thiz = reinterpret_cast<FilteredRun*>(ctx);
+    return thiz->callback.on_end(thiz->ctx, anim_info);
+}
+
+static const AnimDecRunCallback kFilteredCallback = {
+    .on_start = FilteredOnStart,
+    .on_frame = FilteredOnFrame,
+    .on_end = FilteredOnEnd,
+};
+
 int DecRun(const char* input, void* ctx, AnimDecRunCallback callback) {
-    WebPData webp_data;
-    WebPDataInit(&webp_data);
-    defer(WebPDataClear(&webp_data));
+    size_t input_size;
+    return DecRunSized(input, &input_size, ctx, callback);
+}
+
+int DecRunSized(const char* input, size_t* input_size, void* ctx, AnimDecRunCallback callback) {
+    // The file is mapped once and every decoder reads from the mapping, without a heap copy.
+    FileMap map;
+    {
+        TraceScope trace("open_input");
+        checkf(FileMapOpen(input, &map), "The input file cannot be open %s", input);
+    }
+    defer(FileMapClose(&map));
 
-    checkf(ImgIoUtilReadFile(input, &webp_data.bytes, &webp_data.size), "The input file cannot be open %s", input);
+    auto webp_data = &map.data;
+    *input_size = webp_data->size;
 
-    if (IsWebP(&webp_data)) {
-        check(WebPDecRunWithData(&webp_data, ctx, callback));
-    } else if (IsGIF(&webp_data)) {
-        check(GIFDecRun(input, ctx, callback));
+    if (IsWebP(webp_data) || IsGIF(webp_data)) {
+        check(DecRunWithData(webp_data, ctx, callback));
     } else {
-        if (!ImgDecRunWithData(&webp_data, ctx, callback)) {
+        StageScope scope(STAGE_DECODE);
+        TimedRun timed { .ctx = ctx, .callback = callback };
+        if (!ImgDecRunWithData(webp_data, &timed, kTimedCallback)) {
             auto last_dot = strrchr(input, '.');
             notreached("Failed. Please check your file type: `%s`", last_dot ? (last_dot + 1) : input);
         }
@@ -37,3 +116,76 @@ int DecRun(const char* input, void* ctx, AnimDecRunCallback callback) {
 
     return 1;
 }
+
+int DecRunWithData(const WebPData* data, void* ctx, AnimDecRunCallback callback) {
+    require(data && data->bytes);
+
+    // the WithData decoders only read the data
+    auto webp_data = const_cast<WebPData*>(data);
+
+    StageScope scope(STAGE_DECODE);
+    TimedRun timed { .ctx = ctx, .callback = callback };
+
+    if (IsWebP(webp_data)) {
+        check(WebPDecRunWithData(webp_data, &timed, kTimedCallback));
+    } else if (IsGIF(webp_data)) {
+        check(GIFDecRunWithData(webp_data, &timed, kTimedCallback));
+    } else {
+        check(ImgDecRunWithData(webp_data, &timed, kTimedCallback));
+    }
+
+    return 1;
+}
+
+// Seeks through the frame index of `data`, the content of `path` when given.
+static int DecRunFrameWith(const WebPData* data, const char* path, int index, void* ctx, AnimDecRunCallback callback) {
+    require(data && data->bytes && index >= 0);
+
+    // the WithData decoders only read the data
+    auto webp_data = const_cast<WebPData*>(data);
+
+    StageScope scope(STAGE_DECODE);
+    TimedRun timed { .ctx = ctx, .callback = callback };
+
+    if (IsWebP(webp_data) || IsGIF(webp_data)) {
+        std::shared_ptr<const FrameIndex> frame_index;
+        check(FrameIndexGet(data, path, &frame_index));
+
+        // a kept index may be that of a file since rewritten with the same size and mtime
+        for (int rebuilt=0; ; rebuilt=1) {
+            int stale = 0;
+            if (IsWebP(webp_data)) {
+                check(WebPDecRunFrameWithData(webp_data, frame_index.get(), index, &timed, kTimedCallback, &stale));
+            } else {
+                check(GIFDecRunFrameWithData(webp_data, frame_index.get(), index, &timed, kTimedCallback, &stale));
+            }
+            if (!stale) {
+                break;
+            }
+
+            checkf(!rebuilt, "The frame index does not match the data it was built from");
+            logger::w("Rebuilding the stale frame index of %s", path ? path : "the input");
+            check(FrameIndexRebuild(data, path, &frame_index));
+        }
+    } else {
+        FilteredRun filtered { .ctx = &timed, .callback = kTimedCallback, .index = index, .frame_count = 0 };
+        check(ImgDecRunWithData(webp_data, &filtered, kFilteredCallback));
+    }
+
+    return 1;
+}
+
+int DecRunFrame(const char* input, int index, void* ctx, AnimDecRunCallback callback) {
+    FileMap map;
+    {
+        TraceScope trace("open_input");
+        checkf(FileMapOpen(input, &map), "The input file cannot be open %s", input);
+    }
+    defer(FileMapClose(&map));
+
+    return DecRunFrameWith(&map.data, input, index, ctx, callback);
+}
+
+int DecRunFrameWithData(const WebPData* data, int index, void* ctx, AnimDecRunCallback callback) {
+    return DecRunFrameWith(data, nullptr, index, ctx, callback);
+}
@@ -8,11 +8,24 @@
 
 #include "animrun.h"
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef struct WebPData WebPData;
+
 int DecRun(const char* input, void* ctx, AnimDecRunCallback callback);
+// Same, also setting `*input_size` to the bytes of the input, read from stdin when it is "-".
+int DecRunSized(const char* input, size_t* input_size, void* ctx, AnimDecRunCallback callback);
+int DecRunWithData(const WebPData* data, void* ctx, AnimDecRunCallback callback);
+
+// Same, with on_frame called for frame `index` only, which WebP and GIF decode from the last frame
+// before it that does not depend on earlier ones, as found in their frame index (see frameindex.h).
+// on_frame is not called past the last frame.
+int DecRunFrame(const char* input, int index, void* ctx, AnimDecRunCallback callback);
+int DecRunFrameWithData(const WebPData* data, int index, void* ctx, AnimDecRunCallback callback);
 
 #ifdef __cplusplus
 }
@@ -10,6 +10,8 @@
 #include "imgrun.h"
 #include "filefmt.h"
 #include "animenc.h"
+#include "stagetime.h"
+#include "trace.h"
 
 #include "webp/encode.h" // WebPPicture
 #include "webp/mux_types.h" // WebPData
@@ -18,10 +20,19 @@
 #include "check.h"
 #include "logger.h"
 #include "utils/defer.h"
+#include "utils/queue.h"
 #include "decrun.h"
 
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Max number of frames buffered between two pipeline stages.
+#define PIPELINE_QUEUE_DEPTH 4
 
 
 static int RelToAbs(FrameTransformRectRel* rel, int width, int height, FrameTransformRectAbs* abs) {
@@ -88,6 +99,7 @@ typedef struct DropFramesOptions {
 
     // global: WebPAnimEncoderOptions
     int minimize_size;
+    int global_palette;
     int verbose;
 
     // per-frame: WebPConfig
@@ -96,8 +108,15 @@ typedef struct DropFramesOptions {
     int method;
     int pass;
 
+    int pipeline;
+
     int n_transforms;
     FrameTransform transforms[MAX_N_TRANSFORMS];
+
+    // instead of output and output_dir: output i, j is appended to output_buffers[i][j]
+    AnimEncoderBuffer (*output_buffers)[MAX_N_TRANSFORM_DSTS];
+
+    DropFramesStats* stats;
 } DropFramesOptions;
 
 
@@ -106,6 +125,55 @@ struct EncodersGroup {
     AnimEncoder* encoders[MAX_N_TRANSFORM_DSTS];
 };
 
+
+// Adds its lifetime to `*ns`, if ns is given.
+class ElapsedTimer {
+public:
+    explicit ElapsedTimer(int64_t* ns): _ns(ns), _start(std::chrono::steady_clock::now()) {}
+
+    ~ElapsedTimer() {
+        if (_ns) {
+            *_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+        }
+    }
+
+private:
+    int64_t* _ns;
+    std::chrono::steady_clock::time_point _start;
+};
+
+
+typedef std::shared_ptr<WebPPicture> SharedPic;
+
+static int SharedPicNew(SharedPic* out) {
+    auto pic = new WebPPicture();
+    if (!WebPPictureInit(pic)) {
+        delete pic;
+        notreached("Failed to init WebPPicture");
+    }
+
+    *out = SharedPic(pic, [](WebPPicture* p) {
+        WebPPictureFree(p);
+        delete p;
+    });
+
+    return 1;
+}
+
+// A decoded frame travelling from the decode stage to the transform stage.
+struct PipelineFrame {
+    SharedPic pic;
+    int start_ts;
+    int end_ts;
+};
+
+// A transformed frame waiting for the encoder of one destination.
+struct EncodeItem {
+    SharedPic pic;
+    int start_ts;
+    int end_ts;
+};
+
 struct DropFramesContext {
     DropFramesOptions options;
 
@@ -119,6 +187,25 @@ struct DropFramesContext {
 
     NormalizedFrameTransform transforms[MAX_N_TRANSFORMS];
 
+    StageTimes* stage_times; // of the call, for options.stats
+
+    struct Pipeline;
+    std::unique_ptr<Pipeline> pipeline;
+
+    // Each destination is encoded by one thread at a time.
+    int64_t* DstEncodeNs(int i, int j) {
+        return options.stats ? &options.stats->dsts[i][j].encode_ns : nullptr;
+    }
+
+    AnimFrameOptions GetFrameOptions() const {
+        return AnimFrameOptions {
+            .lossless = options.lossless,
+            .quality = options.quality,
+            .method = options.method,
+            .pass = options.pass
+        };
+    }
+
     int OnDecodeStart(const AnimInfo* info, int* stop) {
         auto in_canvas_width = info->canvas_width;
         auto in_canvas_height = info->canvas_height;
@@ -172,22 +259,46 @@ struct DropFramesContext {
                 AnimEncoderOptions encoder_options {
                     .verbose = options.verbose,
                     .minimize_size = options.minimize_size,
+                    .global_palette = options.global_palette,
                     .bgcolor = info->bgcolor
                 };
 
 
-                auto encoder = AnimEncoderNew(
-                        dst.format,
-                        out_canvas_width,
-                        out_canvas_height,
-                        &encoder_options
-                        );
+                AnimEncoder* encoder;
+                if (options.output_buffers) {
+                    encoder = AnimEncoderNewWithBuffer(
+                            dst.format,
+                            out_canvas_width,
+                            out_canvas_height,
+                            &encoder_options,
+                            &options.output_buffers[i][j]
+                            );
+                } else {
+                    // streamed to a temporary file, renamed over the output by AnimEncoderFinish
+                    PathBuilder pb;
+                    BuildOutputPath(i, j, AnimEncoderFormatGetFileExt(dst.format), &pb);
+                    logger::d("AnimEncoderNewWithFile %s", pb.buf);
+
+                    encoder = AnimEncoderNewWithFile(
+                            dst.format,
+                            out_canvas_width,
+                            out_canvas_height,
+                            &encoder_options,
+                            pb.buf
+                            );
+                }
                 checkf(encoder, "Failed to create AnimEncoderNew");
 
                 encoders_groups[i].encoders[j] = encoder;
             }
         }
 
+        if (options.pipeline) {
+            logger::d("Start pipeline");
+            pipeline.reset(new Pipeline(this));
+            check(pipeline->Start());
+        }
+
         return 1;
     }
 
@@ -241,22 +352,28 @@ struct DropFramesContext {
 
             require(out_end_ts >= 0);
 
-            WebPPicture decoded_frame;
-            check(WebPPictureInit(&decoded_frame));
-            defer(WebPPictureFree(&decoded_frame));
+            logger::d("frame to be added %d", out_start_ts);
 
-            check(AnimFrameExportToPic(frame, &decoded_frame));
+            if (pipeline) {
+                SharedPic decoded_frame;
+                check(SharedPicNew(&decoded_frame));
+                check(AnimFrameExportToPic(frame, decoded_frame.get()));
 
-            logger::d("frame to be added %d", out_start_ts);
+                check(pipeline->Push(PipelineFrame {
+                    .pic = decoded_frame,
+                    .start_ts = out_start_ts,
+                    .end_ts = out_end_ts
+                }));
+            } else {
+                WebPPicture decoded_frame;
+                check(WebPPictureInit(&decoded_frame));
+                defer(WebPPictureFree(&decoded_frame));
 
-            AnimFrameOptions frame_options {
-                    .lossless = options.lossless,
-                    .quality = options.quality,
-                    .method = options.method,
-                    .pass = options.pass
-            };
+                check(AnimFrameExportToPic(frame, &decoded_frame));
 
-            check(TransformFrameForAllDsts(&decoded_frame, out_start_ts, out_end_ts, &frame_options));
+                auto frame_options = GetFrameOptions();
+                check(TransformFrameForAllDsts(&decoded_frame, out_start_ts, out_end_ts, &frame_options));
+            }
 
             ++out_frame_count;
 
@@ -283,12 +400,14 @@ struct DropFramesContext {
         CoWPic& operator=(CoWPic&) = delete;
 
         int Crop(int left, int top, int width, int height) {
+            StageScope scope(STAGE_CROP);
             check(CopyIfNeeded());
             check(WebPPictureCrop(&_local, left, top, width, height));
             return 1;
         }
 
         int Rescale(int width, int height) {
+            StageScope scope(STAGE_RESCALE);
             check(CopyIfNeeded());
             check(WebPPictureRescale(&_local, width, height));
             return 1;
@@ -304,6 +423,26 @@ struct DropFramesContext {
             return _current;
         }
 
+        // Hands the current picture over as a SharedPic. A local copy is moved out,
+        // otherwise `foreign_ref`, the owner of the foreign picture, is shared.
+        int Share(const SharedPic& foreign_ref, SharedPic* out) {
+            require(foreign_ref.get() == _foreign);
+
+            if (_current != &_local) {
+                *out = foreign_ref;
+                return 1;
+            }
+
+            SharedPic pic;
+            check(SharedPicNew(&pic));
+            *pic = _local; // takes over the buffers of the local copy
+            check(WebPPictureInit(&_local));
+            _current = _foreign;
+
+            *out = pic;
+            return 1;
+        }
+
     private:
         int CopyIfNeeded() {
             if (_current == &_local)
@@ -351,6 +490,7 @@ struct DropFramesContext {
 
                 // we always pass in out_start_ts instead of out_end_ts
                 // out_start_ts never exceeds the total duration of the animated image.
+                ElapsedTimer timer(DstEncodeNs(i, j));
                 check(AnimEncoderAddFrame(encoders_groups[i].encoders[j], rescaled.Get(), start_ts, end_ts, frame_options));
             }
         }
@@ -358,12 +498,188 @@ struct DropFramesContext {
         return 1;
     }
 
+    int TransformFrame(int i, const SharedPic& decoded_frame, SharedPic dst_frames[MAX_N_TRANSFORM_DSTS]) {
+        auto& transform = transforms[i];
+        auto& src = transform.src;
+
+        CoWPic cropped(decoded_frame.get());
+
+        if (src.width > 0 && src.height > 0) {
+            logger::d("Crop %d:%d:%d:%d", src.left, src.top, src.width, src.height);
+            check(cropped.Crop(src.left, src.top, src.width, src.height));
+        }
+
+        SharedPic cropped_frame;
+        check(cropped.Share(decoded_frame, &cropped_frame));
+
+        for (int j=0; j < transform.n_dsts; ++j) {
+            auto dst = transform.dsts[j];
+
+            CoWPic rescaled(cropped_frame.get());
+
+            if (dst.width > 0 && dst.height > 0) {
+                logger::d("Rescale %d:%d", dst.width, dst.height);
+                check(rescaled.Rescale(dst.width, dst.height));
+            }
+
+            check(rescaled.Share(cropped_frame, &dst_frames[j]));
+        }
+
+        return 1;
+    }
+
+    // Decoding stays on the caller's thread. Each transform gets a thread doing its crop and rescales,
+    // which feeds one encoder thread per destination, so the destinations are encoded side by side.
+    struct Pipeline {
+        explicit Pipeline(DropFramesContext* ctx): ctx(ctx), failed(0), finished(0) {}
+
+        Pipeline(const Pipeline&) = delete;
+        Pipeline& operator=(const Pipeline&) = delete;
+
+        ~Pipeline() {
+            Finish();
+        }
+
+        int Start() {
+            for (int i=0; i<ctx->options.n_transforms; ++i) {
+                transform_queues[i].reset(new BoundedQueue<PipelineFrame>(PIPELINE_QUEUE_DEPTH));
+                for (int j=0; j<ctx->transforms[i].n_dsts; ++j) {
+                    encode_queues[i][j].reset(new BoundedQueue<EncodeItem>(PIPELINE_QUEUE_DEPTH));
+                }
+            }
+
+            for (int i=0; i<ctx->options.n_transforms; ++i) {
+                threads.emplace_back([this, i]() {
+                    StageTimesBinding binding(ctx->stage_times);
+                    if (!TransformLoop(i)) Abort();
+                });
+
+                for (int j=0; j<ctx->transforms[i].n_dsts; ++j) {
+                    threads.emplace_back([this, i, j]() {
+                        StageTimesBinding binding(ctx->stage_times);
+                        if (!EncodeLoop(i, j)) Abort();
+                    });
+                }
+            }
+
+            return 1;
+        }
+
+        int Push(const PipelineFrame& frame) {
+            for (int i=0; i<ctx->options.n_transforms; ++i) {
+                checkf(TracedPush(transform_queues[i].get(), frame), "Pipeline aborted");
+            }
+
+            return 1;
+        }
+
+        // Waits until every pushed frame has been encoded.
+        int Finish() {
+            if (!finished) {
+                finished = 1;
+
+                for (int i=0; i<ctx->options.n_transforms; ++i) {
+                    transform_queues[i]->Close();
+                }
+
+                for (auto& thread : threads) {
+                    thread.join();
+                }
+            }
+
+            checkf(!failed, "Pipeline aborted");
+            return 1;
+        }
+
+    private:
+        // Time blocked on a queue shows up in the trace as a stall of the producer or the consumer.
+        template <typename T>
+        static int TracedPush(BoundedQueue<T>* queue, T item) {
+            TraceScope trace("queue_push");
+            return queue->Push(std::move(item));
+        }
+
+        template <typename T>
+        static int TracedPop(BoundedQueue<T>* queue, T* item) {
+            TraceScope trace("queue_pop");
+            return queue->Pop(item);
+        }
+
+        int TransformLoop(int i) {
+            auto n_dsts = ctx->transforms[i].n_dsts;
+            defer(
+                for (int j=0; j<n_dsts; ++j) {
+                    encode_queues[i][j]->Close();
+                }
+            );
+
+            PipelineFrame frame;
+            while (TracedPop(transform_queues[i].get(), &frame)) {
+                check(!failed);
+
+                SharedPic dst_frames[MAX_N_TRANSFORM_DSTS];
+                check(ctx->TransformFrame(i, frame.pic, dst_frames));
+                frame.pic.reset();
+
+                for (int j=0; j<n_dsts; ++j) {
+                    check(TracedPush(encode_queues[i][j].get(), EncodeItem {
+                        .pic = std::move(dst_frames[j]),
+                        .start_ts = frame.start_ts,
+                        .end_ts = frame.end_ts
+                    }));
+                }
+            }
+
+            return 1;
+        }
+
+        // Encoders are stateful, so each one is fed by exactly one thread in frame order.
+        int EncodeLoop(int i, int j) {
+            auto encoder = ctx->encoders_groups[i].encoders[j];
+            auto frame_options = ctx->GetFrameOptions();
+
+            EncodeItem item;
+            while (TracedPop(encode_queues[i][j].get(), &item)) {
+                check(!failed);
+
+                ElapsedTimer timer(ctx->DstEncodeNs(i, j));
+                check(AnimEncoderAddFrame(encoder, item.pic.get(), item.start_ts, item.end_ts, &frame_options));
+                item.pic.reset();
+            }
+
+            return 1;
+        }
+
+        void Abort() {
+            failed = 1;
+
+            for (int i=0; i<ctx->options.n_transforms; ++i) {
+                transform_queues[i]->Close();
+                for (int j=0; j<ctx->transforms[i].n_dsts; ++j) {
+                    encode_queues[i][j]->Close();
+                }
+            }
+        }
+
+        DropFramesContext* ctx;
+        std::atomic<int> failed;
+        int finished;
+
+        std::unique_ptr<BoundedQueue<PipelineFrame>> transform_queues[MAX_N_TRANSFORMS];
+        std::unique_ptr<BoundedQueue<EncodeItem>> encode_queues[MAX_N_TRANSFORMS][MAX_N_TRANSFORM_DSTS];
+        std::vector<std::thread> threads;
+    };
+
+    // Also drops the outputs of the encoders not finished yet.
     void DeleteAllEncoders() {
+        pipeline.reset(); // its threads may still be encoding
+
         for (int i=0; i<options.n_transforms; ++i) {
             auto& transform = transforms[i];
 
             for (int j=0; j<transform.n_dsts; ++j) {
                 AnimEncoderDelete(encoders_groups[i].encoders[j]);
+                encoders_groups[i].encoders[j] = nullptr;
             }
         }
     }
@@ -429,44 +745,55 @@ struct DropFramesContext {
     };
 
 
-    int OnDecodeEnd(const AnimInfo* anim_info) {
-        defer(DeleteAllEncoders());
+    void BuildOutputPath(int i, int j, const char* file_ext, PathBuilder* pb) {
+        auto& transform = options.transforms[i];
 
-        for (int i=0; i<options.n_transforms; ++i) {
-            auto transform = options.transforms[i];
+        if (options.output_dir) {
+            pb->AddStr(options.output_dir);
 
-            for (int j=0; j<transform.n_dsts; ++j) {
+            if (options.output_dir[strlen(options.output_dir)-1] != '/') {
+                pb->AddStr("/");
+            }
 
-                auto file_ext = AnimEncoderGetFileExt(encoders_groups[i].encoders[j]);
+            const char* file_name = transform.dsts[j].file_name;
+            if (strlen(file_name) > 0) {
+                pb->AddStr(file_name);
+            } else {
+                pb->AddSuffix("", i, j);
+                pb->AddStr(file_ext);
+            }
 
-                PathBuilder pb;
+        } else if (options.output) {
+            if (i == 0 && j == 0) {
+                pb->AddStr(options.output);
+            } else {
+                pb->BuildWithPath(options.output, i, j, nullptr);
+            }
+        } else {
+            // fine, we fallback to input
+            pb->BuildWithPath(options.input, i, j, file_ext);
+        }
+    }
 
-                if (options.output_dir) {
-                    pb.AddStr(options.output_dir);
+    void CollectOutputSize(int i, int j) {
+        if (options.stats) {
+            auto size = static_cast<int64_t>(AnimEncoderGetBytesWritten(encoders_groups[i].encoders[j]));
+            options.stats->dsts[i][j].output_size = size;
+            options.stats->bytes_written += size;
+        }
+    }
 
-                    if (options.output_dir[strlen(options.output_dir)-1] != '/') {
-                        pb.AddStr("/");
-                    }
+    int OnDecodeEnd(const AnimInfo* anim_info) {
+        defer(DeleteAllEncoders());
 
-                    const char* file_name = transform.dsts[j].file_name;
-                    if (strlen(file_name) > 0) {
-                        pb.AddStr(file_name);
-                    } else {
-                        pb.AddSuffix("", i, j);
-                        pb.AddStr(file_ext);
-                    }
+        if (pipeline) {
+            check(pipeline->Finish());
+        }
 
-                } else if (options.output) {
-                    if (i == 0 && j == 0) {
-                        pb.AddStr(options.output);
-                    } else {
-                        pb.BuildWithPath(options.output, i, j, nullptr);
-                    }
-                } else {
-                    // fine, we fallback to input
-                    pb.BuildWithPath(options.input, i, j, file_ext);
-                }
+        for (int i=0; i<options.n_transforms; ++i) {
+            auto transform = options.transforms[i];
 
+            for (int j=0; j<transform.n_dsts; ++j) {
 
                 int loop_count = 0;
 
@@ -480,13 +807,19 @@ struct DropFramesContext {
                     }
                 }
 
-                logger::d("AnimEncoderExport src_duration=%d out_start=%d, %s", in_total_duration_so_far, out_start_ts, pb.buf);
                 // usually out_start_ts will not larger than in_total_duration_so_far, except if the duration sequence is like this
                 // #0 100
                 // #1 0
                 // #2 0
                 // #3 0
-                check(AnimEncoderExport(encoders_groups[i].encoders[j], (out_start_ts > in_total_duration_so_far) ? out_start_ts : in_total_duration_so_far, loop_count, pb.buf));
+                auto final_ts = (out_start_ts > in_total_duration_so_far) ? out_start_ts : in_total_duration_so_far;
+
+                logger::d("AnimEncoderFinish src_duration=%d out_start=%d", in_total_duration_so_far, out_start_ts);
+                {
+                    ElapsedTimer timer(DstEncodeNs(i, j));
+                    check(AnimEncoderFinish(encoders_groups[i].encoders[j], final_ts, loop_count));
+                }
+                CollectOutputSize(i, j);
             }
         }
 
@@ -527,16 +860,21 @@ static const char* GetGravityStr(int gravities) {
     }
 }
 
-int AnimToolDropFrames(
+// Decodes input_data when it is given, input otherwise, and encodes into output_buffers
+// when they are given, into files otherwise.
+static int DropFrames(
     const char* const input,
+    const WebPData* input_data,
     const char* const output,
     const char* const output_dir,
+    AnimEncoderBuffer (*output_buffers)[MAX_N_TRANSFORM_DSTS],
     int target_frame_rate,
     int target_total_duration,
     int loop_count,
 
     // global: WebPAnimEncoderOptions
     int minimize_size,
+    int global_palette,
     int verbose,
 
     // per-frame: WebPConfig
@@ -545,23 +883,30 @@ int AnimToolDropFrames(
     int method,
     int pass,
 
+    int pipeline,
+
     int n_transforms,
-    const FrameTransform transforms[MAX_N_TRANSFORMS]
+    const FrameTransform transforms[MAX_N_TRANSFORMS],
+
+    DropFramesStats* stats
 ) {
     logger::i("Start AnimToolDropFrames");
-    logger::i("    input: %s", input);
+    logger::i("    input: %s", input_data ? "(memory)" : input);
     logger::i("    output: %s", output);
     logger::i("    output_dir: %s", output_dir);
     logger::i("    frame_rate: %d", target_frame_rate);
     logger::i("    total_duration: %d", target_total_duration);
 
     logger::i("    minimize_size: %d", minimize_size);
+    logger::i("    global_palette: %d", global_palette);
 
     logger::i("    lossless: %d", lossless);
     logger::i("    quality: %f", quality);
     logger::i("    method: %d", method);
     logger::i("    pass: %d", pass);
 
+    logger::i("    pipeline: %d", pipeline);
+
     logger::i("    n_transforms: %d", n_transforms);
     for (int i=0; i<n_transforms; ++i) {
         auto& t = transforms[i];
@@ -589,26 +934,133 @@ int AnimToolDropFrames(
         .target_total_duration = target_total_duration,
         .loop_count = loop_count,
         .minimize_size = minimize_size,
+        .global_palette = global_palette,
         .verbose = verbose,
         .lossless = lossless,
         .quality = quality,
         .method = method,
         .pass = pass,
+        .pipeline = pipeline,
         .n_transforms = n_transforms,
+        .output_buffers = output_buffers,
+        .stats = stats,
     };
 
     memcpy(options.transforms, transforms, sizeof(transforms[0]) * n_transforms);
 
+    if (stats) {
+        *stats = DropFramesStats {};
+    }
+
+    StageTimes stage_times {};
+    StageTimesBinding binding(stats ? &stage_times : nullptr);
+
     DropFramesContext ctx{
-        .options = options
+        .options = options,
+        .stage_times = StageTimesGetBound()
     };
+    // when the run fails before OnDecodeEnd
+    defer(ctx.DeleteAllEncoders());
 
-    check(DecRun(input, &ctx, kDropFramesCallback));
+    size_t input_size;
+    if (input_data) {
+        input_size = input_data->size;
+        check(DecRunWithData(input_data, &ctx, kDropFramesCallback));
+    } else {
+        check(DecRunSized(input, &input_size, &ctx, kDropFramesCallback));
+    }
 
     logger::i("End AnimToolDropFrames: %d->%d", ctx.in_frame_count, ctx.out_frame_count);
+
+    if (stats) {
+        stats->decode_ns = stage_times.ns[STAGE_DECODE];
+        stats->compose_ns = stage_times.ns[STAGE_COMPOSE];
+        stats->crop_ns = stage_times.ns[STAGE_CROP];
+        stats->rescale_ns = stage_times.ns[STAGE_RESCALE];
+        stats->quantize_ns = stage_times.ns[STAGE_QUANTIZE];
+        stats->encode_ns = stage_times.ns[STAGE_ENCODE];
+        stats->mux_ns = stage_times.ns[STAGE_MUX];
+        stats->write_ns = stage_times.ns[STAGE_WRITE];
+
+        stats->bytes_read = static_cast<int64_t>(input_size);
+
+        stats->in_frame_count = ctx.in_frame_count;
+        stats->out_frame_count = ctx.out_frame_count;
+        stats->frames_dropped = ctx.in_frame_count - ctx.out_frame_count;
+    }
     return 1;
 }
 
+int AnimToolDropFrames(
+    const char* const input,
+    const char* const output,
+    const char* const output_dir,
+    int target_frame_rate,
+    int target_total_duration,
+    int loop_count,
+
+    // global: WebPAnimEncoderOptions
+    int minimize_size,
+    int global_palette,
+    int verbose,
+
+    // per-frame: WebPConfig
+    int lossless,
+    float quality,
+    int method,
+    int pass,
+
+    int pipeline,
+
+    int n_transforms,
+    const FrameTransform transforms[MAX_N_TRANSFORMS],
+
+    DropFramesStats* stats
+) {
+    return DropFrames(input, nullptr, output, output_dir, nullptr,
+                      target_frame_rate, target_total_duration, loop_count,
+                      minimize_size, global_palette, verbose,
+                      lossless, quality, method, pass,
+                      pipeline,
+                      n_transforms, transforms,
+                      stats);
+}
+
+int AnimToolDropFramesWithData(
+    const WebPData* input,
+    int target_frame_rate,
+    int target_total_duration,
+    int loop_count,
+
+    // global: WebPAnimEncoderOptions
+    int minimize_size,
+    int global_palette,
+    int verbose,
+
+    // per-frame: WebPConfig
+    int lossless,
+    float quality,
+    int method,
+    int pass,
+
+    int pipeline,
+
+    int n_transforms,
+    const FrameTransform transforms[MAX_N_TRANSFORMS],
+    AnimEncoderBuffer outputs[MAX_N_TRANSFORMS][MAX_N_TRANSFORM_DSTS],
+
+    DropFramesStats* stats
+) {
+    require(input && outputs);
+    return DropFrames(nullptr, input, nullptr, nullptr, outputs,
+                      target_frame_rate, target_total_duration, loop_count,
+                      minimize_size, global_palette, verbose,
+                      lossless, quality, method, pass,
+                      pipeline,
+                      n_transforms, transforms,
+                      stats);
+}
+
 int AnimToolDropFramesLite(
     const char* const input,
     const char* const output,
@@ -651,6 +1103,7 @@ int AnimToolDropFramesLite(
             loop_count,
 
             0, // minimize_size
+            0, // global_palette
             0, // verbose
 
             0, // lossless
@@ -658,8 +1111,12 @@ int AnimToolDropFramesLite(
             0, // method
             1, // pass
 
+            0, // pipeline
+
             1,
-            &transform
+            &transform,
+
+            nullptr // stats
     );
 }
 
@@ -10,10 +10,15 @@
 #define MAX_FILE_NAME_LENGTH 256
 #define MAX_FORMAT_LENGTH 8
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef struct WebPData WebPData;
+typedef struct AnimEncoderBuffer AnimEncoderBuffer;
+
 typedef struct FrameTransformRectAbs {
     int left;
     int top;
@@ -58,6 +63,33 @@ typedef struct FrameTransform {
 } FrameTransform;
 
 
+typedef struct DropFramesDstStats {
+    int64_t encode_ns; // adding the frames and finishing, including quantize, mux and write
+    int64_t output_size;
+} DropFramesDstStats;
+
+// Stage times are summed over all the threads of the call, so they can add up to more than its wall time.
+typedef struct DropFramesStats {
+    int64_t decode_ns;
+    int64_t compose_ns;
+    int64_t crop_ns;
+    int64_t rescale_ns;
+    int64_t quantize_ns;
+    int64_t encode_ns;
+    int64_t mux_ns;
+    int64_t write_ns;
+
+    int64_t bytes_read;
+    int64_t bytes_written;
+
+    int in_frame_count;
+    int out_frame_count;
+    int frames_dropped;
+
+    DropFramesDstStats dsts[MAX_N_TRANSFORMS][MAX_N_TRANSFORM_DSTS];
+} DropFramesStats;
+
+
 int AnimToolDropFrames(
     const char* const input,
     const char* const output,
@@ -68,6 +100,7 @@ int AnimToolDropFrames(
 
     // global: WebPAnimEncoderOptions
     int minimize_size,
+    int global_palette,
     int verbose,
 
     // per-frame: WebPConfig
@@ -76,8 +109,42 @@ int AnimToolDropFrames(
     int method,
     int pass,
 
+    // decode, transform and encode on separate threads
+    int pipeline,
+
     int n_transforms,
-    const FrameTransform transforms[MAX_N_TRANSFORMS]
+    const FrameTransform transforms[MAX_N_TRANSFORMS],
+
+    DropFramesStats* stats // optional
+);
+
+// Same as above, with the input in memory. Output i, j (transform i, destination j)
+// is appended to outputs[i][j], the file names of the destinations are ignored.
+int AnimToolDropFramesWithData(
+    const WebPData* input,
+    int target_frame_rate,
+    int target_total_duration,
+    int loop_count,
+
+    // global: WebPAnimEncoderOptions
+    int minimize_size,
+    int global_palette,
+    int verbose,
+
+    // per-frame: WebPConfig
+    int lossless,
+    float quality,
+    int method,
+    int pass,
+
+    // decode, transform and encode on separate threads
+    int pipeline,
+
+    int n_transforms,
+    const FrameTransform transforms[MAX_N_TRANSFORMS],
+    AnimEncoderBuffer outputs[MAX_N_TRANSFORMS][MAX_N_TRANSFORM_DSTS],
+
+    DropFramesStats* stats // optional
 );
 
 int AnimToolDropFramesLite(
@@ -0,0 +1,60 @@
+#include "filemap.h"
+
+#include "../imageio/imageio_util.h" // ImgIoUtilReadFile
+
+#include "check.h"
+#include "logger.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+int FileMapOpen(const char* file_path, FileMap* map) {
+    require(file_path && map);
+    WebPDataInit(&map->data);
+    map->mapped = 0;
+
+#ifndef _WIN32
+    int fd = open(file_path, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st {};
+        void* addr = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+
+        if (addr != MAP_FAILED) {
+            // every decoder reads the input front to back
+            madvise(addr, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+
+            map->data.bytes = static_cast<const uint8_t*>(addr);
+            map->data.size = static_cast<size_t>(st.st_size);
+            map->mapped = 1;
+            return 1;
+        }
+        logger::d("mmap is not available for %s, reading it instead", file_path);
+    }
+#endif
+
+    // pipes, empty files and platforms without mmap
+    return ImgIoUtilReadFile(file_path, &map->data.bytes, &map->data.size);
+}
+
+void FileMapClose(FileMap* map) {
+    if (!map) return;
+
+#ifndef _WIN32
+    if (map->mapped) {
+        munmap(const_cast<uint8_t*>(map->data.bytes), map->data.size);
+        WebPDataInit(&map->data);
+        map->mapped = 0;
+        return;
+    }
+#endif
+
+    WebPDataClear(&map->data);
+}
@@ -0,0 +1,16 @@
+#ifndef ANIMTOOL_FILEMAP_H
+#define ANIMTOOL_FILEMAP_H
+
+#include "webp/mux_types.h" // WebPData
+
+// A read-only view of a whole file, memory mapped where the platform allows it.
+// `data` stays valid until FileMapClose.
+struct FileMap {
+    WebPData data;
+    int mapped;  // 0 when the bytes were read onto the heap instead
+};
+
+int FileMapOpen(const char* file_path, FileMap* map);
+void FileMapClose(FileMap* map);
+
+#endif //ANIMTOOL_FILEMAP_H
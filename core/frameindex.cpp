@@ -0,0 +1,285 @@
+#include "frameindex.h"
+
+#include "filefmt.h"
+#include "gifrun.h"
+#include "webprun.h"
+#include "trace.h"
+
+#include "webp/mux_types.h" // WebPData
+
+#include "check.h"
+#include "logger.h"
+#include "utils/defer.h"
+#include "utils/tmppath.h"
+
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+// Indexes are small, a few tens of bytes per frame: this many files are kept in process.
+#define FRAME_INDEX_CACHE_CAPACITY 64
+
+#define FRAME_INDEX_SIDECAR_MAGIC "AFIX"
+#define FRAME_INDEX_SIDECAR_VERSION 1
+
+static_assert(std::is_trivially_copyable<FrameIndexHeader>::value, "stored as is");
+static_assert(std::is_trivially_copyable<FrameIndexEntry>::value, "stored as is");
+
+// Sidecars are in native byte order and layout: a sidecar from another platform fails the magic
+// or the sizes and is rebuilt.
+struct SidecarHead {
+    char magic[4];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t entry_size;
+    uint64_t file_size;
+    int64_t file_mtime_ns;
+    uint64_t n_frames;
+};
+
+struct FileStamp {
+    uint64_t size;
+    int64_t mtime_ns;
+};
+
+static thread_local int t_sidecar_enabled = 0;
+
+FrameIndexSidecarBinding::FrameIndexSidecarBinding(int enabled): _outer(t_sidecar_enabled) {
+    t_sidecar_enabled = enabled;
+}
+
+FrameIndexSidecarBinding::~FrameIndexSidecarBinding() {
+    t_sidecar_enabled = _outer;
+}
+
+int FrameIndexBuild(const WebPData* data, FrameIndex* index) {
+    require(data && data->bytes && index);
+
+    TraceScope trace("frame_index_build");
+    if (IsWebP(data)) {
+        check(WebPBuildFrameIndex(data, 0, index));
+    } else if (IsGIF(data)) {
+        check(GIFBuildFrameIndex(data, 0, index));
+    } else {
+        notreached("Only WebP and GIF are indexed");
+    }
+
+    return 1;
+}
+
+int FrameIndexReadHeader(const WebPData* data, FrameIndexHeader* header) {
+    require(data && data->bytes && header);
+
+    FrameIndex index;
+    if (IsWebP(data)) {
+        check(WebPBuildFrameIndex(data, 1, &index));
+    } else if (IsGIF(data)) {
+        check(GIFBuildFrameIndex(data, 1, &index));
+    } else {
+        notreached("Only WebP and GIF are indexed");
+    }
+
+    *header = index.header;
+    return 1;
+}
+
+int FrameIndexFindKeyFrame(const FrameIndex* index, int i) {
+    while (i > 0 && !index->frames[i].is_key_frame) {
+        --i;
+    }
+    return i;
+}
+
+static int GetFileStamp(const char* path, FileStamp* stamp) {
+    struct stat st {};
+    if (stat(path, &st) != 0) {
+        return 0;
+    }
+
+    stamp->size = static_cast<uint64_t>(st.st_size);
+#if defined(__APPLE__)
+    stamp->mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    stamp->mtime_ns = static_cast<int64_t>(st.st_mtime) * 1000000000;
+#else
+    stamp->mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return 1;
+}
+
+static std::string GetSidecarPath(const char* path) {
+    return std::string(path) + FRAME_INDEX_SIDECAR_SUFFIX;
+}
+
+// 0 when there is no sidecar, or one for another version of the file.
+static int ReadSidecar(const char* path, const FileStamp& stamp, FrameIndex* index) {
+    auto sidecar_path = GetSidecarPath(path);
+    auto file = fopen(sidecar_path.c_str(), "rb");
+    if (!file) {
+        return 0;
+    }
+    defer(fclose(file));
+
+    SidecarHead head {};
+    if (fread(&head, sizeof(head), 1, file) != 1 ||
+        memcmp(head.magic, FRAME_INDEX_SIDECAR_MAGIC, sizeof(head.magic)) != 0 ||
+        head.version != FRAME_INDEX_SIDECAR_VERSION ||
+        head.header_size != sizeof(FrameIndexHeader) ||
+        head.entry_size != sizeof(FrameIndexEntry)) {
+        logger::d("Ignoring the sidecar %s of another format", sidecar_path.c_str());
+        return 0;
+    }
+
+    if (head.file_size != stamp.size || head.file_mtime_ns != stamp.mtime_ns) {
+        logger::d("Ignoring the stale sidecar %s", sidecar_path.c_str());
+        return 0;
+    }
+
+    // a frame takes more than a byte of its file, which bounds what a corrupted count can allocate
+    if (head.n_frames > stamp.size) {
+        return 0;
+    }
+
+    index->frames.resize(head.n_frames);
+    if (fread(&index->header, sizeof(index->header), 1, file) != 1 ||
+        fread(index->frames.data(), sizeof(FrameIndexEntry), index->frames.size(), file) != index->frames.size()) {
+        logger::w("Ignoring the truncated sidecar %s", sidecar_path.c_str());
+        return 0;
+    }
+
+    return 1;
+}
+
+// Written to a temporary file renamed over the sidecar, so readers never see half of one.
+static int WriteSidecar(const char* path, const FileStamp& stamp, const FrameIndex& index) {
+    auto sidecar_path = GetSidecarPath(path);
+
+    auto tmp_path = TempPathFor(sidecar_path);
+
+    SidecarHead head {
+        .magic = {},
+        .version = FRAME_INDEX_SIDECAR_VERSION,
+        .header_size = sizeof(FrameIndexHeader),
+        .entry_size = sizeof(FrameIndexEntry),
+        .file_size = stamp.size,
+        .file_mtime_ns = stamp.mtime_ns,
+        .n_frames = index.frames.size()
+    };
+    memcpy(head.magic, FRAME_INDEX_SIDECAR_MAGIC, sizeof(head.magic));
+
+    auto file = fopen(tmp_path.c_str(), "wb");
+    checkf(file, "Cannot create %s", tmp_path.c_str());
+
+    auto ok = fwrite(&head, sizeof(head), 1, file) == 1 &&
+              fwrite(&index.header, sizeof(index.header), 1, file) == 1 &&
+              fwrite(index.frames.data(), sizeof(FrameIndexEntry), index.frames.size(), file) == index.frames.size();
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(tmp_path.c_str(), sidecar_path.c_str()) != 0) {
+        remove(tmp_path.c_str());
+        notreached("Cannot write %s", sidecar_path.c_str());
+    }
+
+    return 1;
+}
+
+// Least recently used indexes go first.
+struct FrameIndexCache {
+    typedef std::pair<std::string, std::shared_ptr<const FrameIndex>> Entry;
+
+    std::mutex mutex;
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> keys;
+
+    std::shared_ptr<const FrameIndex> Find(const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = keys.find(key);
+        if (it == keys.end()) {
+            return nullptr;
+        }
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+
+    void Insert(const std::string& key, std::shared_ptr<const FrameIndex> index) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = keys.find(key);
+        if (it != keys.end()) {
+            entries.erase(it->second);
+            keys.erase(it);
+        }
+
+        entries.emplace_front(key, std::move(index));
+        keys[key] = entries.begin();
+
+        while (entries.size() > FRAME_INDEX_CACHE_CAPACITY) {
+            keys.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+};
+
+static FrameIndexCache g_cache;
+
+static int GetFormat(const WebPData* data) {
+    return IsWebP(data) ? FRAME_INDEX_WEBP : (IsGIF(data) ? FRAME_INDEX_GIF : 0);
+}
+
+static int GetIndex(const WebPData* data, const char* path, int rebuild, std::shared_ptr<const FrameIndex>* index) {
+    require(data && data->bytes && index);
+
+    // only files are kept: a content hash would let crafted data collide with the index of other data
+    FileStamp stamp {};
+    auto has_stamp = path && GetFileStamp(path, &stamp) && stamp.size == data->size;
+    if (!has_stamp) {
+        auto built = std::make_shared<FrameIndex>();
+        check(FrameIndexBuild(data, built.get()));
+        *index = std::move(built);
+        return 1;
+    }
+
+    char key[64];
+    snprintf(key, sizeof(key), ":%llu:%lld", static_cast<unsigned long long>(stamp.size),
+             static_cast<long long>(stamp.mtime_ns));
+    auto cache_key = std::string(path) + key;
+
+    if (!rebuild) {
+        *index = g_cache.Find(cache_key);
+        if (*index) {
+            return 1;
+        }
+    }
+
+    auto built = std::make_shared<FrameIndex>();
+    auto read = !rebuild && t_sidecar_enabled && ReadSidecar(path, stamp, built.get());
+    if (read && built->header.format != GetFormat(data)) {
+        logger::d("Ignoring the sidecar of %s made for another format", path);
+        read = 0;
+    }
+    if (!read) {
+        check(FrameIndexBuild(data, built.get()));
+
+        if (t_sidecar_enabled && !WriteSidecar(path, stamp, *built)) {
+            logger::w("The frame index of %s is not kept for later runs", path);
+        }
+    }
+
+    g_cache.Insert(cache_key, built);
+    *index = std::move(built);
+    return 1;
+}
+
+int FrameIndexGet(const WebPData* data, const char* path, std::shared_ptr<const FrameIndex>* index) {
+    return GetIndex(data, path, 0, index);
+}
+
+int FrameIndexRebuild(const WebPData* data, const char* path, std::shared_ptr<const FrameIndex>* index) {
+    return GetIndex(data, path, 1, index);
+}
@@ -0,0 +1,99 @@
+#ifndef ANIMTOOL_FRAMEINDEX_H
+#define ANIMTOOL_FRAMEINDEX_H
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+struct WebPData;
+
+// Sidecars are written next to their file, named after it with this suffix.
+#define FRAME_INDEX_SIDECAR_SUFFIX ".fidx"
+
+typedef enum FrameIndexFormat {
+    FRAME_INDEX_WEBP = 1,
+    FRAME_INDEX_GIF = 2
+} FrameIndexFormat;
+
+typedef enum FrameDispose {
+    FRAME_DISPOSE_NONE,
+    FRAME_DISPOSE_BACKGROUND, // the frame rect is cleared to transparent
+    FRAME_DISPOSE_PREVIOUS    // the frame rect is restored to what it was before the frame
+} FrameDispose;
+
+// What the headers of an animation tell, without its pixels. Plain data, stored as is in sidecars.
+struct FrameIndexHeader {
+    int32_t format;         // FrameIndexFormat
+    int32_t canvas_width;
+    int32_t canvas_height;
+    uint32_t bgcolor;
+    int32_t has_loop_count;
+    int32_t loop_count;
+
+    // GIF only
+    int32_t gif_color_res;
+    int32_t gif_bgcolor_index;
+    int32_t gif_color_count; // of the global color map, 0 without one
+};
+
+struct FrameIndexEntry {
+    uint64_t offset;        // of the frame in the file: its GIF image descriptor, its WebP bitstream
+    uint64_t size;
+    int32_t x_offset;
+    int32_t y_offset;
+    int32_t width;
+    int32_t height;
+    int32_t start_ts;       // ms
+    int32_t end_ts;
+    int32_t dispose;        // FrameDispose
+    int32_t blend;          // 1 when drawn over the canvas, 0 when replacing it
+    int32_t has_alpha;      // GIF: has a transparent index
+    int32_t is_key_frame;   // the frame does not depend on the frames before it
+
+    // GIF only, as in the file
+    int32_t gif_dispose;
+    int32_t gif_transparent_index;
+    int32_t gif_interlace;
+    int32_t gif_color_count; // of the local color map, 0 without one
+};
+
+struct FrameIndex {
+    FrameIndexHeader header;
+    std::vector<FrameIndexEntry> frames;
+};
+
+// Builds the index of a WebP or GIF from its headers, skipping the image data.
+int FrameIndexBuild(const WebPData* data, FrameIndex* index);
+
+// Reads the header of the index of a WebP or GIF alone, without going through the frames. The loop count
+// of a GIF is only the one stored before its first image.
+int FrameIndexReadHeader(const WebPData* data, FrameIndexHeader* header);
+
+// The last key frame up to frame `i`, which must exist.
+int FrameIndexFindKeyFrame(const FrameIndex* index, int i);
+
+// The index of `data`, the content of the file at `path` when given. Indexes of files are kept in process
+// by path, size and mtime, and in sidecars when bound to; data without a path is indexed every time.
+// A file rewritten with the same size and mtime keeps its stale index: decoders check the frames they
+// use against the data, and replace an index found stale with FrameIndexRebuild.
+int FrameIndexGet(const WebPData* data, const char* path, std::shared_ptr<const FrameIndex>* index);
+// Same, always building the index from `data`, which replaces the one kept for `path`.
+int FrameIndexRebuild(const WebPData* data, const char* path, std::shared_ptr<const FrameIndex>* index);
+
+// While alive, the indexes of files got on the calling thread are read from their sidecar when it is
+// still valid, and written to it otherwise, so later processes skip the scan. A sidecar is valid while
+// its file keeps the size and mtime it was written for.
+class FrameIndexSidecarBinding {
+public:
+    explicit FrameIndexSidecarBinding(int enabled);
+    ~FrameIndexSidecarBinding();
+
+    FrameIndexSidecarBinding(const FrameIndexSidecarBinding&) = delete;
+    FrameIndexSidecarBinding& operator=(const FrameIndexSidecarBinding&) = delete;
+
+private:
+    int _outer;
+};
+
+#endif //ANIMTOOL_FRAMEINDEX_H
@@ -4,6 +4,8 @@
 
 #include "gifrun.h"
 #include "rawgif.h"
+#include "frameindex.h"
+#include "filemap.h"
 
 #include "webp/encode.h"
 #include "webp/mux.h"
@@ -16,9 +18,12 @@
 
 #include "gif_lib.h"
 
+#include <algorithm>
+
 #define GIF_TRANSPARENT_MASK  0x01
 #define GIF_DISPOSE_MASK      0x07
 #define GIF_DISPOSE_SHIFT     2
+#define GIF_IMAGE_INTRODUCER  0x2C  // first byte of an image descriptor record
 
 static int GIFReadRawGraphicsExtension(const GifByteType* const buf, int* const duration_ten_ms,
                                     int* const dispose,
@@ -48,7 +53,242 @@ static GIFDisposeMethod GIFDisposeMethodFromRaw(int dispose_raw) {
     }
 }
 
+// giflib input function reading straight from the caller's buffer
+struct GIFMemoryReader {
+    const uint8_t* bytes;
+    size_t size;
+    size_t pos;
+};
+
+static int GIFReadFromMemory(GifFileType* gif, GifByteType* dst, int len) {
+    auto reader = reinterpret_cast<GIFMemoryReader*>(gif->UserData);
+    auto n = std::min(static_cast<size_t>(len), reader->size - reader->pos);
+    memcpy(dst, reader->bytes + reader->pos, n);
+    reader->pos += n;
+    return static_cast<int>(n);
+}
+
+// Some broken GIFs report a 0 x 0 screen, fixed to the size of the first image, or have images of
+// 0 width or height, taken as the whole screen.
+static int GIFFixBrokenSizes(GifFileType* gif, int frame_number) {
+    GifImageDesc* const image_desc = &gif->Image;
+
+    if (frame_number == 0) {
+        logger::d("Canvas screen: %d x %d", gif->SWidth, gif->SHeight);
+    }
+    if (frame_number == 0 && (gif->SWidth == 0 || gif->SHeight == 0)) {
+        image_desc->Left = 0;
+        image_desc->Top = 0;
+        gif->SWidth = image_desc->Width;
+        gif->SHeight = image_desc->Height;
+        check(gif->SWidth > 0 && gif->SHeight > 0);
+
+        logger::w("broken GIF. Fixed canvas screen dimension to: %d x %d",
+               gif->SWidth, gif->SHeight);
+    }
+
+    if (image_desc->Width == 0 || image_desc->Height == 0) {
+        image_desc->Width = gif->SWidth;
+        image_desc->Height = gif->SHeight;
+    }
+
+    return 1;
+}
+
+// Moves past the LZW data of the current image without decompressing it.
+static int GIFSkipImageData(GifFileType* gif) {
+    int code_size;
+    GifByteType* block = NULL;
+    if (DGifGetCode(gif, &code_size, &block) == GIF_ERROR) {
+        return 0;
+    }
+    while (block != NULL) {
+        if (DGifGetCodeNext(gif, &block) == GIF_ERROR) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int GIFIsFullFrame(const GifImageDesc& desc, int canvas_width, int canvas_height) {
+    return desc.Left == 0 && desc.Top == 0 && desc.Width == canvas_width && desc.Height == canvas_height;
+}
+
+static FrameDispose FrameDisposeFromRaw(int dispose_raw) {
+    switch (GIFDisposeMethodFromRaw(dispose_raw)) {
+        case GIF_DISPOSE_BACKGROUND:
+            return FRAME_DISPOSE_BACKGROUND;
+        case GIF_DISPOSE_RESTORE_PREVIOUS:
+            return FRAME_DISPOSE_PREVIOUS;
+        default:
+            return FRAME_DISPOSE_NONE;
+    }
+}
+
+int GIFBuildFrameIndex(const WebPData* gif_data, int header_only, FrameIndex* index) {
+    int gif_error = 0;
+    GIFMemoryReader reader {
+        .bytes = gif_data->bytes,
+        .size = gif_data->size,
+        .pos = 0
+    };
+    auto gif = DGifOpen(&reader, GIFReadFromMemory, &gif_error);
+    if (gif == 0) {
+        log_gif_error("DGifOpen", gif_error);
+        return 0;
+    }
+
+    defer(
+        int gif_error = 0;
+        if (!DGifCloseFile(gif, &gif_error)) {
+            log_gif_error("DGifCloseFile", gif_error);
+        }
+    );
+
+    index->header = FrameIndexHeader {
+        .format = FRAME_INDEX_GIF,
+        .gif_color_res = gif->SColorResolution,
+        .gif_bgcolor_index = gif->SBackGroundColor,
+        .gif_color_count = gif->SColorMap ? gif->SColorMap->ColorCount : 0
+    };
+    index->frames.clear();
+
+    // graphic control extensions apply to the next image, as in GIFDecRunWithData
+    int duration_ten_ms = 0;
+    int dispose = DISPOSAL_UNSPECIFIED;
+    int transparent_index = GIF_INDEX_INVALID;
+    int timestamp_ms = 0;
+    int loop_count = 0;
+    int stored_loop_count = 0;
+
+    int done = 0;
+    while (!done) {
+        auto record_offset = reader.pos;
+
+        GifRecordType type;
+        check_gif(DGifGetRecordType(gif, &type), gif);
+
+        switch (type) {
+            case IMAGE_DESC_RECORD_TYPE: {
+                const GifImageDesc& desc = gif->Image;
+                auto frame_number = static_cast<int>(index->frames.size());
+
+                check_gif(DGifGetImageDesc(gif), gif);
+                check(GIFFixBrokenSizes(gif, frame_number));
+
+                if (frame_number == 0) {
+                    index->header.canvas_width = gif->SWidth;
+                    index->header.canvas_height = gif->SHeight;
+                    GIFGetBackgroundColor(gif->SColorMap, gif->SBackGroundColor, transparent_index,
+                                          &index->header.bgcolor);
+                }
+                if (header_only) {
+                    done = 1;
+                    break;
+                }
+
+                check_gif(GIFSkipImageData(gif), gif);
+
+                FrameIndexEntry entry {
+                    .offset = record_offset,
+                    .size = reader.pos - record_offset,
+                    .x_offset = desc.Left,
+                    .y_offset = desc.Top,
+                    .width = desc.Width,
+                    .height = desc.Height,
+                    .start_ts = timestamp_ms,
+                    .end_ts = timestamp_ms + duration_ten_ms * 10,
+                    .dispose = FrameDisposeFromRaw(dispose),
+                    .blend = 1,
+                    .has_alpha = transparent_index != GIF_INDEX_INVALID,
+                    .is_key_frame = 0,
+                    .gif_dispose = dispose,
+                    .gif_transparent_index = transparent_index,
+                    .gif_interlace = desc.Interlace,
+                    .gif_color_count = desc.ColorMap ? desc.ColorMap->ColorCount : 0
+                };
+
+                // Canvases start transparent and are cleared to transparent, so a frame does not depend on the
+                // ones before when it is the first, covers the canvas without transparency (and does not restore
+                // what was there), or follows a frame that left the canvas cleared.
+                const int canvas_width = index->header.canvas_width;
+                const int canvas_height = index->header.canvas_height;
+                if (frame_number == 0) {
+                    entry.is_key_frame = 1;
+                } else {
+                    const auto& prev = index->frames.back();
+                    auto prev_is_full = prev.x_offset == 0 && prev.y_offset == 0 &&
+                                        prev.width == canvas_width && prev.height == canvas_height;
+                    entry.is_key_frame =
+                            (!entry.has_alpha && entry.dispose != FRAME_DISPOSE_PREVIOUS &&
+                             GIFIsFullFrame(desc, canvas_width, canvas_height)) ||
+                            (prev.dispose == FRAME_DISPOSE_BACKGROUND && (prev_is_full || prev.is_key_frame));
+                }
+
+                index->frames.push_back(entry);
+                timestamp_ms = entry.end_ts;
+
+                duration_ten_ms = 0;
+                dispose = DISPOSAL_UNSPECIFIED;
+                transparent_index = GIF_INDEX_INVALID;
+                break;
+            }
+            case EXTENSION_RECORD_TYPE: {
+                int extension;
+                GifByteType* data = NULL;
+                check_gif(DGifGetExtension(gif, &extension, &data), gif);
+
+                if (data != NULL && extension == GRAPHICS_EXT_FUNC_CODE) {
+                    check_gif(GIFReadRawGraphicsExtension(data, &duration_ten_ms, &dispose, &transparent_index), gif);
+                } else if (data != NULL && extension == APPLICATION_EXT_FUNC_CODE && data[0] == 11 &&
+                           (!memcmp(data + 1, "NETSCAPE2.0", 11) || !memcmp(data + 1, "ANIMEXTS1.0", 11))) {
+                    check(GIFReadLoopCount(gif, &data, &loop_count));
+                    stored_loop_count = loop_count != 0;
+                }
+
+                while (data != NULL) {
+                    check_gif(DGifGetExtensionNext(gif, &data), gif);
+                }
+                break;
+            }
+            case TERMINATE_RECORD_TYPE: {
+                done = 1;
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+    }
+
+    index->header.has_loop_count = stored_loop_count;
+    index->header.loop_count = loop_count;
+
+    return 1;
+}
+
 int GIFDecRun(const char* file_path, void* ctx, AnimDecRunCallback callback) {
+    FileMap map;
+    checkf(FileMapOpen(file_path, &map), "The input file cannot be open %s", file_path);
+    defer(FileMapClose(&map));
+
+    return GIFDecRunWithData(&map.data, ctx, callback);
+}
+
+// Whether the image descriptor just read is the one `frame` was indexed from.
+static int GIFFrameMatches(const GifFileType* gif, const FrameIndexEntry& frame) {
+    const GifImageDesc& desc = gif->Image;
+    return desc.Left == frame.x_offset && desc.Top == frame.y_offset &&
+           desc.Width == frame.width && desc.Height == frame.height &&
+           desc.Interlace == frame.gif_interlace &&
+           (desc.ColorMap ? desc.ColorMap->ColorCount : 0) == frame.gif_color_count;
+}
+
+// With a `frame_index`, only frame `seek_index` is passed to on_frame: the reader starts at the last key
+// frame up to it, at the offset and with the graphic control of the index, and the run stops there.
+// `*stale` is set, before any callback, when the index does not match the data.
+static int GIFDecRunFrom(const WebPData* gif_data, const FrameIndex* frame_index, int seek_index, void* ctx,
+                         AnimDecRunCallback callback, int* stale) {
     logger::d("GIF Decode via giflib(%d.%d.%d)", GIFLIB_MAJOR, GIFLIB_MINOR, GIFLIB_RELEASE);
 
     GifFileType* gif = NULL;
@@ -94,9 +334,14 @@ int GIFDecRun(const char* file_path, void* ctx, AnimDecRunCallback callback) {
 
     // Start the decoder object
     int gif_error = 0;
-    gif = DGifOpenFileName(file_path, &gif_error);
+    GIFMemoryReader reader {
+        .bytes = gif_data->bytes,
+        .size = gif_data->size,
+        .pos = 0
+    };
+    gif = DGifOpen(&reader, GIFReadFromMemory, &gif_error);
     if (gif == 0) {
-        log_gif_error("DGifOpenFileName", gif_error);
+        log_gif_error("DGifOpen", gif_error);
         return 0;
     }
 
@@ -110,10 +355,54 @@ int GIFDecRun(const char* file_path, void* ctx, AnimDecRunCallback callback) {
 
     AnimInfo anim_info {};
     RawGifGlobalInfo raw_gif_global {};
+    int started = 0;
+
+    if (frame_index) {
+        const auto& header = frame_index->header;
+        const auto& frames = frame_index->frames;
+        auto n_frames = static_cast<int>(frames.size());
+
+        // the first frame still starts the run when there is no frame to seek to
+        auto key_index = seek_index < n_frames ? FrameIndexFindKeyFrame(frame_index, seek_index) : 0;
+
+        // broken screens of 0 x 0 get the size of their first image from GIFFixBrokenSizes, which only
+        // sees it when starting from it
+        auto broken_screen = gif->SWidth == 0 || gif->SHeight == 0;
+        if (broken_screen && key_index > 0) {
+            gif->SWidth = header.canvas_width;
+            gif->SHeight = header.canvas_height;
+            broken_screen = 0;
+        }
+        *stale = header.format != FRAME_INDEX_GIF ||
+                 (!broken_screen && (gif->SWidth != header.canvas_width || gif->SHeight != header.canvas_height));
+
+        if (!*stale && n_frames > 0) {
+            const auto& key = frames[key_index];
+            *stale = key.offset >= gif_data->size || gif_data->bytes[key.offset] != GIF_IMAGE_INTRODUCER;
+        }
+        if (*stale) {
+            return 1;
+        }
+        logger::d("Seek to frame %d from key frame %d", seek_index, key_index);
+
+        // the loop count may be anywhere in the file, the graphic control of the key frame is right before it
+        loop_count = header.loop_count;
+        stored_loop_count = header.has_loop_count;
+
+        if (n_frames > 0) {
+            const auto& key = frames[key_index];
+            reader.pos = key.offset;
+            frame_number = key_index;
+            frame_timestamp_ms = key.start_ts;
+            frame_duration_ten_ms = (key.end_ts - key.start_ts) / 10;
+            orig_dispose = key.gif_dispose;
+            transparent_index = key.gif_transparent_index;
+        }
+    }
 
     // Loop over GIF images
-    done = 0;
-    do {
+    done = frame_index && frame_index->frames.empty();
+    while (!done) {
         GifRecordType type;
         check_gif(DGifGetRecordType(gif, &type), gif);
 
@@ -123,21 +412,15 @@ int GIFDecRun(const char* file_path, void* ctx, AnimDecRunCallback callback) {
 
                 check_gif(DGifGetImageDesc(gif), gif);
 
-                if (frame_number == 0) {
-                    logger::d("Canvas screen: %d x %d", gif->SWidth, gif->SHeight);
-
-                    // Fix some broken GIF global headers that report
-                    // 0 x 0 screen dimension.
-                    if (gif->SWidth == 0 || gif->SHeight == 0) {
-                        image_desc->Left = 0;
-                        image_desc->Top = 0;
-                        gif->SWidth = image_desc->Width;
-                        gif->SHeight = image_desc->Height;
-                        check(gif->SWidth > 0 && gif->SHeight > 0);
-
-                        logger::w("broken GIF. Fixed canvas screen dimension to: %d x %d",
-                               gif->SWidth, gif->SHeight);
+                check(GIFFixBrokenSizes(gif, frame_number));
+
+                if (!started) {
+                    if (frame_index && !GIFFrameMatches(gif, frame_index->frames[frame_number])) {
+                        *stale = 1;
+                        return 1;
                     }
+                    started = 1;
+
                     // Allocate current buffer.
                     frame.width = gif->SWidth;
                     frame.height = gif->SHeight;
@@ -148,12 +431,16 @@ int GIFDecRun(const char* file_path, void* ctx, AnimDecRunCallback callback) {
                     check(WebPPictureCopy(&frame, &curr_canvas));
                     check(WebPPictureCopy(&frame, &prev_canvas));
 
-                    logger::d("GIFGetBackgroundColor tidx=%d", transparent_index);
+                    // Background color, picked with the transparent index of the first frame.
                     uint32_t bgcolor = 0;
-                    // Background color.
-                    GIFGetBackgroundColor(gif->SColorMap, gif->SBackGroundColor,
-                                          transparent_index,
-                                          &bgcolor);
+                    if (frame_index) {
+                        bgcolor = frame_index->header.bgcolor;
+                    } else {
+                        logger::d("GIFGetBackgroundColor tidx=%d", transparent_index);
+                        GIFGetBackgroundColor(gif->SColorMap, gif->SBackGroundColor,
+                                              transparent_index,
+                                              &bgcolor);
+                    }
 
                     raw_gif_global.color_res = gif->SColorResolution;
                     raw_gif_global.bgcolor_index = gif->SBackGroundColor;
@@ -169,12 +456,12 @@ int GIFDecRun(const char* file_path, void* ctx, AnimDecRunCallback callback) {
                     check(callback.on_start(ctx, &anim_info, &stop));
 
                     if (stop) { return 1;}
-                }
 
-                // Some even more broken GIF can have sub-rect with zero width/height.
-                if (image_desc->Width == 0 || image_desc->Height == 0) {
-                    image_desc->Width = gif->SWidth;
-                    image_desc->Height = gif->SHeight;
+                    // no such frame: the run ends without any
+                    if (frame_index && seek_index >= static_cast<int>(frame_index->frames.size())) {
+                        done = 1;
+                        break;
+                    }
                 }
 
                 GIFFrameRect gif_rect{};
@@ -207,7 +494,12 @@ int GIFDecRun(const char* file_path, void* ctx, AnimDecRunCallback callback) {
                 anim_frame.raw_gif = &raw_gif_local;
 
                 int stop = 0;
-                check(callback.on_frame(ctx, &anim_frame, frame_timestamp_ms, frame_timestamp_ms + frame_duration_ten_ms * 10, &stop));
+                if (seek_index < 0 || frame_number == seek_index) {
+                    check(callback.on_frame(ctx, &anim_frame, frame_timestamp_ms, frame_timestamp_ms + frame_duration_ten_ms * 10, &stop));
+                }
+                if (frame_number == seek_index) {
+                    stop = 1;
+                }
                 ++frame_number;
                 frame_timestamp_ms += frame_duration_ten_ms * 10;
 
@@ -296,7 +588,7 @@ int GIFDecRun(const char* file_path, void* ctx, AnimDecRunCallback callback) {
                 break;
             }
         }
-    } while (!done);
+    }
 
     if (!loop_compatibility) {
         if (!stored_loop_count) {
@@ -320,4 +612,14 @@ int GIFDecRun(const char* file_path, void* ctx, AnimDecRunCallback callback) {
     return 1;
 }
 
+int GIFDecRunWithData(const WebPData* gif_data, void* ctx, AnimDecRunCallback callback) {
+    return GIFDecRunFrom(gif_data, nullptr, -1, ctx, callback, nullptr);
+}
+
+int GIFDecRunFrameWithData(const WebPData* gif_data, const FrameIndex* frame_index, int index, void* ctx,
+                           AnimDecRunCallback callback, int* stale) {
+    require(frame_index && index >= 0 && stale);
 
+    *stale = 0;
+    return GIFDecRunFrom(gif_data, frame_index, index, ctx, callback, stale);
+}
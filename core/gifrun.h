@@ -11,7 +11,22 @@
 extern "C" {
 #endif
 
+typedef struct WebPData WebPData;
+struct FrameIndex;
+
 int GIFDecRun(const char* file_path, void* ctx, AnimDecRunCallback callback);
+int GIFDecRunWithData(const WebPData* gif_data, void* ctx, AnimDecRunCallback callback);
+
+// Runs the callback on frame `index` only. Reading starts at the last key frame up to it, found in
+// `frame_index` with its offset in the file: the frames before are not read. Without such a frame,
+// on_frame is not called.
+// When `frame_index` is not that of `gif_data`, sets `*stale` and returns without calling back.
+int GIFDecRunFrameWithData(const WebPData* gif_data, const struct FrameIndex* frame_index, int index, void* ctx,
+                           AnimDecRunCallback callback, int* stale);
+
+// Builds the index of `gif_data`, or only its header when `header_only` is set, which reads up to the first
+// image descriptor: the canvas of broken screens and the background color depend on the first frame.
+int GIFBuildFrameIndex(const WebPData* gif_data, int header_only, struct FrameIndex* index);
 
 #ifdef __cplusplus
 }
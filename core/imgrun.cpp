@@ -1,8 +1,8 @@
 
 #include "imgrun.h"
+#include "filemap.h"
 
 #include "../imageio/image_enc.h"
-#include "../imageio/imageio_util.h"
 #include "../imageio/image_dec.h"
 #include "webp/encode.h"
 #include "webp/demux.h"
@@ -11,13 +11,11 @@
 #include "utils/defer.h"
 
 int ImgDecRun(const char* file_path, void* ctx, AnimDecRunCallback callback) {
-    WebPData webp_data;
-    WebPDataInit(&webp_data);
-    defer(WebPDataClear(&webp_data));
+    FileMap map;
+    check(FileMapOpen(file_path, &map));
+    defer(FileMapClose(&map));
 
-    check(ImgIoUtilReadFile(file_path, &webp_data.bytes, &webp_data.size));
-
-    return ImgDecRunWithData(&webp_data, ctx, callback);
+    return ImgDecRunWithData(&map.data, ctx, callback);
 }
 
 int ImgDecRunWithData(WebPData* webp_data, void* ctx, AnimDecRunCallback callback) {
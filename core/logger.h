@@ -12,10 +12,41 @@ namespace logger {
         LOG_ERROR        
     };
 
-    inline Level level = LOG_INFO;
+    inline Level level = LOG_INFO; // of the process, set before any thread starts
+    inline thread_local int job_level = -1; // of the job running on the thread, -1 outside of jobs
+
+    static inline Level GetLevel() {
+        return job_level >= 0 ? static_cast<Level>(job_level) : level;
+    }
+
+    // Sets the level of the job running on the calling thread, or of the process outside of jobs.
+    static inline void SetLevel(Level l) {
+        if (job_level >= 0) {
+            job_level = l;
+        } else {
+            level = l;
+        }
+    }
+
+    // While alive, the calling thread runs a job: its level starts from the one of the process, and
+    // SetLevel only changes it for the thread. Threads started by the job log at the process level.
+    struct JobLevelScope {
+        int outer;
+
+        JobLevelScope(): outer(job_level) {
+            job_level = GetLevel();
+        }
+
+        ~JobLevelScope() {
+            job_level = outer;
+        }
+
+        JobLevelScope(const JobLevelScope&) = delete;
+        JobLevelScope& operator=(const JobLevelScope&) = delete;
+    };
 
     static inline void vprint(Level l, const char* format, va_list ap) {
-        if (l < level) return;
+        if (l < GetLevel()) return;
 
         char buf[1024] = {};
         int n = vsnprintf(buf, sizeof(buf), format, ap);
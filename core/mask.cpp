@@ -22,9 +22,11 @@ struct Context {
     int total_duration_so_far;
 
     const char* output;
+    AnimEncoderBuffer* output_buffer; // instead of output
     const char* format;
     // global: WebPAnimEncoderOptions
     int minimize_size;
+    int global_palette;
     int verbose;
 
     // per-frame: WebPConfig
@@ -47,9 +49,12 @@ static int OnStart(void* ctx, const AnimInfo* info, int* stop) {
     AnimEncoderOptions encoder_options {
             .verbose = thiz->verbose,
             .minimize_size = thiz->minimize_size,
+            .global_palette = thiz->global_palette,
             .bgcolor = info->bgcolor
     };
-    auto encoder = AnimEncoderNew(thiz->format, info->canvas_width, info->canvas_height, &encoder_options);
+    auto encoder = thiz->output_buffer ?
+            AnimEncoderNewWithBuffer(thiz->format, info->canvas_width, info->canvas_height, &encoder_options, thiz->output_buffer) :
+            AnimEncoderNewWithFile(thiz->format, info->canvas_width, info->canvas_height, &encoder_options, thiz->output);
     check(encoder);
     thiz->encoder = encoder;
 
@@ -84,9 +89,11 @@ static int OnFrame(void* ctx, const AnimFrame* frame, int start_ts, int end_ts,
 
 static int OnEnd(void* ctx, const AnimInfo* anim_info) {
     auto thiz = reinterpret_cast<Context*>(ctx);
-    defer(AnimEncoderDelete(thiz->encoder));
+    auto encoder = thiz->encoder;
+    thiz->encoder = nullptr;
+    defer(AnimEncoderDelete(encoder));
 
-    check(AnimEncoderExport(thiz->encoder, thiz->total_duration_so_far, anim_info->loop_count, thiz->output));
+    check(AnimEncoderFinish(encoder, thiz->total_duration_so_far, anim_info->loop_count));
 
     return 1;
 }
@@ -101,16 +108,21 @@ static AnimDecRunCallback kRunCallback {
 
 
 
-int AnimToolMask(
+// Decodes input_data when it is given, input otherwise, and encodes into output_buffer
+// when it is given, into the output file otherwise.
+static int Mask(
         const char* input,
-        const char* mask_path,
+        const WebPData* input_data,
+        WebPPicture* mask,
         int fit,
-        int x, int y, // ignored if center == 1
+        int x, int y,
 
         const char* output,
+        AnimEncoderBuffer* output_buffer,
         const char* format,
         // global: WebPAnimEncoderOptions
         int minimize_size,
+        int global_palette,
         int verbose,
 
         // per-frame: WebPConfig
@@ -119,31 +131,90 @@ int AnimToolMask(
         int method,
         int pass
 ) {
-
-    WebPPicture mask;
-    check(WebPPictureInit(&mask));
-    defer(WebPPictureFree(&mask));
-    check(PicInitWithFile(&mask, mask_path));
-
-
     Context ctx{
-            .mask = &mask,
+            .mask = mask,
             .fit = fit,
             .point = cg::Point {
                     .x = x,
                     .y = y
             },
             .output = output,
+            .output_buffer = output_buffer,
             .format = format,
             .minimize_size = minimize_size,
+            .global_palette = global_palette,
             .verbose = verbose,
             .lossless = lossless,
             .quality = quality,
             .method = method,
             .pass = pass,
     };
+    // a run stopped before its end leaves its encoder, and the output is discarded with it
+    defer(if (ctx.encoder) AnimEncoderDelete(ctx.encoder); );
 
-    check(DecRun(input, &ctx, kRunCallback));
+    if (input_data) {
+        check(DecRunWithData(input_data, &ctx, kRunCallback));
+    } else {
+        check(DecRun(input, &ctx, kRunCallback));
+    }
 
     return 1;
+}
+
+int AnimToolMask(
+        const char* input,
+        const char* mask_path,
+        int fit,
+        int x, int y, // ignored if center == 1
+
+        const char* output,
+        const char* format,
+        // global: WebPAnimEncoderOptions
+        int minimize_size,
+        int global_palette,
+        int verbose,
+
+        // per-frame: WebPConfig
+        int lossless,
+        float quality,
+        int method,
+        int pass
+) {
+    WebPPicture mask;
+    check(WebPPictureInit(&mask));
+    defer(WebPPictureFree(&mask));
+    check(PicInitWithFile(&mask, mask_path));
+
+    return Mask(input, nullptr, &mask, fit, x, y, output, nullptr, format,
+                minimize_size, global_palette, verbose, lossless, quality, method, pass);
+}
+
+int AnimToolMaskWithData(
+        const WebPData* input,
+        const WebPData* mask_data,
+        int fit,
+        int x, int y, // ignored if center == 1
+
+        AnimEncoderBuffer* output,
+        const char* format,
+        // global: WebPAnimEncoderOptions
+        int minimize_size,
+        int global_palette,
+        int verbose,
+
+        // per-frame: WebPConfig
+        int lossless,
+        float quality,
+        int method,
+        int pass
+) {
+    require(input && output);
+
+    WebPPicture mask;
+    check(WebPPictureInit(&mask));
+    defer(WebPPictureFree(&mask));
+    check(PicInitWithData(&mask, mask_data));
+
+    return Mask(nullptr, input, &mask, fit, x, y, nullptr, output, format,
+                minimize_size, global_palette, verbose, lossless, quality, method, pass);
 }
\ No newline at end of file
@@ -5,6 +5,9 @@
 #ifndef ANIMTOOL_MASK_H
 #define ANIMTOOL_MASK_H
 
+typedef struct WebPData WebPData;
+typedef struct AnimEncoderBuffer AnimEncoderBuffer;
+
 
 int AnimToolMask(
         const char* input,
@@ -16,6 +19,28 @@ int AnimToolMask(
         const char* format,
         // global: WebPAnimEncoderOptions
         int minimize_size,
+        int global_palette,
+        int verbose,
+
+        // per-frame: WebPConfig
+        int lossless,
+        float quality,
+        int method,
+        int pass
+);
+
+// Same as above, with the input and the mask in memory. The output is appended to `output`.
+int AnimToolMaskWithData(
+        const WebPData* input,
+        const WebPData* mask_data,
+        int fit,
+        int x, int y, // ignored if center == 1
+
+        AnimEncoderBuffer* output,
+        const char* format,
+        // global: WebPAnimEncoderOptions
+        int minimize_size,
+        int global_palette,
         int verbose,
 
         // per-frame: WebPConfig
@@ -54,8 +54,10 @@ static AnimDecRunCallback kRunCallback {
         .on_end = OnEnd
 };
 
-int AnimToolGetOpacity(
+// Decodes image_data when it is given, image_path otherwise.
+static int GetOpacity(
         const char*const image_path,
+        const WebPData* image_data,
         int sample_divider,
         float* out_opacity
 ) {
@@ -63,7 +65,11 @@ int AnimToolGetOpacity(
             .sample_divider = sample_divider
     };
 
-    check(DecRun(image_path, &ctx, kRunCallback));
+    if (image_data) {
+        check(DecRunWithData(image_data, &ctx, kRunCallback));
+    } else {
+        check(DecRun(image_path, &ctx, kRunCallback));
+    }
 
     if (ctx.n_samples == 0) {
         *out_opacity = 0;
@@ -73,3 +79,20 @@ int AnimToolGetOpacity(
 
     return 1;
 }
+
+int AnimToolGetOpacity(
+        const char*const image_path,
+        int sample_divider,
+        float* out_opacity
+) {
+    return GetOpacity(image_path, nullptr, sample_divider, out_opacity);
+}
+
+int AnimToolGetOpacityWithData(
+        const WebPData* image_data,
+        int sample_divider,
+        float* out_opacity
+) {
+    require(image_data);
+    return GetOpacity(nullptr, image_data, sample_divider, out_opacity);
+}
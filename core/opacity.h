@@ -10,6 +10,8 @@
 extern "C" {
 #endif
 
+typedef struct WebPData WebPData;
+
 
 int AnimToolGetOpacity(
         const char*const image_path,
@@ -17,6 +19,13 @@ int AnimToolGetOpacity(
         float* out_opacity
 );
 
+// Same as above, with the image in memory.
+int AnimToolGetOpacityWithData(
+        const WebPData* image_data,
+        int sample_divider,
+        float* out_opacity
+);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,134 @@
+#include "piccache.h"
+
+#include "picutils.h"
+#include "filemap.h"
+#include "trace.h"
+
+#include "webp/encode.h" // WebPPicture
+#include "webp/mux_types.h" // WebPData
+
+#include "check.h"
+#include "utils/defer.h"
+#include "utils/hash.h"
+
+#include <cstring>
+
+static size_t GetPicBytes(const WebPPicture* pic) {
+    return static_cast<size_t>(pic->argb_stride) * pic->height * sizeof(uint32_t);
+}
+
+PicCache::PicCache(size_t max_bytes): _max_bytes(max_bytes), _bytes(0) {}
+
+int PicCache::Load(WebPPicture* pic, const WebPData* data) {
+    require(data && data->bytes);
+
+    // only picks the slot: hits are confirmed by comparing the sources
+    auto hash = HashBytes(data->bytes, data->size);
+    auto cached = Find(hash, data);
+    if (cached) {
+        TraceScope trace("pic_cache_hit");
+        WebPPictureFree(pic);
+        check(WebPPictureCopy(cached.get(), pic));
+        return 1;
+    }
+
+    check(PicInitWithData(pic, data));
+    Insert(hash, data, pic);
+    return 1;
+}
+
+int PicCache::LoadFile(WebPPicture* pic, const char* path) {
+    FileMap map;
+    {
+        TraceScope trace("open_input");
+        check(FileMapOpen(path, &map));
+    }
+    defer(FileMapClose(&map));
+
+    return Load(pic, &map.data);
+}
+
+void PicCache::SetMaxBytes(size_t max_bytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _max_bytes = max_bytes;
+    Evict(_max_bytes);
+}
+
+size_t PicCache::GetBytes() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _bytes;
+}
+
+std::shared_ptr<WebPPicture> PicCache::Find(uint64_t hash, const WebPData* data) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _index.find(hash);
+    if (it == _index.end()) {
+        return nullptr;
+    }
+
+    auto& entry = *it->second;
+    if (entry.source.size() != data->size || memcmp(entry.source.data(), data->bytes, data->size) != 0) {
+        return nullptr;
+    }
+
+    _entries.splice(_entries.begin(), _entries, it->second);
+    return entry.pic;
+}
+
+// Entries are copied outside of the lock; a picture too large for the cache is not kept.
+void PicCache::Insert(uint64_t hash, const WebPData* data, const WebPPicture* pic) {
+    auto bytes = GetPicBytes(pic) + data->size;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (bytes > _max_bytes) {
+            return;
+        }
+    }
+
+    std::shared_ptr<WebPPicture> copy(new WebPPicture, [](WebPPicture* p) {
+        WebPPictureFree(p);
+        delete p;
+    });
+    if (!WebPPictureInit(copy.get()) || !WebPPictureCopy(pic, copy.get())) {
+        return;
+    }
+
+    Entry entry {
+        .hash = hash,
+        .source = std::vector<uint8_t>(data->bytes, data->bytes + data->size),
+        .pic = std::move(copy),
+        .bytes = bytes
+    };
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (bytes > _max_bytes) {
+        return;
+    }
+
+    auto it = _index.find(hash);
+    if (it != _index.end()) {
+        // same content decoded by another thread meanwhile, or a hash collision: keep the latest
+        _bytes -= it->second->bytes;
+        _entries.erase(it->second);
+        _index.erase(it);
+    }
+
+    Evict(_max_bytes - bytes);
+    _entries.push_front(std::move(entry));
+    _index[hash] = _entries.begin();
+    _bytes += bytes;
+}
+
+void PicCache::Evict(size_t max_bytes) {
+    while (_bytes > max_bytes && !_entries.empty()) {
+        auto& entry = _entries.back();
+        _bytes -= entry.bytes;
+        _index.erase(entry.hash);
+        _entries.pop_back();
+    }
+}
+
+PicCache* PicCacheGetShared() {
+    static PicCache cache(PIC_CACHE_DEFAULT_MAX_BYTES);
+    return &cache;
+}
@@ -0,0 +1,57 @@
+#ifndef ANIMTOOL_PICCACHE_H
+#define ANIMTOOL_PICCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct WebPPicture;
+struct WebPData;
+
+#define PIC_CACHE_DEFAULT_MAX_BYTES (256u << 20)
+
+// Decoded still images keyed by the content of their source, so the same image is decoded once,
+// whether a job uses it twice or jobs of a long lived process share it. Sources are kept to confirm
+// matches. Past `max_bytes` of pictures and sources, the least recently used go first. Thread safe.
+class PicCache {
+public:
+    explicit PicCache(size_t max_bytes);
+
+    PicCache(const PicCache&) = delete;
+    PicCache& operator=(const PicCache&) = delete;
+
+    // Same as PicInitWithData and PicInitWithFile. `pic` gets its own copy of the pixels.
+    int Load(WebPPicture* pic, const WebPData* data);
+    int LoadFile(WebPPicture* pic, const char* path);
+
+    void SetMaxBytes(size_t max_bytes);
+    size_t GetBytes();
+
+private:
+    struct Entry {
+        uint64_t hash;
+        std::vector<uint8_t> source;
+        std::shared_ptr<WebPPicture> pic;
+        size_t bytes;
+    };
+
+    std::shared_ptr<WebPPicture> Find(uint64_t hash, const WebPData* data);
+    void Insert(uint64_t hash, const WebPData* data, const WebPPicture* pic);
+    void Evict(size_t max_bytes); // with _mutex held
+
+    std::mutex _mutex;
+    size_t _max_bytes;
+    size_t _bytes;
+    std::list<Entry> _entries; // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> _index;
+};
+
+// The cache shared by every job of the process, PIC_CACHE_DEFAULT_MAX_BYTES unless set.
+PicCache* PicCacheGetShared();
+
+#endif //ANIMTOOL_PICCACHE_H
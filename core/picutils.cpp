@@ -5,8 +5,10 @@
 #include "picutils.h"
 
 #include "blurutils.h"
+#include "filemap.h"
+#include "stagetime.h"
+#include "trace.h"
 
-#include "../imageio/imageio_util.h"
 #include "../imageio/image_dec.h"
 #include "webp/encode.h"
 #include "webp/demux.h"
@@ -15,9 +17,11 @@
 #include "check.h"
 #include "utils/defer.h"
 
+#include <algorithm>
 #include <cmath>
 
 void PicClear(WebPPicture* pic, cg::Color color) {
+    StageScope scope(STAGE_COMPOSE);
 
     for (int y=0; y<pic->height; ++y) {
         auto argb_line = pic->argb + pic->argb_stride * y;
@@ -28,6 +32,7 @@ void PicClear(WebPPicture* pic, cg::Color color) {
 }
 
 void PicTint(WebPPicture* pic, cg::Color color) {
+    StageScope scope(STAGE_COMPOSE);
     for (int y=0; y<pic->height; ++y) {
         auto argb_line = pic->argb + pic->argb_stride * y;
         for (int x=0; x<pic->width; ++x) {
@@ -38,39 +43,38 @@ void PicTint(WebPPicture* pic, cg::Color color) {
 }
 
 
-int PicMerge(WebPPicture* dst, const WebPPicture* src, cg::Point point, cg::Color (*Merger)( const cg::Color&,  const cg::Color&)) {
-    checkf(point.x + src->width <= dst->width, "Invalid geometry point.x=%d, src->width=%d, dst->width=%d", point.x, src->width, dst->width);
-    checkf(point.y + src->height <= dst->height, "Invalid geometry point.y=%d, src->height=%d, dst->height=%d", point.y, src->height, dst->height);
+int PicMerge(WebPPicture* dst, const WebPPicture* src, cg::Point point, CompositeMode mode) {
+    StageScope scope(STAGE_COMPOSE);
 
     const size_t src_stride = src->argb_stride;
     const size_t dst_stride = dst->argb_stride;
 
+    // the part of src that lands on dst
+    int left = std::max(point.x, 0);
+    int top = std::max(point.y, 0);
+    int right = std::min(point.x + src->width, dst->width);
+    int bottom = std::min(point.y + src->height, dst->height);
+    if (left >= right || top >= bottom) {
+        left = right = top = bottom = 0;
+    }
 
-    for (int y=0; y<dst->height; ++y) {
-        for (int x=0; x<dst->width; ++x) {
-
-            auto dst_pixel = dst->argb[y * dst_stride + x];
-            uint32_t src_pixel = 0;
-            if (point.y <= y && y<point.y + src->height && point.x <= x && x<point.x + src->width) {
-
-                auto src_x = x - point.x;
-                auto src_y = y - point.y;
-                src_pixel = src->argb[src_y * src_stride + src_x];
+    // merging with transparent leaves dst as is, except that a mask clears it
+    if (mode == COMPOSITE_MASK) {
+        for (int y=0; y<dst->height; ++y) {
+            auto dst_line = dst->argb + y * dst_stride;
+            if (y < top || y >= bottom) {
+                CompositeRow(dst_line, nullptr, dst->width, mode);
+            } else {
+                CompositeRow(dst_line, nullptr, left, mode);
+                CompositeRow(dst_line + right, nullptr, dst->width - right, mode);
             }
-
-            dst->argb[y * dst_stride + x] = Merger(cg::Color::FromARGB(dst_pixel), cg::Color::FromARGB(src_pixel)).ToARGB();
         }
     }
 
-    for (int y=0; y<src->height; ++y) {
-        for (int x=0; x<src->width; ++x) {
-            auto src_pixel = src->argb[y * src_stride + x];
-            auto dst_x = x + point.x;
-            auto dst_y = y + point.y;
-            auto dst_pixel = dst->argb[dst_y * dst_stride + dst_x];
-
-            dst->argb[dst_y * dst_stride + dst_x] = Merger(cg::Color::FromARGB(dst_pixel), cg::Color::FromARGB(src_pixel)).ToARGB();
-        }
+    for (int y=top; y<bottom; ++y) {
+        CompositeRow(dst->argb + y * dst_stride + left,
+                     src->argb + (y - point.y) * src_stride + (left - point.x),
+                     right - left, mode);
     }
 
     return 1;
@@ -78,13 +82,13 @@ int PicMerge(WebPPicture* dst, const WebPPicture* src, cg::Point point, cg::Colo
 
 int PicDraw(WebPPicture* dst, const WebPPicture* src, cg::Point point, int over) {
     if (over)
-        return PicMerge(dst, src, point, cg::Blend);
+        return PicMerge(dst, src, point, COMPOSITE_OVER);
     else
-        return PicMerge(dst, src, point, cg::RevBlend);
+        return PicMerge(dst, src, point, COMPOSITE_UNDER);
 }
 
 int PicMask(WebPPicture* dst, const WebPPicture* mask, cg::Point point) {
-    return PicMerge(dst, mask, point, cg::Mask);
+    return PicMerge(dst, mask, point, COMPOSITE_MASK);
 }
 
 
@@ -96,7 +100,10 @@ int PicDrawOverFit(WebPPicture* dst, WebPPicture* src, int over) {
     );
 
     logger::d("fit_rect %d:%d:%d:%d", fit_rect.origin.x, fit_rect.origin.y, fit_rect.size.width, fit_rect.size.height);
-    check(WebPPictureRescale(src, fit_rect.size.width, fit_rect.size.height));
+    {
+        StageScope scope(STAGE_RESCALE);
+        check(WebPPictureRescale(src, fit_rect.size.width, fit_rect.size.height));
+    }
     check(PicDraw(dst, src, fit_rect.origin, over));
 
     return 1;
@@ -107,6 +114,8 @@ int PicFill(WebPPicture* pic, cg::Size dst) {
         return 1;
     }
 
+    StageScope scope(STAGE_RESCALE);
+
     auto rv_fit_rect = cg::FitTo(
             cg::Size {.width = pic->width, .height = pic->height},
             cg::Size {.width = dst.width, .height = dst.height}
@@ -121,23 +130,32 @@ int PicFill(WebPPicture* pic, cg::Size dst) {
             dst
     );
 
+    StageScope crop_scope(STAGE_CROP);
     check(WebPPictureCrop(pic, crop_rect.Left(), crop_rect.Top(), dst.width, dst.height));
 
     return 1;
 }
 
 int PicInitWithFile(WebPPicture* pic, const char* path) {
+    FileMap map;
+    {
+        TraceScope trace("open_input");
+        check(FileMapOpen(path, &map));
+    }
+    defer(FileMapClose(&map));
 
-    WebPData data;
-    WebPDataInit(&data);
-    defer(WebPDataClear(&data));
+    return PicInitWithData(pic, &map.data);
+}
+
+int PicInitWithData(WebPPicture* pic, const WebPData* data) {
+    require(data && data->bytes);
 
-    check(ImgIoUtilReadFile(path, &data.bytes, &data.size));
+    StageScope scope(STAGE_DECODE);
 
-    auto reader = WebPGuessImageReader(data.bytes, data.size);
+    auto reader = WebPGuessImageReader(data->bytes, data->size);
 
     pic->use_argb = 1;
-    check(reader(data.bytes, data.size, pic, 1, NULL));
+    check(reader(data->bytes, data->size, pic, 1, NULL));
 
     return 1;
 }
@@ -145,38 +163,23 @@ int PicInitWithFile(WebPPicture* pic, const char* path) {
 
 
 
-void PicToRGB(WebPPicture* pic, unsigned char* rgb) {
-    for (int y=0; y<pic->height; ++y) {
-        for (int x=0; x<pic->width; ++x) {
-            auto color = cg::Color::FromARGB(pic->argb[y * pic->argb_stride + x]);
-            auto pix = (y * pic->width + x) * 3;
-            rgb[pix] = color.r;
-            rgb[pix + 1] = color.g;
-            rgb[pix + 2] = color.b;
-        }
+// Blur radii used to size a kernel weighting offset k by (radius - |k|)^2. Returns the standard deviation
+// of that kernel, so the box approximation looks the same at the same radius.
+static float BlurRadiusToSigma(int radius) {
+    double sum = 0;
+    double sum_k2 = 0;
+    for (int k=1-radius; k<radius; ++k) {
+        double weight = static_cast<double>(radius - std::abs(k)) * (radius - std::abs(k));
+        sum += weight;
+        sum_k2 += weight * k * k;
     }
+    return sum > 0 ? static_cast<float>(std::sqrt(sum_k2 / sum)) : 0;
 }
 
-void RGBToPic(unsigned char* rgb, WebPPicture* pic) {
-    for (int y=0; y<pic->height; ++y) {
-        for (int x=0; x<pic->width; ++x) {
-            auto color = cg::Color::FromARGB(pic->argb[y * pic->argb_stride + x]);
-            auto pix = (y * pic->width + x) * 3;
-            pic->argb[y * pic->argb_stride + x] = cg::Color(rgb[pix], rgb[pix + 1], rgb[pix + 2], color.a).ToARGB();
-        }
-    }
-}
-
-
-int PicBlur(WebPPicture* pic, int radius) {
-    auto rgb = reinterpret_cast<unsigned char*>(malloc(pic->width * pic->height * 3));
-    check(rgb);
-    defer(free(rgb));
+int PicBlur(WebPPicture* pic, int radius, int blur_alpha, std::vector<uint8_t>* scratch) {
+    StageScope scope(STAGE_BLUR);
+    require(pic->use_argb && pic->argb);
 
-    PicToRGB(pic, rgb);
-    GaussianBlur(rgb, pic->width, pic->height, 3, radius);
-    //superFastBlur(rgb, pic->width, pic->height, 5);
-    RGBToPic(rgb, pic);
-
-    return 1;
+    return BoxGaussianBlurARGB(pic->argb, pic->width, pic->height, pic->argb_stride, blur_alpha,
+                               BlurRadiusToSigma(radius), scratch);
 }
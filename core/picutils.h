@@ -6,12 +6,21 @@
 #define ANIMTOOL_PICUTILS_H
 
 #include "cg.h"
+#include "composite.h"
+
+#include <stdint.h>
+
+#include <vector>
 
 struct WebPPicture;
+struct WebPData;
 
 void PicClear(WebPPicture* pic, cg::Color color);
 void PicTint(WebPPicture* pic, cg::Color color);
 
+// Merges `src` drawn at `point` into `dst`, row span by row span. src may extend past the edges of dst.
+// Over and under only touch the pixels under src, a mask also makes the rest of dst transparent.
+int PicMerge(WebPPicture* dst, const WebPPicture* src, cg::Point point, CompositeMode mode);
 int PicDraw(WebPPicture* dst, const WebPPicture* src, cg::Point point, int over);
 int PicMask(WebPPicture* dst, const WebPPicture* mask, cg::Point point);
 int PicDrawOverFit(WebPPicture* dst, WebPPicture* src, int over);
@@ -19,8 +28,10 @@ int PicDrawOverFit(WebPPicture* dst, WebPPicture* src, int over);
 int PicFill(WebPPicture* pic, cg::Size dst);
 
 int PicInitWithFile(WebPPicture* pic, const char* path);
+int PicInitWithData(WebPPicture* pic, const WebPData* data);
 
-int PicBlur(WebPPicture* pic, int radius);
+// Blurs the ARGB pixels in place. Alpha is kept unless `blur_alpha`. `scratch` is optional, see BoxGaussianBlur.
+int PicBlur(WebPPicture* pic, int radius, int blur_alpha, std::vector<uint8_t>* scratch);
 
 
 #endif //ANIMTOOL_PICUTILS_H
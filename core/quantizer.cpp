@@ -32,6 +32,7 @@
 
 #include "quantizer.h"
 #include "check.h"
+#include "utils/parallel.h"
 #include <cstdlib>
 #include <cstring>
 
@@ -52,6 +53,20 @@
 
 #define MAXCOLOR	256
 
+// Minimum number of pixels worth a band of its own when building the histogram:
+// each band costs a pass over its histogram when the bands are merged
+#define MIN_PIXELS_PER_BAND	131072
+
+// Squares table, so that c^2 moments don't need any multiplication
+static const struct SquareTable {
+	int values[256];
+
+	SquareTable() {
+		for(int i = 0; i < 256; i++)
+			values[i] = i * i;
+	}
+} squares;
+
 // Constructor / Destructor
 
 int
@@ -62,6 +77,7 @@ WuQuantizer::Init(int w, int h) {
 	gm2 = NULL;
 	wt = mr = mg = mb = NULL;
 	Qadd = NULL;
+	tag = NULL;
 
 	// Allocate 3D arrays
 	gm2 = (float*)malloc(SIZE_3D * sizeof(float));
@@ -100,6 +116,7 @@ WuQuantizer::~WuQuantizer() {
 	if(mg)	free(mg);
 	if(mb)	free(mb);
 	if(Qadd)  free(Qadd);
+	if(tag)	free(tag);
 }
 
 
@@ -119,11 +136,8 @@ WuQuantizer::AddPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
 void
 WuQuantizer::Hist3DAddPixel(LONG *vwt, LONG *vmr, LONG *vmg, LONG *vmb, float *m2, int x, int y, uint8_t r, uint8_t g, uint8_t b) {
 	int ind = 0;
-	int inr, ing, inb, table[256];
-	int i;
-
-	for(i = 0; i < 256; i++)
-		table[i] = i * i;
+	int inr, ing, inb;
+	const int *table = squares.values;
 
 	inr = (r >> 3) + 1;
 	ing = (g >> 3) + 1;
@@ -139,6 +153,97 @@ WuQuantizer::Hist3DAddPixel(LONG *vwt, LONG *vmr, LONG *vmg, LONG *vmb, float *m
 	m2[ind] += (float)(table[r] + table[g] + table[b]);
 }
 
+void
+WuQuantizer::Hist3DAddRows(Hist3D *hist, const uint32_t *argb, int argb_stride, int y_start, int y_end) {
+	const int *table = squares.values;
+
+	for(int y = y_start; y < y_end; y++) {
+		const uint32_t *line = argb + (size_t)argb_stride * y;
+		WORD *qadd_line = Qadd + (size_t)width * y;
+
+		for(unsigned x = 0; x < width; x++) {
+			int r = (line[x] >> 16) & 0xFF;
+			int g = (line[x] >> 8) & 0xFF;
+			int b = line[x] & 0xFF;
+
+			int inr = (r >> 3) + 1;
+			int ing = (g >> 3) + 1;
+			int inb = (b >> 3) + 1;
+			int ind = INDEX(inr, ing, inb);
+
+			qadd_line[x] = (WORD)ind;
+			hist->wt[ind]++;
+			hist->mr[ind] += r;
+			hist->mg[ind] += g;
+			hist->mb[ind] += b;
+			hist->m2[ind] += table[r] + table[g] + table[b];
+		}
+	}
+}
+
+WuHistogramBands::WuHistogramBands() {
+}
+
+WuHistogramBands::~WuHistogramBands() {
+	for(size_t i = 0; i < hists.size(); i++)
+		free(hists[i]);
+}
+
+int
+WuHistogramBands::Reserve(int n_bands) {
+	while((int)hists.size() < n_bands) {
+		WuQuantizer::Hist3D *hist = (WuQuantizer::Hist3D*)calloc(1, sizeof(WuQuantizer::Hist3D));
+		checkf(hist, "OOM");
+		hists.push_back(hist);
+	}
+
+	return 1;
+}
+
+// Each row band fills its own histogram, the bands are then summed up.
+// c^2 sums are kept as integers until the merge, so the result doesn't depend on the number of bands.
+// The merge clears the bands as it reads them, so they are ready for the next call without another pass.
+int
+WuQuantizer::AddPixels(const uint32_t *argb, int argb_stride, WuHistogramBands *bands) {
+	int n_bands = ParallelBandCount(height, MIN_PIXELS_PER_BAND / (width > 0 ? width : 1));
+
+	WuHistogramBands local_bands;
+	if(!bands)
+		bands = &local_bands;
+	check(bands->Reserve(n_bands));
+
+	Hist3D **hists = bands->hists.data();
+	int ok = ParallelForBands(ParallelGetSharedPool(), n_bands, height, [&](int band, int y_start, int y_end) {
+		Hist3DAddRows(hists[band], argb, argb_stride, y_start, y_end);
+		return 1;
+	});
+
+	for(int ind = 0; ind < SIZE_3D; ind++) {
+		LONG vwt = 0, vmr = 0, vmg = 0, vmb = 0;
+		INT64 vm2 = 0;
+		for(int band = 0; band < n_bands; band++) {
+			Hist3D *hist = hists[band];
+			vwt += hist->wt[ind];
+			vmr += hist->mr[ind];
+			vmg += hist->mg[ind];
+			vmb += hist->mb[ind];
+			vm2 += hist->m2[ind];
+			hist->wt[ind] = hist->mr[ind] = hist->mg[ind] = hist->mb[ind] = 0;
+			hist->m2[ind] = 0;
+		}
+
+		if(ok) {
+			wt[ind] += vwt;
+			mr[ind] += vmr;
+			mg[ind] += vmg;
+			mb[ind] += vmb;
+			gm2[ind] += (float)vm2;
+		}
+	}
+
+	return ok;
+}
+
 
 
 // At conclusion of the histogram step, we can interpret
@@ -418,8 +523,6 @@ WuQuantizer::Mark(Box *cube, int label, BYTE *tag) {
 // Wu Quantization algorithm
 int
 WuQuantizer::Build(int PaletteSize, void* ctx, void(*Visitor)(void* ctx, int i, uint8_t r, uint8_t g, uint8_t b)) {
-	BYTE *tag = NULL;
-
 	M3D(wt, mr, mg, mb, gm2);
 
 
@@ -468,7 +571,7 @@ WuQuantizer::Build(int PaletteSize, void* ctx, void(*Visitor)(void* ctx, int i,
 
 	gm2 = NULL;
 
-	// Allocate a new dib
+	// Box labels, kept for GetInverseMap
 	tag = (BYTE*) malloc(SIZE_3D * sizeof(BYTE));
 	checkf(tag, "OOM");
 
@@ -493,3 +596,19 @@ WuQuantizer::Build(int PaletteSize, void* ctx, void(*Visitor)(void* ctx, int i,
 
 	return 1;
 }
+
+int
+WuQuantizer::GetInverseMap(uint8_t *map, int index_offset) {
+	require(tag);
+
+	for (int r = 0; r < 32; r++) {
+		for (int g = 0; g < 32; g++) {
+			for (int b = 0; b < 32; b++) {
+				int inr = r + 1, ing = g + 1, inb = b + 1;
+				map[(r << 10) | (g << 5) | b] = (uint8_t)(tag[INDEX(inr, ing, inb)] + index_offset);
+			}
+		}
+	}
+
+	return 1;
+}
@@ -43,6 +43,12 @@ typedef long LONG;
 typedef signed __int64 INT64;
 typedef unsigned __int64 UINT64;
 #endif // _MSC_VER
+
+#include <cstddef>
+#include <vector>
+
+class WuHistogramBands;
+
 /**
   Xiaolin Wu color quantization algorithm
 */
@@ -64,12 +70,24 @@ protected:
     float *gm2;
     LONG *wt, *mr, *mg, *mb;
     WORD *Qadd;
+    BYTE *tag;
 
     // DIB data
     unsigned width, height;
 
+public:
+    // Partial histogram built by one row band before being merged
+    typedef struct tagHist3D {
+        LONG wt[35937];
+        LONG mr[35937];
+        LONG mg[35937];
+        LONG mb[35937];
+        INT64 m2[35937];
+    } Hist3D;
+
 protected:
     void Hist3DAddPixel(LONG *vwt, LONG *vmr, LONG *vmg, LONG *vmb, float *m2, int x, int y, uint8_t r, uint8_t g, uint8_t b);
+    void Hist3DAddRows(Hist3D *hist, const uint32_t *argb, int argb_stride, int y_start, int y_end);
     void M3D(LONG *vwt, LONG *vmr, LONG *vmg, LONG *vmb, float *m2);
     LONG Vol(Box *cube, LONG *mmt);
     LONG Bottom(Box *cube, BYTE dir, LONG *mmt);
@@ -88,7 +106,33 @@ public:
     ~WuQuantizer();
 
     void AddPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b);
+    // Adds a whole 32-bit ARGB image of the size given to Init, building the histogram in parallel row bands.
+    // The bands' histograms are those of `bands` when given, made for this call otherwise.
+    int AddPixels(const uint32_t *argb, int argb_stride, WuHistogramBands *bands = NULL);
     int Build(int PaletteSize, void* ctx, void(*Visitor)(void* ctx, int i, uint8_t r, uint8_t g, uint8_t b));
+    // After Build: fills a 32x32x32 table, indexed by (r >> 3) << 10 | (g >> 3) << 5 | (b >> 3),
+    // with the palette index (offset by index_offset) of the box each color falls into
+    int GetInverseMap(uint8_t *map, int index_offset);
+};
+
+// The histograms WuQuantizer::AddPixels fills, one per row band, on the threads of ParallelGetSharedPool.
+// Kept by callers quantizing frame after frame, so that the ~860 KB histograms are not made again for
+// every frame. Used by one AddPixels at a time.
+class WuHistogramBands
+{
+public:
+    WuHistogramBands();
+    ~WuHistogramBands();
+
+    WuHistogramBands(const WuHistogramBands&) = delete;
+    WuHistogramBands& operator=(const WuHistogramBands&) = delete;
+
+private:
+    friend class WuQuantizer;
+
+    int Reserve(int n_bands);
+
+    std::vector<WuQuantizer::Hist3D*> hists; // all zero between two AddPixels
 };
 
 
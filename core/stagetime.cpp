@@ -0,0 +1,102 @@
+#include "stagetime.h"
+
+#include <atomic>
+#include <chrono>
+
+static std::atomic<int> g_enabled(0);
+static std::atomic<int64_t> g_stage_ns[N_STAGES];
+static thread_local StageScope* t_innermost = nullptr;
+static thread_local StageTimes* t_bound = nullptr;
+
+static const char* const kStageNames[N_STAGES] = {
+    "decode",
+    "compose",
+    "crop",
+    "rescale",
+    "blur",
+    "quantize",
+    "encode",
+    "mux",
+    "write",
+};
+
+static int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void AddStageTime(Stage stage, int64_t ns) {
+    if (stage >= N_STAGES) {
+        return;
+    }
+
+    if (g_enabled.load(std::memory_order_relaxed)) {
+        g_stage_ns[stage].fetch_add(ns, std::memory_order_relaxed);
+    }
+    if (t_bound) {
+        t_bound->ns[stage].fetch_add(ns, std::memory_order_relaxed);
+    }
+}
+
+void StageTimesEnable(int enable) {
+    g_enabled.store(enable, std::memory_order_relaxed);
+}
+
+void StageTimesReset() {
+    for (auto& ns : g_stage_ns) {
+        ns.store(0, std::memory_order_relaxed);
+    }
+}
+
+void StageTimesGet(int64_t ns[N_STAGES]) {
+    for (int i=0; i<N_STAGES; ++i) {
+        ns[i] = g_stage_ns[i].load(std::memory_order_relaxed);
+    }
+}
+
+const char* StageGetName(Stage stage) {
+    return stage < N_STAGES ? kStageNames[stage] : "none";
+}
+
+StageTimesBinding::StageTimesBinding(StageTimes* times): _outer(t_bound) {
+    if (times) {
+        t_bound = times;
+    }
+}
+
+StageTimesBinding::~StageTimesBinding() {
+    t_bound = _outer;
+}
+
+StageTimes* StageTimesGetBound() {
+    return t_bound;
+}
+
+StageScope::StageScope(Stage stage, int traced):
+        _stage(stage), _active(0), _start_ns(0), _outer(nullptr),
+        _trace(traced && stage < N_STAGES ? kStageNames[stage] : nullptr) {
+    if (!t_bound && !g_enabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    _active = 1;
+    _start_ns = NowNs();
+    _outer = t_innermost;
+    if (_outer) {
+        AddStageTime(_outer->_stage, _start_ns - _outer->_start_ns);
+    }
+    t_innermost = this;
+}
+
+StageScope::~StageScope() {
+    if (!_active) {
+        return;
+    }
+
+    auto now = NowNs();
+    AddStageTime(_stage, now - _start_ns);
+    t_innermost = _outer;
+    if (_outer) {
+        _outer->_start_ns = now;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef ANIMTOOL_STAGETIME_H
+#define ANIMTOOL_STAGETIME_H
+
+#include "trace.h"
+
+#include <stdint.h>
+
+#include <atomic>
+
+typedef enum Stage {
+    STAGE_DECODE,
+    STAGE_COMPOSE,
+    STAGE_CROP,
+    STAGE_RESCALE,
+    STAGE_BLUR,
+    STAGE_QUANTIZE,
+    STAGE_ENCODE,
+    STAGE_MUX,
+    STAGE_WRITE,
+    N_STAGES,
+
+    STAGE_NONE = N_STAGES // not timed, e.g. the decode callbacks
+} Stage;
+
+// Process wide time spent in each stage, summed over all threads. Off by default.
+void StageTimesEnable(int enable);
+void StageTimesReset();
+void StageTimesGet(int64_t ns[N_STAGES]);
+const char* StageGetName(Stage stage);
+
+// Time spent in each stage by the threads bound to it, e.g. the threads of one job.
+struct StageTimes {
+    std::atomic<int64_t> ns[N_STAGES];
+};
+
+// Binds the calling thread to `times` for its lifetime, whether or not process wide timing is on.
+// A null `times` keeps the current binding.
+class StageTimesBinding {
+public:
+    explicit StageTimesBinding(StageTimes* times);
+    ~StageTimesBinding();
+
+    StageTimesBinding(const StageTimesBinding&) = delete;
+    StageTimesBinding& operator=(const StageTimesBinding&) = delete;
+
+private:
+    StageTimes* _outer;
+};
+
+// The StageTimes the calling thread is bound to, or null. Helper threads of a job bind to it.
+StageTimes* StageTimesGetBound();
+
+// Times its lifetime as `stage`. Scopes nest: an inner scope pauses the outer one of its thread,
+// so each stage only gets its own time. When timing is off, a scope costs a relaxed load.
+// Unless `traced` is 0, e.g. for scopes run per row, it is also recorded as a trace event.
+class StageScope {
+public:
+    explicit StageScope(Stage stage, int traced = 1);
+    ~StageScope();
+
+    StageScope(const StageScope&) = delete;
+    StageScope& operator=(const StageScope&) = delete;
+
+private:
+    Stage _stage;
+    int _active;
+    int64_t _start_ns;
+    StageScope* _outer;
+    TraceScope _trace;
+};
+
+#endif //ANIMTOOL_STAGETIME_H
@@ -0,0 +1,179 @@
+#include "trace.h"
+
+#include "check.h"
+#include "logger.h"
+#include "utils/defer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct TraceEvent {
+    const char* name;
+    int64_t start_ns;
+    int64_t end_ns;
+    int tid;
+};
+
+// An event as stored in a buffer, read by TraceWriteChromeJson while its owner may be overwriting it.
+struct TraceSlot {
+    std::atomic<const char*> name;
+    std::atomic<int64_t> start_ns;
+    std::atomic<int64_t> end_ns;
+    std::atomic<int> tid;
+};
+
+// Single producer ring and seqlock: only the owning thread writes. It bumps n_writing before writing an
+// event and n_events after, so a reader knows which of the events it copied may have been torn.
+struct TraceBuffer {
+    std::atomic<uint64_t> n_events {0}; // ever recorded; event n is at n % TRACE_BUFFER_CAPACITY
+    std::atomic<uint64_t> n_writing {0}; // n_events, or n_events + 1 while an event is written
+    TraceSlot events[TRACE_BUFFER_CAPACITY];
+};
+
+static std::atomic<int> g_enabled(0);
+static std::atomic<int64_t> g_start_ns(0);
+static std::atomic<int> g_next_tid(1);
+
+// Buffers are never freed: the buffer of a finished thread is handed to the next new thread,
+// so memory stays bounded by the number of threads alive at once.
+static std::mutex g_buffers_mutex;
+static std::vector<std::unique_ptr<TraceBuffer>> g_buffers;
+static std::vector<TraceBuffer*> g_free_buffers;
+
+struct ThreadTrace {
+    TraceBuffer* buffer = nullptr;
+    int tid = 0;
+
+    ~ThreadTrace() {
+        if (buffer) {
+            std::lock_guard<std::mutex> lock(g_buffers_mutex);
+            g_free_buffers.push_back(buffer);
+        }
+    }
+};
+
+static thread_local ThreadTrace t_trace;
+
+static int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void Record(const char* name, int64_t start_ns, int64_t end_ns) {
+    auto& trace = t_trace;
+    if (!trace.buffer) {
+        std::lock_guard<std::mutex> lock(g_buffers_mutex);
+        if (g_free_buffers.empty()) {
+            g_buffers.emplace_back(new TraceBuffer);
+            trace.buffer = g_buffers.back().get();
+        } else {
+            trace.buffer = g_free_buffers.back();
+            g_free_buffers.pop_back();
+        }
+        trace.tid = g_next_tid.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    auto buffer = trace.buffer;
+    auto n = buffer->n_events.load(std::memory_order_relaxed);
+    buffer->n_writing.store(n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto& slot = buffer->events[n % TRACE_BUFFER_CAPACITY];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start_ns.store(start_ns, std::memory_order_relaxed);
+    slot.end_ns.store(end_ns, std::memory_order_relaxed);
+    slot.tid.store(trace.tid, std::memory_order_relaxed);
+    buffer->n_events.store(n + 1, std::memory_order_release);
+}
+
+void TraceStart() {
+    g_start_ns.store(NowNs(), std::memory_order_relaxed);
+    g_enabled.store(1, std::memory_order_relaxed);
+}
+
+void TraceStop() {
+    g_enabled.store(0, std::memory_order_relaxed);
+}
+
+int TraceIsEnabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+int TraceWriteChromeJson(const char* path) {
+    auto file = fopen(path, "w");
+    checkf(file, "Failed to open %s", path);
+    defer(fclose(file));
+
+    auto start_ns = g_start_ns.load(std::memory_order_relaxed);
+    int n_events = 0;
+    int overflowed = 0;
+
+    fprintf(file, "{\"traceEvents\":[");
+
+    std::lock_guard<std::mutex> lock(g_buffers_mutex);
+    std::vector<TraceEvent> events;
+    for (auto& buffer : g_buffers) {
+        auto end = buffer->n_events.load(std::memory_order_acquire);
+        auto begin = end > TRACE_BUFFER_CAPACITY ? end - TRACE_BUFFER_CAPACITY : 0;
+
+        events.clear();
+        for (auto n = begin; n < end; ++n) {
+            auto& slot = buffer->events[n % TRACE_BUFFER_CAPACITY];
+            events.push_back(TraceEvent {
+                .name = slot.name.load(std::memory_order_relaxed),
+                .start_ns = slot.start_ns.load(std::memory_order_relaxed),
+                .end_ns = slot.end_ns.load(std::memory_order_relaxed),
+                .tid = slot.tid.load(std::memory_order_relaxed)
+            });
+        }
+
+        // the owner may still be recording: skip what it overwrote, or is overwriting, while we copied
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto now_end = buffer->n_writing.load(std::memory_order_relaxed);
+        auto valid_begin = now_end > TRACE_BUFFER_CAPACITY ? now_end - TRACE_BUFFER_CAPACITY : 0;
+        auto n_skipped = valid_begin > begin ? valid_begin - begin : 0;
+
+        for (auto i = n_skipped; i < events.size(); ++i) {
+            auto& event = events[i];
+            if (event.start_ns < start_ns) {
+                continue;
+            }
+
+            if (i == n_skipped && (begin > 0 || n_skipped > 0)) {
+                overflowed = 1;
+            }
+
+            fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"animtool\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                    n_events ? "," : "", event.name, (event.start_ns - start_ns) / 1e3,
+                    (event.end_ns - event.start_ns) / 1e3, event.tid);
+            ++n_events;
+        }
+    }
+
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    checkf(!ferror(file), "Failed to write %s", path);
+
+    if (overflowed) {
+        logger::w("The trace buffer of a thread overflowed, its oldest events are missing");
+    }
+    logger::i("%d trace events written to %s", n_events, path);
+
+    return 1;
+}
+
+TraceScope::TraceScope(const char* name): _name(nullptr), _start_ns(0) {
+    if (name && g_enabled.load(std::memory_order_relaxed)) {
+        _name = name;
+        _start_ns = NowNs();
+    }
+}
+
+TraceScope::~TraceScope() {
+    if (_name) {
+        Record(_name, _start_ns, NowNs());
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef ANIMTOOL_TRACE_H
+#define ANIMTOOL_TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_BUFFER_CAPACITY (1 << 14)
+
+// Records scopes as trace events into a ring buffer per thread, for chrome://tracing or Perfetto.
+// Off by default. When off, a scope costs a relaxed load.
+
+// Starts recording, dropping the events recorded so far.
+void TraceStart();
+void TraceStop();
+int TraceIsEnabled();
+
+// Writes the recorded events as Chrome trace JSON. Each thread keeps its latest
+// TRACE_BUFFER_CAPACITY events, older ones are overwritten. Threads may keep recording
+// meanwhile: the events they overwrite while being written out are left out.
+int TraceWriteChromeJson(const char* path);
+
+// Records its lifetime as an event. `name` must outlive the trace, e.g. a string literal.
+// A null name records nothing.
+class TraceScope {
+public:
+    explicit TraceScope(const char* name);
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* _name;
+    int64_t _start_ns;
+};
+
+#endif //ANIMTOOL_TRACE_H
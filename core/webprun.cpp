@@ -3,14 +3,27 @@
 //
 
 #include "webprun.h"
+#include "filemap.h"
+#include "frameindex.h"
 
 #include "../imageio/image_enc.h"
-#include "../imageio/imageio_util.h"
 #include "webp/demux.h"
 
 #include "check.h"
+#include "logger.h"
 #include "utils/defer.h"
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// Canvases hold RGBA bytes, read as native uint32_t pixels as WebPAnimDecoder does.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CHANNEL_SHIFT(i) (24 - (i) * 8)
+#else
+#define CHANNEL_SHIFT(i) ((i) * 8)
+#endif
+
 int WebPDecRunWithData(WebPData* webp_data, void* ctx, AnimDecRunCallback callback) {
     auto dec = WebPAnimDecoderNew(webp_data, nullptr);
     checkf(dec, "Failed to create decoder via WebPAnimDecoderNew.");
@@ -57,12 +70,280 @@ int WebPDecRunWithData(WebPData* webp_data, void* ctx, AnimDecRunCallback callba
     return 1;
 }
 
-int WebPDecRun(const char* file_path, void* ctx, AnimDecRunCallback callback) {
-    WebPData webp_data;
-    WebPDataInit(&webp_data);
-    defer(WebPDataClear(&webp_data));
+static int IsFullFrame(const FrameIndexEntry& frame, int canvas_width, int canvas_height) {
+    return frame.width == canvas_width && frame.height == canvas_height;
+}
 
-    check(ImgIoUtilReadFile(file_path, &webp_data.bytes, &webp_data.size));
+// A key frame does not depend on the frames before it: the first one, one covering the canvas without
+// blending, or one after a frame that cleared the whole canvas when disposed. Same rules as WebPAnimDecoder.
+static int IsKeyFrame(const FrameIndexEntry& curr, const FrameIndexEntry* prev, int canvas_width, int canvas_height) {
+    if (!prev) {
+        return 1;
+    }
+    if ((!curr.has_alpha || !curr.blend) && IsFullFrame(curr, canvas_width, canvas_height)) {
+        return 1;
+    }
+    return prev->dispose == FRAME_DISPOSE_BACKGROUND &&
+           (IsFullFrame(*prev, canvas_width, canvas_height) || prev->is_key_frame);
+}
+
+int WebPBuildFrameIndex(const WebPData* webp_data, int header_only, FrameIndex* index) {
+    auto demux = WebPDemux(webp_data);
+    checkf(demux, "Failed to parse the container via WebPDemux.");
+    defer(WebPDemuxDelete(demux));
+
+    index->header = FrameIndexHeader {
+        .format = FRAME_INDEX_WEBP,
+        .canvas_width = static_cast<int32_t>(WebPDemuxGetI(demux, WEBP_FF_CANVAS_WIDTH)),
+        .canvas_height = static_cast<int32_t>(WebPDemuxGetI(demux, WEBP_FF_CANVAS_HEIGHT)),
+        .bgcolor = WebPDemuxGetI(demux, WEBP_FF_BACKGROUND_COLOR),
+        .has_loop_count = 1,
+        .loop_count = static_cast<int32_t>(WebPDemuxGetI(demux, WEBP_FF_LOOP_COUNT))
+    };
+
+    index->frames.clear();
+    if (header_only) {
+        return 1;
+    }
+
+    auto n_frames = static_cast<int>(WebPDemuxGetI(demux, WEBP_FF_FRAME_COUNT));
+    index->frames.reserve(n_frames);
+
+    int timestamp = 0;
+    for (int i=0; i<n_frames; ++i) {
+        WebPIterator iter;
+        check(WebPDemuxGetFrame(demux, i + 1, &iter));
+        defer(WebPDemuxReleaseIterator(&iter));
+
+        FrameIndexEntry entry {
+            .offset = static_cast<uint64_t>(iter.fragment.bytes - webp_data->bytes),
+            .size = iter.fragment.size,
+            .x_offset = iter.x_offset,
+            .y_offset = iter.y_offset,
+            .width = iter.width,
+            .height = iter.height,
+            .start_ts = timestamp,
+            .end_ts = timestamp + iter.duration,
+            .dispose = iter.dispose_method == WEBP_MUX_DISPOSE_BACKGROUND ? FRAME_DISPOSE_BACKGROUND : FRAME_DISPOSE_NONE,
+            .blend = iter.blend_method == WEBP_MUX_BLEND,
+            .has_alpha = iter.has_alpha,
+            .is_key_frame = 0,
+            .gif_transparent_index = -1
+        };
+        entry.is_key_frame = IsKeyFrame(entry, i ? &index->frames.back() : nullptr,
+                                        index->header.canvas_width, index->header.canvas_height);
+
+        index->frames.push_back(entry);
+        timestamp = entry.end_ts;
+    }
+
+    return 1;
+}
+
+// Non premultiplied `src` over `dst`, rounded as WebPAnimDecoder does in MODE_RGBA, so that a seeked frame
+// is the same as the one decoded in sequence.
+static uint8_t BlendChannelNonPremult(uint32_t src, uint8_t src_a, uint32_t dst, uint8_t dst_a, uint32_t scale, int shift) {
+    const uint8_t src_channel = (src >> shift) & 0xff;
+    const uint8_t dst_channel = (dst >> shift) & 0xff;
+    const uint32_t blend_unscaled = src_channel * src_a + dst_channel * dst_a;
+    return (blend_unscaled * scale) >> CHANNEL_SHIFT(3);
+}
+
+static uint32_t BlendPixelNonPremult(uint32_t src, uint32_t dst) {
+    const uint8_t src_a = (src >> CHANNEL_SHIFT(3)) & 0xff;
+    if (src_a == 0) {
+        return dst;
+    }
+
+    const uint8_t dst_a = (dst >> CHANNEL_SHIFT(3)) & 0xff;
+    const uint8_t dst_factor_a = (dst_a * (256 - src_a)) >> 8;
+    const uint8_t blend_a = src_a + dst_factor_a;
+    const uint32_t scale = (1UL << 24) / blend_a;
+
+    const uint8_t blend_r = BlendChannelNonPremult(src, src_a, dst, dst_factor_a, scale, CHANNEL_SHIFT(0));
+    const uint8_t blend_g = BlendChannelNonPremult(src, src_a, dst, dst_factor_a, scale, CHANNEL_SHIFT(1));
+    const uint8_t blend_b = BlendChannelNonPremult(src, src_a, dst, dst_factor_a, scale, CHANNEL_SHIFT(2));
+
+    return (static_cast<uint32_t>(blend_r) << CHANNEL_SHIFT(0)) |
+           (static_cast<uint32_t>(blend_g) << CHANNEL_SHIFT(1)) |
+           (static_cast<uint32_t>(blend_b) << CHANNEL_SHIFT(2)) |
+           (static_cast<uint32_t>(blend_a) << CHANNEL_SHIFT(3));
+}
+
+// `src` is the new frame, blended over the disposed canvas `dst`, where it is not opaque.
+static void BlendRowNonPremult(uint8_t* src, const uint8_t* dst, int n) {
+    for (int i=0; i<n; ++i) {
+        uint32_t src_pixel, dst_pixel;
+        memcpy(&src_pixel, src + i * 4, 4);
+        if (((src_pixel >> CHANNEL_SHIFT(3)) & 0xff) == 0xff) {
+            continue;
+        }
+        memcpy(&dst_pixel, dst + i * 4, 4);
+        src_pixel = BlendPixelNonPremult(src_pixel, dst_pixel);
+        memcpy(src + i * 4, &src_pixel, 4);
+    }
+}
+
+static void ZeroFillRect(uint8_t* canvas, int canvas_width, const FrameIndexEntry& rect) {
+    for (int y=0; y<rect.height; ++y) {
+        memset(canvas + ((static_cast<size_t>(rect.y_offset) + y) * canvas_width + rect.x_offset) * 4, 0,
+               static_cast<size_t>(rect.width) * 4);
+    }
+}
+
+// Whether the canvas, the frame count and frames [first, last] of `frame_index` are those of the file.
+// The frames decoded are drawn at the offsets of the index: a stale one must not be used.
+static int WebPFrameIndexMatches(const WebPDemuxer* demux, const WebPData* webp_data, const FrameIndex* frame_index,
+                                 int first, int last) {
+    const auto& header = frame_index->header;
+    if (header.format != FRAME_INDEX_WEBP ||
+        static_cast<uint32_t>(header.canvas_width) != WebPDemuxGetI(demux, WEBP_FF_CANVAS_WIDTH) ||
+        static_cast<uint32_t>(header.canvas_height) != WebPDemuxGetI(demux, WEBP_FF_CANVAS_HEIGHT) ||
+        frame_index->frames.size() != WebPDemuxGetI(demux, WEBP_FF_FRAME_COUNT)) {
+        return 0;
+    }
+
+    for (int i=first; i<=last; ++i) {
+        const auto& frame = frame_index->frames[i];
+
+        WebPIterator iter;
+        if (!WebPDemuxGetFrame(demux, i + 1, &iter)) {
+            return 0;
+        }
+        defer(WebPDemuxReleaseIterator(&iter));
+
+        auto dispose = iter.dispose_method == WEBP_MUX_DISPOSE_BACKGROUND ? FRAME_DISPOSE_BACKGROUND : FRAME_DISPOSE_NONE;
+        if (frame.offset != static_cast<uint64_t>(iter.fragment.bytes - webp_data->bytes) ||
+            frame.size != iter.fragment.size ||
+            frame.x_offset != iter.x_offset || frame.y_offset != iter.y_offset ||
+            frame.width != iter.width || frame.height != iter.height ||
+            frame.dispose != dispose || frame.blend != (iter.blend_method == WEBP_MUX_BLEND) ||
+            frame.has_alpha != iter.has_alpha) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Decodes frame `index` onto `canvas`, from frame `key_index`, the last key frame before it.
+static int WebPDecodeFrameAt(const WebPDemuxer* demux, const FrameIndex* frame_index, int key_index, int index,
+                             std::vector<uint8_t>* canvas) {
+    const auto& frames = frame_index->frames;
+    const int canvas_width = frame_index->header.canvas_width;
+    const int canvas_height = frame_index->header.canvas_height;
+
+    logger::d("Seek to frame %d from key frame %d", index, key_index);
+
+    const size_t stride = static_cast<size_t>(canvas_width) * 4;
+    canvas->assign(stride * canvas_height, 0);
+    std::vector<uint8_t> prev_disposed;
+
+    for (int i=key_index; i<=index; ++i) {
+        const auto& frame = frames[i];
+
+        if (i > key_index) {
+            memcpy(canvas->data(), prev_disposed.data(), canvas->size());
+        }
+
+        WebPIterator iter;
+        check(WebPDemuxGetFrame(demux, i + 1, &iter));
+        defer(WebPDemuxReleaseIterator(&iter));
+
+        auto frame_origin = canvas->data() + frame.y_offset * stride + frame.x_offset * 4;
+        auto frame_size = stride * (frame.height - 1) + static_cast<size_t>(frame.width) * 4;
+        checkf(WebPDecodeRGBAInto(iter.fragment.bytes, iter.fragment.size, frame_origin, frame_size, static_cast<int>(stride)),
+               "Failed to decode frame %d", i);
+
+        // only pixels the previous frame did not clear are blended: the cleared ones are transparent
+        if (i > key_index && frame.blend) {
+            const auto& prev = frames[i - 1];
+            for (int y=0; y<frame.height; ++y) {
+                auto canvas_y = frame.y_offset + y;
+                auto row = canvas_y * stride;
+                auto x_start = frame.x_offset;
+                auto x_end = frame.x_offset + frame.width;
+
+                if (prev.dispose == FRAME_DISPOSE_BACKGROUND &&
+                    canvas_y >= prev.y_offset && canvas_y < prev.y_offset + prev.height) {
+                    auto left_end = std::min(x_end, prev.x_offset);
+                    auto right_start = std::max(x_start, prev.x_offset + prev.width);
+                    if (left_end > x_start) {
+                        BlendRowNonPremult(canvas->data() + row + x_start * 4, prev_disposed.data() + row + x_start * 4,
+                                           left_end - x_start);
+                    }
+                    if (x_end > right_start) {
+                        BlendRowNonPremult(canvas->data() + row + right_start * 4, prev_disposed.data() + row + right_start * 4,
+                                           x_end - right_start);
+                    }
+                    continue;
+                }
+
+                BlendRowNonPremult(canvas->data() + row + x_start * 4, prev_disposed.data() + row + x_start * 4,
+                                   x_end - x_start);
+            }
+        }
+
+        if (i < index) {
+            prev_disposed = *canvas;
+            if (frame.dispose == FRAME_DISPOSE_BACKGROUND) {
+                ZeroFillRect(prev_disposed.data(), canvas_width, frame);
+            }
+        }
+    }
+
+    return 1;
+}
+
+int WebPDecRunFrameWithData(WebPData* webp_data, const FrameIndex* frame_index, int index, void* ctx,
+                            AnimDecRunCallback callback, int* stale) {
+    require(frame_index && index >= 0 && stale);
+
+    auto demux = WebPDemux(webp_data);
+    checkf(demux, "Failed to parse the container via WebPDemux.");
+    defer(WebPDemuxDelete(demux));
+
+    auto n_frames = static_cast<int>(frame_index->frames.size());
+    auto has_frame = index < n_frames;
+    auto key_index = has_frame ? FrameIndexFindKeyFrame(frame_index, index) : 0;
+
+    *stale = !WebPFrameIndexMatches(demux, webp_data, frame_index, key_index, has_frame ? index : -1);
+    if (*stale) {
+        return 1;
+    }
+
+    int stop = 0;
+
+    const auto& header = frame_index->header;
+    AnimInfo anim_info {
+        .canvas_width = header.canvas_width,
+        .canvas_height = header.canvas_height,
+        .bgcolor = header.bgcolor,
+        .has_loop_count = header.has_loop_count,
+        .loop_count = header.loop_count
+    };
+
+    check(callback.on_start(ctx, &anim_info, &stop));
+    if (stop) return 1;
+
+    if (has_frame) {
+        std::vector<uint8_t> canvas;
+        check(WebPDecodeFrameAt(demux, frame_index, key_index, index, &canvas));
+
+        const auto& frame = frame_index->frames[index];
+        AnimFrame anim_frame{};
+        AnimFrameInitWithRGBA(&anim_frame, canvas.data(), anim_info.canvas_width, anim_info.canvas_height);
+        check(callback.on_frame(ctx, &anim_frame, frame.start_ts, frame.end_ts, &stop));
+    }
+
+    check(callback.on_end(ctx, &anim_info));
+    return 1;
+}
+
+int WebPDecRun(const char* file_path, void* ctx, AnimDecRunCallback callback) {
+    FileMap map;
+    check(FileMapOpen(file_path, &map));
+    defer(FileMapClose(&map));
 
-    return WebPDecRunWithData(&webp_data, ctx, callback);
+    return WebPDecRunWithData(&map.data, ctx, callback);
 }
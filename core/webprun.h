@@ -12,10 +12,20 @@ extern "C" {
 #endif
 
 typedef struct WebPData WebPData;
+struct FrameIndex;
 
 int WebPDecRun(const char* file_path, void* ctx, AnimDecRunCallback callback);
 int WebPDecRunWithData(WebPData* webp_data, void* ctx, AnimDecRunCallback callback);
 
+// Runs the callback on frame `index` only, decoding from the last key frame before it, found in
+// `frame_index`. Without such a frame, on_frame is not called. When `frame_index` is not that of
+// `webp_data`, sets `*stale` and returns without calling back.
+int WebPDecRunFrameWithData(WebPData* webp_data, const struct FrameIndex* frame_index, int index, void* ctx,
+                            AnimDecRunCallback callback, int* stale);
+
+// Builds the index of `webp_data`, or only its header when `header_only` is set.
+int WebPBuildFrameIndex(const WebPData* webp_data, int header_only, struct FrameIndex* index);
+
 #ifdef __cplusplus
 }
 #endif
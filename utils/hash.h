@@ -0,0 +1,24 @@
+#ifndef ANIMTOOL_HASH_H
+#define ANIMTOOL_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// 64-bit hash of a buffer, 8 bytes at a time. Not cryptographic.
+static inline uint64_t HashBytes(const uint8_t* bytes, size_t size) {
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+#endif //ANIMTOOL_HASH_H
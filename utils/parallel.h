@@ -0,0 +1,73 @@
+#ifndef ANIMTOOL_PARALLEL_H
+#define ANIMTOOL_PARALLEL_H
+
+#include "pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+static inline int ParallelGetThreadCount() {
+    auto n = static_cast<int>(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+}
+
+// Number of bands [0, n) should be split into, so that each band has at least `min_band_size` items
+// and there are no more bands than hardware threads.
+static inline int ParallelBandCount(int n, int min_band_size) {
+    auto n_bands = n / std::max(1, min_band_size);
+    return std::max(1, std::min(n_bands, ParallelGetThreadCount()));
+}
+
+static inline int ParallelBandStart(int n_bands, int n, int band) {
+    return static_cast<int>(static_cast<int64_t>(n) * band / n_bands);
+}
+
+// Threads shared by all the callers splitting work into bands, one per hardware thread but the calling one,
+// so that encoders or jobs running at the same time do not each bring as many threads as there are cores.
+// Made on first use. Its tasks must not wait for other tasks of the pool.
+inline ThreadPool* ParallelGetSharedPool() {
+    static ThreadPool pool(std::max(1, ParallelGetThreadCount() - 1), ParallelGetThreadCount() * 4);
+    return &pool;
+}
+
+// Splits [0, n) into `n_bands` contiguous bands and calls `fn(band, start, end)` for each of them.
+// The first band runs on the calling thread, the others on the threads of `pool`, e.g. the shared one,
+// so that splitting work often does not start threads every time. Returns 0 if any band failed.
+template <typename F>
+static int ParallelForBands(ThreadPool* pool, int n_bands, int n, F fn) {
+    if (n_bands <= 1) {
+        return fn(0, 0, n);
+    }
+
+    std::atomic<int> ok(1);
+    std::mutex mutex;
+    std::condition_variable done;
+    int n_pending = n_bands - 1;
+
+    for (int band=1; band<n_bands; ++band) {
+        auto start = ParallelBandStart(n_bands, n, band);
+        auto end = ParallelBandStart(n_bands, n, band + 1);
+        auto task = [&fn, &ok, &mutex, &done, &n_pending, band, start, end]() {
+            if (!fn(band, start, end)) ok = 0;
+
+            // notified under the lock: the caller cannot return, destroying all of this, before it is released
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--n_pending == 0) done.notify_one();
+        };
+        if (!pool->Submit(task)) {
+            task();
+        }
+    }
+
+    if (!fn(0, 0, ParallelBandStart(n_bands, n, 1))) ok = 0;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&n_pending]() { return n_pending == 0; });
+
+    return ok;
+}
+
+#endif //ANIMTOOL_PARALLEL_H
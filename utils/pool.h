@@ -0,0 +1,53 @@
+#ifndef ANIMTOOL_POOL_H
+#define ANIMTOOL_POOL_H
+
+#include "queue.h"
+
+#include <functional>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads running submitted tasks in FIFO order.
+// Submit blocks while `queue_capacity` tasks are already waiting.
+class ThreadPool {
+public:
+    typedef std::function<void()> Task;
+
+    ThreadPool(int n_threads, int queue_capacity): _tasks(queue_capacity) {
+        _threads.reserve(n_threads);
+        for (int i=0; i<n_threads; ++i) {
+            _threads.emplace_back([this]() {
+                Task task;
+                while (_tasks.Pop(&task)) {
+                    task();
+                }
+            });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        Join();
+    }
+
+    int Submit(Task task) {
+        return _tasks.Push(std::move(task));
+    }
+
+    // Runs what has been submitted so far, then stops the workers. Later submits fail.
+    void Join() {
+        _tasks.Close();
+        for (auto& thread : _threads) {
+            thread.join();
+        }
+        _threads.clear();
+    }
+
+private:
+    BoundedQueue<Task> _tasks;
+    std::vector<std::thread> _threads;
+};
+
+#endif //ANIMTOOL_POOL_H
@@ -0,0 +1,58 @@
+#ifndef ANIMTOOL_QUEUE_H
+#define ANIMTOOL_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// A blocking FIFO with a fixed capacity, used to join pipeline stages.
+// Push blocks while the queue is full, Pop blocks while it is empty.
+// Once closed, Push fails immediately and Pop drains what is left before failing.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(int capacity): _capacity(capacity), _closed(false) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    int Push(T item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_full.wait(lock, [this]() { return _closed || static_cast<int>(_items.size()) < _capacity; });
+        if (_closed)
+            return 0;
+
+        _items.push_back(std::move(item));
+        _not_empty.notify_one();
+        return 1;
+    }
+
+    int Pop(T* item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_empty.wait(lock, [this]() { return _closed || !_items.empty(); });
+        if (_items.empty())
+            return 0;
+
+        *item = std::move(_items.front());
+        _items.pop_front();
+        _not_full.notify_one();
+        return 1;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _not_empty.notify_all();
+        _not_full.notify_all();
+    }
+
+private:
+    const int _capacity;
+    bool _closed;
+    std::deque<T> _items;
+    std::mutex _mutex;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+};
+
+#endif //ANIMTOOL_QUEUE_H
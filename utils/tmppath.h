@@ -0,0 +1,20 @@
+#ifndef ANIMTOOL_TMPPATH_H
+#define ANIMTOOL_TMPPATH_H
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+
+// A path next to `path` for a temporary file later renamed over it: in the same directory, so the rename
+// stays on one file system, and unique to the calling thread and instant.
+static inline std::string TempPathFor(const std::string& path) {
+    char suffix[64];
+    auto nonce = std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+                 static_cast<size_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    snprintf(suffix, sizeof(suffix), ".%zx.tmp", nonce);
+    return path + suffix;
+}
+
+#endif //ANIMTOOL_TMPPATH_H